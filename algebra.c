@@ -3,28 +3,50 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
+#include <float.h>
+#include <stdint.h>
 #include "options.h"
 #include "csparse.h"
 #include "components.h"
 #include "algebra.h"
 #include "utility.h"
-extern double *G, *C;
+#include "blas.h"
+#include "threads.h"
+#include "amg.h"
+#include "reduce.h"
+
+#define LU_BLOCK 64
+#define SOLVE_PARALLEL_MIN 1024   // below this the substitutions stay sequential
+#define SOLVE_CHUNK 256
+#define ITER_STALL 500          // Krylov iterations without progress before giving up
+#define ITER_PAR_MIN 20000      // below this many unknowns a Krylov iteration stays on one thread
+
+extern double *G, *C, *LU;
 extern cs *G_s, *C_s;
 extern css* S;
 extern csn* N;
 
-static double *_r;
-static double *_p;
-static double *_temp;
-static double *_Ap ;
-static double *_z = NULL;
-void solve(double *m , int *P, double *sol,
+#define SOLVER_CONTEXTS 2  // the full system and its nodal reduction
+
+static solver_t *solver[SOLVER_CONTEXTS];  // most recently used first
+static long iter_count = 0, iter_solves = 0;  // Krylov work since the last iter_report()
+
+/* Nodal reduction (reduce.c) for the solvers that need an SPD matrix. It is
+ * rebuilt by decompose() and precond_setup() from the system matrix of the
+ * moment. Between system_enter() and system_leave() G and G_s are the
+ * reduced matrix, the callers keep passing the full vectors. */
+static reduce_t *reduction = NULL;
+static double *G_full = NULL;
+static cs *G_s_full = NULL;
+
+void solve(precond_t *M, int *P, double *sol,
 		double *rhs,int  size)
 {
 	if ( method_choice == NonIterative)
 		solve_lu(P, rhs, sol, size, method_noniter);
 	else
-		solve_iter(rhs, sol, m, size, method_iter);
+		solve_iter(rhs, sol, M, size, method_iter);
 }
 
 
@@ -38,12 +60,7 @@ void multiply_vector_scalar(double *vec, double scalar, double* output, int size
 
 
 double dot_vectors(double *v1, double *v2, int size ) {
-	int i =0;
-	double output = 0;
-
-	for (i=0; i<size; i++ )
-		output+= v1[i] * v2[i];
-	return output;
+	return vdot(size, v1, v2);
 }
 
 void multiply_vector_vector(double *v1, double *v2, double *output, int size) 
@@ -107,419 +124,2330 @@ int matrix_symmetric(double *mat, int size)
 }
 
 
-int Doolittle_LU_Decomposition_with_Pivoting(double *A, int pivot[], int n)
+/* Unblocked factorization of the panel A[k:n][k:k+nb]. The row swaps are only
+ * applied inside the panel, ipiv[j] records the row that became row k+j. */
+static int lu_panel(double *A, int n, int k, int nb, int *ipiv)
 {
-	int i, j, k, new_p;
-	double *p_k, *p_row, *p_col;
-	long double max;
-
-	for ( i=0; i<n; i ++ )
-		pivot[i] = i;
-
-	for (k = 0, p_k = A; k < n; p_k += n, k++) {
-
-		new_p = pivot[k];
-		max = fabs( *(p_k + k) );
-		for (j = k + 1, p_row = p_k + n; j < n; j++, p_row += n) {
-			if ( max < fabs(*(p_row + k)) ) {
-				max = fabs(*(p_row + k));
-				new_p = j;
-				p_col = p_row;
+	int i, j, l, new_p;
+	double *p_k, *p_row, max, tmp;
+
+	for (j = k; j < k+nb; j++) {
+		p_k = A + j*n;
+
+		new_p = j;
+		max = fabs(p_k[j]);
+		for (i = j+1, p_row = p_k + n; i < n; i++, p_row += n) {
+			if ( max < fabs(p_row[j]) ) {
+				max = fabs(p_row[j]);
+				new_p = i;
 			}
 		}
 
-		if (pivot[k] != new_p) {
-			for (j = 0; j < n; j++) {
-				max = *(p_k + j);
-				*(p_k + j) = *(p_col + j);
-				*(p_col + j) = max;
+		ipiv[j-k] = new_p;
+		if ( new_p != j ) {
+			p_row = A + new_p*n;
+			for (l = k; l < k+nb; l++) {
+				tmp = p_k[l];
+				p_k[l] = p_row[l];
+				p_row[l] = tmp;
 			}
-
-			max = pivot[new_p];
-			pivot[new_p] = pivot[k];
-			pivot[k] = max;
 		}
 
-
-		if ( *(p_k + k) == 0.0 ) {
+		if ( p_k[j] == 0.0 ) {
 			printf("[-] Failed to decompose LU\n");
 			return -1;
 		}
 
+		for (i = j+1, p_row = p_k + n; i < n; p_row += n, i++) {
+			p_row[j] /= p_k[j];
+
+			for (l = j+1; l < k+nb; l++)
+				p_row[l] -= p_row[j] * p_k[l];
+		}
+	}
+
+	return 0;
+}
+
+// replays the row swaps of panel k on the columns [c0,c1)
+static void lu_swap_rows(double *A, int n, int k, int nb, const int *ipiv, int c0, int c1)
+{
+	int j, l;
+	double tmp, *r1, *r2;
+
+	for ( j=0; j<nb; j++ ) {
+		if ( ipiv[j] == k+j )
+			continue;
+
+		r1 = A + (k+j)*n;
+		r2 = A + ipiv[j]*n;
+		for ( l=c0; l<c1; l++ ) {
+			tmp = r1[l];
+			r1[l] = r2[l];
+			r2[l] = tmp;
+		}
+	}
+}
+
+typedef struct DENSE_STEP_T
+{
+	double *A;
+	int n, k, nb;
+	int *ipiv;       // row swaps of panel k
+	int *next_ipiv;  // row swaps of the look-ahead panel
+	double *Lt;      // packed transpose of the Cholesky panel
+	int failed;
+} dense_step_t;
+
+/* Updates one block column of the trailing matrix with panel k. Task 0 owns
+ * the next panel and factors it right away (look-ahead), while the other
+ * threads are still busy with the rest of the trailing matrix. */
+static void lu_update_task(int id, int thread, void *arg)
+{
+	dense_step_t *st = (dense_step_t*) arg;
+	double *A = st->A;
+	int n = st->n, k = st->k, nb = st->nb;
+	int c0 = k + nb + id*LU_BLOCK;
+	int c1 = c0 + LU_BLOCK < n ? c0 + LU_BLOCK : n;
+
+	lu_swap_rows(A, n, k, nb, st->ipiv, c0, c1);
+
+	// U12 = inv(L11) * A12
+	dtrsm_lower_unit(nb, c1-c0, A + k*n + k, n, A + k*n + c0, n);
+
+	// A22 -= L21 * U12
+	dgemm_sub(n-k-nb, c1-c0, nb, A + (k+nb)*n + k, n, A + k*n + c0, n, A + (k+nb)*n + c0, n);
+
+	if ( id == 0 && lu_panel(A, n, c0, c1-c0, st->next_ipiv) != 0 )
+		st->failed = 1;
+}
+
+/* Right-looking blocked LU with partial pivoting and a look-ahead of one
+ * panel. Block columns of the trailing update run as parallel tasks; the task
+ * layout does not depend on the number of threads, so neither do the factors. */
+int Doolittle_LU_Decomposition_with_Pivoting(double *A, int pivot[], int n)
+{
+	int i, j, nb, *swap;
+	int ipiv[2][LU_BLOCK];
+	dense_step_t st;
+
+	for ( i=0; i<n; i ++ )
+		pivot[i] = i;
+
+	st.A = A;
+	st.n = n;
+	st.ipiv = ipiv[0];
+	st.next_ipiv = ipiv[1];
+	st.failed = 0;
 
-		for (i = k+1, p_row = p_k + n; i < n; p_row += n, i++) {
-			*(p_row + k) /= *(p_k + k);
-		}  
+	if ( lu_panel(A, n, 0, n < LU_BLOCK ? n : LU_BLOCK, st.ipiv) != 0 )
+		return -1;
 
+	for (st.k = 0; st.k < n; st.k += LU_BLOCK) {
+		st.nb = nb = n-st.k < LU_BLOCK ? n-st.k : LU_BLOCK;
 
-		for (i = k+1, p_row = p_k + n; i < n; p_row += n, i++)
-			for (j = k+1; j < n; j++)
-				*(p_row + j) -= *(p_row + k) * *(p_k + j);
+		if ( st.k+nb < n )
+			parallel_for((n-st.k-nb + LU_BLOCK-1) / LU_BLOCK, lu_update_task, &st);
 
+		lu_swap_rows(A, n, st.k, nb, st.ipiv, 0, st.k);
+		for ( j=0; j<nb; j++ ) {
+			i = pivot[st.ipiv[j]];
+			pivot[st.ipiv[j]] = pivot[st.k+j];
+			pivot[st.k+j] = i;
+		}
+
+		if ( st.failed )
+			return -1;
+
+		swap = st.ipiv;
+		st.ipiv = st.next_ipiv;
+		st.next_ipiv = swap;
 	}
 
 	return 0;
 }
 
-int Choleski_LU_Decomposition(double *A, int n)
+/* Cholesky of the panel A[k:n][k:k+nb], left-looking inside the panel. A
+ * non-positive pivot is replaced by 1 like the unblocked routine always did. */
+static void chol_panel(double *A, int n, int k, int nb)
 {
-	int i, k, p;
-	double *p_Lk0;                   // pointer to L[k][0]
-	double *p_Lkp;                   // pointer to L[k][p]  
-	double *p_Lkk;                   // pointer to diagonal element on row k.
-	double *p_Li0;                   // pointer to L[i][0]
-	double reciprocal;
+	int i, j, p;
+	double d, *p_j, *p_i;
+
+	for ( j=k; j<k+nb; j++ ) {
+		p_j = A + j*n;
+
+		d = p_j[j];
+		for ( p=k; p<j; p++ )
+			d -= p_j[p] * p_j[p];
+
+		if ( d <= 0.0 ) d = 1.0;
 
-	for (k = 0, p_Lk0 = A; k < n; p_Lk0 += n, k++) {
+		p_j[j] = sqrt(d);
 
-		//            Update pointer to row k diagonal element.   
+		for ( i=j+1, p_i = p_j + n; i<n; i++, p_i += n ) {
+			d = p_i[j];
+			for ( p=k; p<j; p++ )
+				d -= p_i[p] * p_j[p];
+			p_i[j] = d / p_j[j];
+		}
+	}
+}
+
+// A[c0:n][c0:c1] -= L21[c0:n] * L21[c0:c1]', task 0 factors the next panel
+static void chol_update_task(int id, int thread, void *arg)
+{
+	dense_step_t *st = (dense_step_t*) arg;
+	double *A = st->A;
+	int n = st->n, k = st->k, nb = st->nb, m = n-k-nb;
+	int c0 = k + nb + id*LU_BLOCK;
+	int c1 = c0 + LU_BLOCK < n ? c0 + LU_BLOCK : n;
+
+	dgemm_sub(n-c0, c1-c0, nb, A + c0*n + k, n, st->Lt + (c0-k-nb), m, A + c0*n + c0, n);
 
-		p_Lkk = p_Lk0 + k;
+	if ( id == 0 )
+		chol_panel(A, n, c0, c1-c0);
+}
 
-		//            Calculate the difference of the diagonal element in row k
-		//            from the sum of squares of elements row k from column 0 to 
-		//            column k-1.
+static void mirror_task(int id, int thread, void *arg)
+{
+	dense_step_t *st = (dense_step_t*) arg;
+	int i, j, n = st->n;
+	int r1 = (id+1)*LU_BLOCK < n ? (id+1)*LU_BLOCK : n;
 
-		for (p = 0, p_Lkp = p_Lk0; p < k; p_Lkp += 1,  p++)
-			*p_Lkk -= *p_Lkp * *p_Lkp;
+	for ( i=id*LU_BLOCK; i<r1; i++ )
+		for ( j=0; j<i; j++ )
+			st->A[j*n+i] = st->A[i*n+j];
+}
 
-		//            If diagonal element is not positive, return the error code,
-		//            the matrix is not positive definite symmetric.
+/* Blocked right-looking Cholesky with the same look-ahead scheme as the LU.
+ * L is left in the lower triangle and L' in the upper one. */
+int Choleski_LU_Decomposition(double *A, int n)
+{
+	int r, p, m;
+	dense_step_t st;
 
-		if ( *p_Lkk <= 0.0 ) *p_Lkk = 1.0;
+	st.A = A;
+	st.n = n;
+	st.Lt = (double*) malloc(sizeof(double) * (n > LU_BLOCK ? (n-LU_BLOCK)*LU_BLOCK : 1));
+	assert(st.Lt);
 
-		//            Otherwise take the square root of the diagonal element.
+	chol_panel(A, n, 0, n < LU_BLOCK ? n : LU_BLOCK);
 
-		*p_Lkk = sqrt( *p_Lkk );
-		reciprocal = 1.0 / *p_Lkk;
+	for (st.k = 0; st.k + LU_BLOCK < n; st.k += LU_BLOCK) {
+		st.nb = LU_BLOCK;
+		m = n - st.k - st.nb;
 
-		//            For rows i = k+1 to n-1, column k, calculate the difference
-		//            between the i,k th element and the inner product of the first
-		//            k-1 columns of row i and row k, then divide the difference by
-		//            the diagonal element in row k.
-		//            Store the transposed element in the upper triangular matrix.
+		for ( r=0; r<m; r++ )
+			for ( p=0; p<st.nb; p++ )
+				st.Lt[p*m + r] = A[(st.k+st.nb+r)*n + st.k+p];
 
-		p_Li0 = p_Lk0 + n;
-		for (i = k + 1; i < n; p_Li0 += n, i++) {
-			for (p = 0; p < k; p++)
-				*(p_Li0 + k) -= *(p_Li0 + p) * *(p_Lk0 + p);
-			*(p_Li0 + k) *= reciprocal;
-			*(p_Lk0 + i) = *(p_Li0 + k);
-		}  
+		parallel_for((m + LU_BLOCK-1) / LU_BLOCK, chol_update_task, &st);
 	}
+
+	parallel_for((n + LU_BLOCK-1) / LU_BLOCK, mirror_task, &st);
+
+	free(st.Lt);
 	return 0;
 }
-int decompose(int size, int **P, enum NonIterativeMethods type)
+
+/* Single precision copies of the blocked factorizations, for the mixed
+ * precision mode: half the memory traffic and twice the lanes per register.
+ * The accuracy is recovered by iterative refinement in solve_lu(). */
+static int lu_panel_float(float *A, int n, int k, int nb, int *ipiv)
 {
-	int i = 0;
+	int i, j, l, new_p;
+	float *p_k, *p_row, max, tmp;
+
+	for (j = k; j < k+nb; j++) {
+		p_k = A + j*n;
+
+		new_p = j;
+		max = fabsf(p_k[j]);
+		for (i = j+1, p_row = p_k + n; i < n; i++, p_row += n) {
+			if ( max < fabsf(p_row[j]) ) {
+				max = fabsf(p_row[j]);
+				new_p = i;
+			}
+		}
+
+		ipiv[j-k] = new_p;
+		if ( new_p != j ) {
+			p_row = A + new_p*n;
+			for (l = k; l < k+nb; l++) {
+				tmp = p_k[l];
+				p_k[l] = p_row[l];
+				p_row[l] = tmp;
+			}
+		}
 
-	if ( type == CholDecomp ) {
-		if ( voltages || inductors )
+		if ( p_k[j] == 0.0f )
 			return -1;
+
+		for (i = j+1, p_row = p_k + n; i < n; p_row += n, i++) {
+			p_row[j] /= p_k[j];
+
+			for (l = j+1; l < k+nb; l++)
+				p_row[l] -= p_row[j] * p_k[l];
+		}
 	}
 
-	if ( sparse_use == 0 ) {
-		switch ( type ) {
-			case LUDecomp:
-				if ( *P == NULL )
-					*P = (int*) malloc(size*sizeof(int));
+	return 0;
+}
 
-				return Doolittle_LU_Decomposition_with_Pivoting(G, *P, size);
-				break;
+static void lu_swap_rows_float(float *A, int n, int k, int nb, const int *ipiv, int c0, int c1)
+{
+	int j, l;
+	float tmp, *r1, *r2;
+
+	for ( j=0; j<nb; j++ ) {
+		if ( ipiv[j] == k+j )
+			continue;
+
+		r1 = A + (k+j)*n;
+		r2 = A + ipiv[j]*n;
+		for ( l=c0; l<c1; l++ ) {
+			tmp = r1[l];
+			r1[l] = r2[l];
+			r2[l] = tmp;
+		}
+	}
+}
 
-			case CholDecomp:
-				if ( *P == NULL )
-					*P = (int*) malloc(size* sizeof(int));
+typedef struct DENSE_STEP_FLOAT_T
+{
+	float *A;
+	int n, k, nb;
+	int *ipiv, *next_ipiv;
+	float *Lt;
+	int failed;
+} dense_step_float_t;
+
+static void lu_update_task_float(int id, int thread, void *arg)
+{
+	dense_step_float_t *st = (dense_step_float_t*) arg;
+	float *A = st->A;
+	int n = st->n, k = st->k, nb = st->nb;
+	int c0 = k + nb + id*LU_BLOCK;
+	int c1 = c0 + LU_BLOCK < n ? c0 + LU_BLOCK : n;
+
+	lu_swap_rows_float(A, n, k, nb, st->ipiv, c0, c1);
+	strsm_lower_unit(nb, c1-c0, A + k*n + k, n, A + k*n + c0, n);
+	sgemm_sub(n-k-nb, c1-c0, nb, A + (k+nb)*n + k, n, A + k*n + c0, n, A + (k+nb)*n + c0, n);
+
+	if ( id == 0 && lu_panel_float(A, n, c0, c1-c0, st->next_ipiv) != 0 )
+		st->failed = 1;
+}
 
-				for ( i=0; i<size; i++ )
-					(*P)[i] = i;
+// same steps as Doolittle_LU_Decomposition_with_Pivoting()
+static int LU_Decomposition_float(float *A, int pivot[], int n)
+{
+	int i, j, nb, *swap;
+	int ipiv[2][LU_BLOCK];
+	dense_step_float_t st;
 
-				return Choleski_LU_Decomposition(G, size);
-				break;
+	for ( i=0; i<n; i ++ )
+		pivot[i] = i;
 
-			default:
-				return -2;
-		}
-	} else {
-		cs *comp;
+	st.A = A;
+	st.n = n;
+	st.ipiv = ipiv[0];
+	st.next_ipiv = ipiv[1];
+	st.failed = 0;
 
-		comp = cs_compress(G_s);
+	if ( lu_panel_float(A, n, 0, n < LU_BLOCK ? n : LU_BLOCK, st.ipiv) != 0 )
+		return -1;
 
-		assert(comp);
+	for (st.k = 0; st.k < n; st.k += LU_BLOCK) {
+		st.nb = nb = n-st.k < LU_BLOCK ? n-st.k : LU_BLOCK;
 
-		switch( type ) {
-			case LUDecomp:
-				S = cs_sqr (2, comp, 0) ;              /* ordering and symbolic analysis */
-				N = cs_lu (comp, S, 1) ;                 /* numeric LU factorization */
-				break;
+		if ( st.k+nb < n )
+			parallel_for((n-st.k-nb + LU_BLOCK-1) / LU_BLOCK, lu_update_task_float, &st);
 
-			case CholDecomp:
-				S = cs_schol(1,comp);
-				N = cs_chol(comp,S);
-				break;
+		lu_swap_rows_float(A, n, st.k, nb, st.ipiv, 0, st.k);
+		for ( j=0; j<nb; j++ ) {
+			i = pivot[st.ipiv[j]];
+			pivot[st.ipiv[j]] = pivot[st.k+j];
+			pivot[st.k+j] = i;
 		}
 
-		if ( !S || !N )
+		if ( st.failed )
 			return -1;
+
+		swap = st.ipiv;
+		st.ipiv = st.next_ipiv;
+		st.next_ipiv = swap;
 	}
+
 	return 0;
 }
 
-int biconjugate_sparse(cs *A, double *x, double *b, double *m, double itol, int size){
-	double rsold;
-	double rsnew;
-	double alpha;
-	double beta;
-
-	int i;
+/* A non-positive pivot fails here instead of being replaced by 1: the
+ * refinement could not converge on such factors anyway. */
+static int chol_panel_float(float *A, int n, int k, int nb)
+{
+	int i, j, p;
+	float d, *p_j, *p_i;
 
-	settozero(_z, size);
-	settozero(_r, size);
-	settozero(_temp,size);
-	settozero(_Ap, size);
-	settozero(_p, size);
+	for ( j=k; j<k+nb; j++ ) {
+		p_j = A + j*n;
 
-	//multiply_matrix_vector(A, x, _p, size);
-	cs_gaxpy(A, x, _p); // gia na doulepsei swsta prepei _p=[0,...,0]
-	sub_vectors(b, _p, _r, size);
+		d = p_j[j];
+		for ( p=k; p<j; p++ )
+			d -= p_j[p] * p_j[p];
 
-	for( i = 0 ; i < size * size; i++){
-		multiply_vector_vector(_r,m,_z,size);
-		rsold = rsnew;
-		rsnew = dot_vectors(_z,_r,size);
-		if(!rsnew){
-			printf("biconjugate FAILS \n");
+		if ( d <= 0.0f )
 			return -1;
+
+		p_j[j] = sqrtf(d);
+
+		for ( i=j+1, p_i = p_j + n; i<n; i++, p_i += n ) {
+			d = p_i[j];
+			for ( p=k; p<j; p++ )
+				d -= p_i[p] * p_j[p];
+			p_i[j] = d / p_j[j];
 		}
-		if(i == 0 ){
-			memcpy(_p, _z, size*sizeof(double));
-		}
-		else{
-			beta = rsnew/rsold;
-			multiply_vector_scalar(_p,beta,_p,size);
-			add_vectors(_z,_p,_p,size);
-		}
-		
-		settozero(_Ap, size);
-		cs_gaxpy(A, _p, _Ap);
-		//multiply_matrix_vector(A,_p,_Ap,size);
-		alpha = rsnew/dot_vectors(_p,_Ap,size);
+	}
 
-		multiply_vector_scalar(_p,alpha,_temp,size);
-		add_vectors(x,_temp,x,size);
+	return 0;
+}
 
-		multiply_vector_scalar(_Ap,alpha,_temp,size);
-		sub_vectors(_r,_temp,_r,size);
+static void chol_update_task_float(int id, int thread, void *arg)
+{
+	dense_step_float_t *st = (dense_step_float_t*) arg;
+	float *A = st->A;
+	int n = st->n, k = st->k, nb = st->nb, m = n-k-nb;
+	int c0 = k + nb + id*LU_BLOCK;
+	int c1 = c0 + LU_BLOCK < n ? c0 + LU_BLOCK : n;
 
-		if ( sqrt(rsnew) < itol )
-			break;
+	sgemm_sub(n-c0, c1-c0, nb, A + c0*n + k, n, st->Lt + (c0-k-nb), m, A + c0*n + c0, n);
 
-	}
+	if ( id == 0 && chol_panel_float(A, n, c0, c1-c0) != 0 )
+		st->failed = 1;
+}
 
-	return 0;
+static void mirror_task_float(int id, int thread, void *arg)
+{
+	dense_step_float_t *st = (dense_step_float_t*) arg;
+	int i, j, n = st->n;
+	int r1 = (id+1)*LU_BLOCK < n ? (id+1)*LU_BLOCK : n;
+
+	for ( i=id*LU_BLOCK; i<r1; i++ )
+		for ( j=0; j<i; j++ )
+			st->A[j*n+i] = st->A[i*n+j];
 }
 
-void conjugate_sparse(cs *A, double *x, double *b, double *m, double itol, int size) {
-	double rsold;
-	double rsnew;
-	double alpha;
+// same steps as Choleski_LU_Decomposition()
+static int Choleski_Decomposition_float(float *A, int n)
+{
+	int r, p, m;
+	dense_step_float_t st;
 
-	int i;
+	st.A = A;
+	st.n = n;
+	st.failed = 0;
+	st.Lt = (float*) malloc(sizeof(float) * (n > LU_BLOCK ? (n-LU_BLOCK)*LU_BLOCK : 1));
+	assert(st.Lt);
 
-	settozero(_z, size);
-	settozero(_r, size);
-	settozero(_temp,size);
-	settozero(_Ap,size);
-	settozero(_p,size );
-	
-	cs_gaxpy(A, x, _p);
-	//multiply_matrix_vector(A, x, _p, size);
-	sub_vectors(b, _p, _r, size);
-	multiply_vector_vector(m, _r, _z, size);
+	st.failed = chol_panel_float(A, n, 0, n < LU_BLOCK ? n : LU_BLOCK) != 0;
 
-	memcpy(_p, _z, size*sizeof(double));
-	rsold = dot_vectors(_r,_z,size);
+	for (st.k = 0; st.k + LU_BLOCK < n && !st.failed; st.k += LU_BLOCK) {
+		st.nb = LU_BLOCK;
+		m = n - st.k - st.nb;
 
-	for (i=0; i<size * size; i++ ) {
-		settozero(_Ap,size);
-		cs_gaxpy(A, _p, _Ap);
-		// multiply_matrix_vector(A,_p, _Ap, size);
-		alpha = rsold/dot_vectors(_p, _Ap, size);
+		for ( r=0; r<m; r++ )
+			for ( p=0; p<st.nb; p++ )
+				st.Lt[p*m + r] = A[(st.k+st.nb+r)*n + st.k+p];
 
-		multiply_vector_scalar(_p, alpha, _temp, size);
-		add_vectors(x, _temp, x, size);
+		parallel_for((m + LU_BLOCK-1) / LU_BLOCK, chol_update_task_float, &st);
+	}
 
-		multiply_vector_scalar(_Ap, alpha, _temp, size);
-		sub_vectors(_r, _temp, _r, size);
+	free(st.Lt);
+	if ( st.failed )
+		return -1;
 
+	parallel_for((n + LU_BLOCK-1) / LU_BLOCK, mirror_task_float, &st);
+	return 0;
+}
 
-		multiply_vector_vector(m,_r,_z,size);
-		rsnew = dot_vectors(_z,_r, size);
+/* Factorization cache shared by the DC point, the .DC sweep and the transient.
+ * Entries are keyed by the sparsity pattern of the matrix (the symbolic part)
+ * and by a hash of its values (the numeric part). A value change on a known
+ * pattern only costs a numeric refactorization on top of the cached ordering.
+ * The hashes only pick the candidate. A sparse match is confirmed against a
+ * copy of the values the entry was built from; a dense one, where the copy
+ * would be another size^2 doubles per entry, against a second hash of them
+ * computed a different way. */
+#define FACTOR_CACHE_SIZE 4
+#define REFACTOR_PIVOT_TOL 1e-3
+#define FACTOR_PARALLEL_MIN 2000  // sparse systems below this are factorized sequentially
+#define SUBTREES_PER_THREAD 4
+#define SUPERNODAL_MIN_LNZ 200000  // smaller Cholesky factors are done column by column
+#define HASH_SEED 14695981039346656037ULL
+
+typedef struct FACTOR_T
+{
+	enum NonIterativeMethods type;
+	int size;
+	uint64_t pattern;       // hash of the sparsity pattern
+	uint64_t values;        // hash of the numeric values
+	int valid;              // numeric part matches 'values'
+	int *Ap, *Ai;           // sparse pattern of the matrix
+	double *Ax;             // sparse: copy of the values of the matrix
+	uint64_t check;         // dense: word-wise hash of the values, see hash_words
+
+	css *S;                 // sparse symbolic analysis
+	csn *N;                 // sparse numeric factorization
+	double *LU;             // dense factors
+	int *pivot;             // dense row permutation
+	cst *T;                 // subtrees of the etree for the parallel factorizations
+	cstri *Lrows, *Urows;   // level sets of the parallel triangular solves
+	csnf *Nf;               // mixed mode: single precision sparse factors
+	float *LUf;             // mixed mode: single precision dense factors
+	int mixed;              // the factors in use are the single precision ones
+	int mixed_failed;       // refinement stalled on this entry, it stays in double
+	double anorm;           // infinity norm of the matrix, scale of the refinement test
+} factor_t;
+
+static cstri *Lrows = NULL, *Urows = NULL;  // levels of the current factorization
+static factor_t *current = NULL;            // the entry decompose() handed out last
+
+static factor_t *factor_cache[FACTOR_CACHE_SIZE];
+
+static uint64_t hash_bytes(const void *data, size_t len, uint64_t h)
+{
+	const unsigned char *c = (const unsigned char*) data;
+	size_t i;
 
-		if ( sqrt(rsnew) < itol )
-			break;
+	for ( i=0; i<len; i++ ) {
+		h ^= c[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
 
-		multiply_vector_scalar(_p, rsnew/rsold, _p, size);
-		add_vectors(_z, _p, _p, size);
-		rsold = rsnew;
+// the values as 64-bit words, unrelated to hash_bytes so that both collide rarely
+static uint64_t hash_words(const double *x, long n)
+{
+	uint64_t h = HASH_SEED, w;
+	long i;
+
+	for ( i=0; i<n; i++ ) {
+		memcpy(&w, x + i, sizeof(w));
+		h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 32;
 	}
+	return h;
 }
 
-int biconjugate(double *A, double *x, double *b, double *m, double itol, int size){
-	double rsold;
-	double rsnew;
-	double alpha;
-	double beta;
+static void factor_free(factor_t *f)
+{
+	if ( f == NULL )
+		return;
+
+	cs_sfree(f->S);
+	cs_nfree(f->N);
+	cs_tsfree(f->T);
+	cs_tfree(f->Lrows);
+	cs_tfree(f->Urows);
+	cs_nffree(f->Nf);
+	free(f->LU);
+	free(f->LUf);
+	free(f->pivot);
+	free(f->Ap);
+	free(f->Ai);
+	free(f->Ax);
+	free(f);
+}
 
+void factor_cache_free()
+{
 	int i;
 
-	settozero(_z, size);
-	settozero(_r, size);
-	settozero(_temp, size);
-	settozero(_Ap, size);
-	settozero(_p, size);
+	for ( i=0; i<FACTOR_CACHE_SIZE; i++ ) {
+		factor_free(factor_cache[i]);
+		factor_cache[i] = NULL;
+	}
 
-	multiply_matrix_vector(A, x, _p, size);
-	sub_vectors(b, _p, _r, size);
+	S = NULL;
+	N = NULL;
+	LU = NULL;
+	Lrows = Urows = NULL;
+	current = NULL;
+}
 
-	for( i = 0 ; i < size * size; i++){
-		multiply_vector_vector(_r,m,_z,size);
-		rsold = rsnew;
-		rsnew = dot_vectors(_z,_r,size);
-		if(!rsnew){
-			printf("biconjugate FAILS \n");
-			return -1;
-		}
-		if(i == 0 ){
-			memcpy(_p, _z, size*sizeof(double));
-		}
-		else{
-			beta = rsnew/rsold;
-			multiply_vector_scalar(_p,beta,_p,size);
-			add_vectors(_z,_p,_p,size);
-		}
+static long factor_nnz(int size)
+{
+	return sparse_use ? G_s->p[G_s->n] : (long) size*size;
+}
 
-		multiply_matrix_vector(A,_p,_Ap,size);
-		alpha = rsnew/dot_vectors(_p,_Ap,size);
+// dense entries are keyed by the size alone
+static int factor_same_pattern(const factor_t *f)
+{
+	if ( sparse_use == 0 )
+		return 1;
 
-		multiply_vector_scalar(_p,alpha,_temp,size);
-		add_vectors(x,_temp,x,size);
+	return memcmp(f->Ap, G_s->p, sizeof(int)*(G_s->n+1)) == 0
+		&& memcmp(f->Ai, G_s->i, sizeof(int)*G_s->p[G_s->n]) == 0;
+}
 
-		multiply_vector_scalar(_Ap,alpha,_temp,size);
-		sub_vectors(_r,_temp,_r,size);
+static int factor_same_values(const factor_t *f)
+{
+	if ( sparse_use == 0 )
+		return f->check == hash_words(G, factor_nnz(f->size));
 
-		if ( sqrt(rsnew) < itol )
-			break;
+	return f->Ax && memcmp(f->Ax, G_s->x, sizeof(double)*factor_nnz(f->size)) == 0;
+}
 
+static void factor_keep_values(factor_t *f)
+{
+	long nnz = factor_nnz(f->size);
+
+	if ( sparse_use == 0 ) {
+		f->check = hash_words(G, nnz);
+		return;
 	}
 
-	return 0;
+	if ( f->Ax == NULL )
+		f->Ax = (double*) malloc(sizeof(double)*(nnz ? nnz : 1));
+	assert(f->Ax);
+	memcpy(f->Ax, G_s->x, sizeof(double)*nnz);
 }
 
-void conjugate(double *A, double *x, double *b, double *m, double itol, int size) {
-	if ( matrix_symmetric(A, size) == 0 ) {
-		printf("O pinakas den einai symmetrikos ( conjugate )\n");
-		exit(0);
+/* Returns the entry for (pattern, type, size) moved to the front of the
+ * cache, creating it and evicting the least recently used one if needed. */
+static factor_t *factor_lookup(uint64_t pattern, enum NonIterativeMethods type, int size)
+{
+	int i;
+	factor_t *f = NULL;
+
+	for ( i=0; i<FACTOR_CACHE_SIZE && factor_cache[i]; i++ ) {
+		if ( factor_cache[i]->pattern == pattern && factor_cache[i]->type == type
+				&& factor_cache[i]->size == size && factor_same_pattern(factor_cache[i]) ) {
+			f = factor_cache[i];
+			break;
+		}
 	}
 
-	double rsold;
-	double rsnew;
-	double alpha;
+	if ( f == NULL ) {
+		if ( i == FACTOR_CACHE_SIZE ) {
+			i--;
+			factor_free(factor_cache[i]);
+		}
 
-	int i;
-	settozero(x, size);
-	settozero(_z,size);
-	settozero(_r, size);
-	settozero(_temp, size);
-	settozero(_Ap, size);
-	settozero(_p, size);
-
-	multiply_matrix_vector(A, x, _p, size);
-	sub_vectors(b, _p, _r, size);
-	multiply_vector_vector(m, _r, _z, size);
-
-	memcpy(_p, _z, size*sizeof(double));
-	rsold = dot_vectors(_r,_z,size);
-	printf("$$$$$$$$$$$$$$$$$$$$$$ %lf \n",itol);
-	for (i=0; i<size*size; i++ ) {
-		multiply_matrix_vector(A,_p, _Ap, size);
-		alpha = rsold/dot_vectors(_p, _Ap, size);
+		f = (factor_t*) calloc(1, sizeof(factor_t));
+		assert(f);
+		f->type = type;
+		f->size = size;
+		f->pattern = pattern;
+
+		if ( sparse_use ) {
+			f->Ap = (int*) malloc(sizeof(int)*(size+1));
+			f->Ai = (int*) malloc(sizeof(int)*(G_s->p[size] ? G_s->p[size] : 1));
+			assert(f->Ap && f->Ai);
+			memcpy(f->Ap, G_s->p, sizeof(int)*(size+1));
+			memcpy(f->Ai, G_s->i, sizeof(int)*G_s->p[size]);
+		}
+	}
 
-		multiply_vector_scalar(_p, alpha, _temp, size);
-		add_vectors(x, _temp, x, size);
+	for ( ; i>0; i-- )
+		factor_cache[i] = factor_cache[i-1];
+	factor_cache[0] = f;
 
-		multiply_vector_scalar(_Ap, alpha, _temp, size);
-		sub_vectors(_r, _temp, _r, size);
+	return f;
+}
 
+// small systems are not worth the synchronization
+static int factor_parallel(factor_t *f)
+{
+	return f->size >= FACTOR_PARALLEL_MIN && threads_count() > 1;
+}
 
-		multiply_vector_vector(m,_r,_z,size);
-		rsnew = dot_vectors(_z,_r, size);
+/* Independent subtrees of the elimination tree, computed once per pattern.
+ * The LU uses the column etree of G(:,q), which contains the dependencies
+ * between the columns of L and U for any choice of the row pivots. */
+static cst *factor_schedule(factor_t *f)
+{
+	cs *C;
+	int *parent;
 
-		if ( sqrt(rsnew) < itol )
-			break;
+	if ( f->T )
+		return f->T;
 
-		multiply_vector_scalar(_p, rsnew/rsold, _p, size);
-		add_vectors(_z, _p, _p, size);
-		rsold = rsnew;
+	if ( f->type == CholDecomp ) {
+		f->T = cs_tschedule(f->S->parent, f->S->cp, f->size, SUBTREES_PER_THREAD*threads_count());
+	} else {
+		C = cs_permute(G_s, NULL, f->S->q, 0);
+		parent = C ? cs_etree(C, 1) : NULL;
+		f->T = cs_tschedule(parent, f->N->U->p, f->size, SUBTREES_PER_THREAD*threads_count());
+		cs_spfree(C);
+		cs_free(parent);
 	}
+
+	return f->T;
 }
 
-void solve_iter(double *b, double *x, double *m, int size, enum IterativeMethods type)
+/* Row-wise copies of the sparse factors with their level sets, for the
+ * parallel triangular solves. Built once per factorization pattern. */
+static void factor_levels(factor_t *f)
 {
-	if ( _z == NULL ) {
-		_z = (double* ) malloc(size* sizeof(double));
-		_temp = (double* ) malloc(size* sizeof(double));
-		_Ap = (double* ) malloc(size* sizeof(double));
-		_p = (double* ) malloc(size* sizeof(double));
-		_r = (double* ) malloc(size* sizeof(double));
-	}
+	f->Lrows = cs_tfree(f->Lrows);
+	f->Urows = cs_tfree(f->Urows);
 
-	if ( sparse_use == 0 ) {
-		if ( type == BiCG ) {
-			biconjugate(G, x, b, m, itol, size);
-		} else if (type == CG) {
-			conjugate(G, x, b, m, itol, size);
-		} else
-			assert( 0 && "Invalid Iterative Method");
-	} else {
-		if ( type == BiCG ) {
-			biconjugate_sparse(G_s, x, b, m, itol, size);
-		} else if (type == CG) {
-			conjugate_sparse(G_s, x, b, m, itol, size);
-		} else
-			assert( 0 && "Invalid Iterative Method");
+	if ( !factor_parallel(f) )
+		return;
+
+	f->Lrows = cs_tlevels(f->N->L, 1, 0);
+	if ( f->type == CholDecomp )
+		f->Urows = cs_tlevels(f->N->L, 0, 1);
+	else
+		f->Urows = cs_tlevels(f->N->U, 0, 0);
+
+	if ( !f->Lrows || !f->Urows ) {
+		f->Lrows = cs_tfree(f->Lrows);
+		f->Urows = cs_tfree(f->Urows);
 	}
 }
 
-void solve_lu(int *p, double *b, double *x, int size, enum NonIterativeMethods type)
+// infinity norm of the system matrix, dense or sparse
+static double system_norm(int size)
 {
-	int i, j;
+	int i, j, p;
+	double s, max = 0, *row;
 
 	if ( sparse_use == 0 ) {
-		for (i=0; i<size; i++ ) {
-			x[i] = b[p[i]];
+		for ( i=0; i<size; i++ ) {
+			for ( s=0, j=0; j<size; j++ )
+				s += fabs(G[i*size+j]);
+			if ( s > max )
+				max = s;
+		}
+		return max;
+	}
 
-			for ( j=0; j<i; j++ )
-				x[i] -= x[j] * G[i*size+j];
+	row = (double*) calloc(size, sizeof(double));
+	assert(row);
 
-			if ( type == CholDecomp )
-				x[i] /= G[i*size+i];
-		} 
+	for ( j=0; j<G_s->n; j++ )
+		for ( p=G_s->p[j]; p<G_s->p[j+1]; p++ )
+			row[G_s->i[p]] += fabs(G_s->x[p]);
+
+	for ( i=0; i<size; i++ )
+		if ( row[i] > max )
+			max = row[i];
+
+	free(row);
+	return max;
+}
 
-		for ( i=size-1; i>=0; i-- ) {
-			for ( j=i+1; j<size; j++ )
-				x[i] -= x[j] * G[i*size+j];
+/* Single precision factors for the mixed mode, only one set of factors is
+ * kept so the double ones are dropped. The sparse factorization is the
+ * sequential one: the refinement recovers the accuracy, not the speed of
+ * the parallel and supernodal variants. */
+static int factor_numeric_float(factor_t *f)
+{
+	int i, size = f->size;
+
+	f->mixed = 0;
+	f->anorm = system_norm(size);
 
-			x[i] /= G[i*size+i];
+	if ( sparse_use == 0 ) {
+		free(f->LU);
+		f->LU = NULL;
+		if ( f->LUf == NULL )
+			f->LUf = (float*) malloc(sizeof(float)*size*size);
+		if ( f->pivot == NULL )
+			f->pivot = (int*) malloc(sizeof(int)*size);
+		assert(f->LUf && f->pivot);
+
+		for ( i=0; i<size*size; i++ )
+			f->LUf[i] = (float) G[i];
+
+		if ( f->type == LUDecomp ) {
+			if ( LU_Decomposition_float(f->LUf, f->pivot, size) != 0 )
+				return -1;
+		} else if ( f->type == CholDecomp ) {
+			for ( i=0; i<size; i++ )
+				f->pivot[i] = i;
+
+			if ( Choleski_Decomposition_float(f->LUf, size) != 0 )
+				return -1;
+		} else {
+			return -2;
 		}
 	} else {
-		if ( type == CholDecomp )
-			cs_cholsol(S, N, b, x, size);
-		else if ( type == LUDecomp )
-			cs_lusol(S, N, b, x, size);
-		else
-			assert(0);
+		f->N = cs_nfree(f->N);
+		f->Nf = cs_nffree(f->Nf);
+		f->Lrows = cs_tfree(f->Lrows);
+		f->Urows = cs_tfree(f->Urows);
+
+		if ( f->type == LUDecomp ) {
+			if ( f->S == NULL )
+				f->S = cs_sqr(2, G_s, 0);
+			if ( f->S )
+				f->Nf = cs_lu_float(G_s, f->S, 1);
+		} else if ( f->type == CholDecomp ) {
+			if ( f->S == NULL )
+				f->S = cs_schol(1, G_s);
+			if ( f->S )
+				f->Nf = cs_chol_float(G_s, f->S);
+		} else {
+			return -2;
+		}
+
+		if ( f->Nf == NULL )
+			return -1;
 	}
 
+	f->mixed = 1;
+	return 0;
 }
 
+static int factor_numeric(factor_t *f)
+{
+	int i, size = f->size, refactored = 0;
+
+	f->valid = 0;
+
+	if ( mixed_use && !f->mixed_failed ) {
+		if ( factor_numeric_float(f) == 0 ) {
+			f->valid = 1;
+			return 0;
+		}
+		f->mixed_failed = 1;  // a zero or negative pivot in single precision
+	}
+
+	f->mixed = 0;
+	f->Nf = cs_nffree(f->Nf);
+	free(f->LUf);
+	f->LUf = NULL;
+
+	if ( sparse_use == 0 ) {
+		if ( f->LU == NULL )
+			f->LU = (double*) malloc(sizeof(double)*size*size);
+		if ( f->pivot == NULL )
+			f->pivot = (int*) malloc(sizeof(int)*size);
+		assert(f->LU && f->pivot);
+
+		memcpy(f->LU, G, sizeof(double)*size*size);
+
+		switch ( f->type ) {
+			case LUDecomp:
+				if ( Doolittle_LU_Decomposition_with_Pivoting(f->LU, f->pivot, size) != 0 )
+					return -1;
+				break;
+
+			case CholDecomp:
+				for ( i=0; i<size; i++ )
+					f->pivot[i] = i;
+
+				if ( Choleski_LU_Decomposition(f->LU, size) != 0 )
+					return -1;
+				break;
+
+			default:
+				return -2;
+		}
+	} else {
+		switch( f->type ) {
+			case LUDecomp:
+				if ( f->N && factor_parallel(f) && factor_schedule(f) )
+					refactored = cs_relu_par(G_s, f->S, f->N, REFACTOR_PIVOT_TOL, f->T, parallel_for, threads_count());
+				else if ( f->N )
+					refactored = cs_relu(G_s, f->S, f->N, REFACTOR_PIVOT_TOL);
+
+				if ( refactored )
+					break;
+
+				f->N = cs_nfree(f->N);
+				if ( f->S == NULL )
+					f->S = cs_sqr (2, G_s, 0) ;              /* ordering and symbolic analysis */
+				if ( f->S )
+					f->N = cs_lu (G_s, f->S, 1) ;            /* numeric LU factorization */
+				break;
+
+			case CholDecomp:
+				f->N = cs_nfree(f->N);
+				if ( f->S == NULL )
+					f->S = cs_schol(1,G_s);
+				if ( f->S && f->S->lnz >= SUPERNODAL_MIN_LNZ )
+					f->N = cs_chol_super(G_s, f->S);
+				else if ( f->S && factor_parallel(f) && factor_schedule(f) )
+					f->N = cs_chol_par(G_s, f->S, f->T, parallel_for, threads_count());
+				else if ( f->S )
+					f->N = cs_chol(G_s,f->S);
+				break;
+
+			default:
+				return -2;
+		}
+
+		if ( !f->S || !f->N )
+			return -1;
+
+		// same pattern: the levels only need the new values
+		if ( refactored && f->Lrows ) {
+			cs_tvalues(f->Lrows, f->N->L);
+			cs_tvalues(f->Urows, f->N->U);
+		} else {
+			factor_levels(f);
+		}
+	}
+
+	f->valid = 1;
+	return 0;
+}
+
+// voltage sources or inductors, and a solver that needs the SPD nodal matrix
+static int reduce_wanted()
+{
+	if ( voltages + inductors == 0 )
+		return 0;
+	if ( reduce_use )
+		return 1;
+	if ( method_choice == NonIterative )
+		return method_noniter == CholDecomp;
+	return method_iter == CG;
+}
+
+// rebuilds the reduction from the system matrix in G/G_s
+static void system_reduce(int size)
+{
+	int rsize = reduction ? reduction->rsize : -1;
+
+	reduction = reduce_free(reduction);
+	if ( !reduce_wanted() )
+		return;
+
+	reduction = reduce_setup(sparse_use ? NULL : G, sparse_use ? G_s : NULL, size, size - voltages - inductors);
+
+	if ( reduction == NULL )
+		printf("[-] Nodal reduction failed (loop of voltage sources?), solving the full system\n");
+	else if ( reduction->rsize != rsize )
+		printf("[+] Nodal reduction: %d -> %d unknowns\n", size, reduction->rsize);
+}
+
+// makes the reduced matrix the system matrix, returns its size
+static int system_enter(int size)
+{
+	if ( reduction == NULL )
+		return size;
+
+	G_full = G;
+	G_s_full = G_s;
+	G = reduction->G;
+	G_s = reduction->G_s;
+
+	return reduction->rsize;
+}
+
+static void system_leave()
+{
+	if ( reduction == NULL )
+		return;
+
+	G = G_full;
+	G_s = G_s_full;
+}
+
+static int factor_system(int size, int *P, enum NonIterativeMethods type)
+{
+	factor_t *f;
+	uint64_t pattern, values;
+
+	// the branch rows make the full MNA matrix indefinite
+	if ( type == CholDecomp && (voltages || inductors) && reduction == NULL )
+		return -1;
+
+	if ( sparse_use == 0 ) {
+		pattern = hash_bytes(&size, sizeof(int), HASH_SEED);
+		values = hash_bytes(G, sizeof(double)*size*size, HASH_SEED);
+	} else {
+		pattern = hash_bytes(&G_s->m, sizeof(int), HASH_SEED);
+		pattern = hash_bytes(G_s->p, sizeof(int)*(G_s->n+1), pattern);
+		pattern = hash_bytes(G_s->i, sizeof(int)*G_s->p[G_s->n], pattern);
+		values = hash_bytes(G_s->x, sizeof(double)*G_s->p[G_s->n], HASH_SEED);
+	}
+
+	f = factor_lookup(pattern, type, size);
+
+	if ( !f->valid || f->values != values || !factor_same_values(f) ) {
+#ifdef VERBOSE
+		printf("[$] %s factorization\n", f->S || f->LU ? "Numeric" : "Full");
+#endif
+		f->values = values;
+		factor_keep_values(f);
+		if ( factor_numeric(f) != 0 )
+			return -1;
+	}
+
+	S = f->S;
+	N = f->N;
+	LU = f->LU;
+	Lrows = f->Lrows;
+	Urows = f->Urows;
+	current = f;
+
+	if ( sparse_use == 0 )
+		memcpy(P, f->pivot, sizeof(int)*size);
+
+	return 0;
+}
+
+int decompose(int size, int **P, enum NonIterativeMethods type)
+{
+	int ret;
+
+	system_reduce(size);
+
+	// full size, the reduced systems of the DC point and the transient differ
+	if ( sparse_use == 0 && *P == NULL ) {
+		*P = (int*) malloc(size*sizeof(int));
+		assert(*P);
+	}
+
+	size = system_enter(size);
+	ret = factor_system(size, *P, type);
+	system_leave();
+
+	return ret;
+}
+
+/* The old size*size cap, without the int overflow past 46340 unknowns */
+static int iter_max(int size)
+{
+	return size < 46340 ? size*size : INT_MAX;
+}
+
+enum VecOps { VecDot, VecAxpyDot, VecScaleDot, VecAxpy2, VecXpby };
+
+typedef struct VEC_JOB_T
+{
+	enum VecOps op;
+	const int *start;
+	double a, b;
+	const double *x, *p, *q;
+	double *y, *z;
+	double *partial;
+} vec_job_t;
+
+static void vec_task(int id, int thread, void *arg)
+{
+	vec_job_t *job = (vec_job_t*) arg;
+	int i = job->start[id], n = job->start[id+1] - i;
+
+	switch ( job->op ) {
+		case VecDot:
+			job->partial[id] = vdot(n, job->x + i, job->p + i);
+			break;
+		case VecAxpyDot:
+			job->partial[id] = vaxpy_dot(n, job->a, job->x + i, job->y + i);
+			break;
+		case VecScaleDot:
+			job->partial[id] = vscale_dot(n, job->x + i, job->p + i, job->y + i);
+			break;
+		case VecAxpy2:
+			vaxpy2(n, job->a, job->p + i, job->y + i, job->b, job->q + i, job->z + i);
+			break;
+		case VecXpby:
+			vxpby(n, job->x + i, job->b, job->y + i);
+			break;
+	}
+}
+
+/* Runs a vector kernel over the blocks of ws, each on the thread that owns the
+ * matching rows of the matrix, and sums the partial dots in block order so the
+ * result does not depend on the scheduling. */
+static double vec_run(solver_t *ws, vec_job_t *job)
+{
+	int k;
+	double s = 0;
+
+	job->start = ws->start;
+	job->partial = ws->partial;
+	parallel_for_pinned(ws->parts, vec_task, job);
+
+	for ( k=0; k<ws->parts; k++ )
+		s += ws->partial[k];
+	return s;
+}
+
+static double pdot(solver_t *ws, const double *x, const double *y)
+{
+	vec_job_t job = { VecDot };
+
+	if ( ws->parts == 1 )
+		return vdot(ws->size, x, y);
+
+	job.x = x;
+	job.p = y;
+	return vec_run(ws, &job);
+}
+
+static double paxpy_dot(solver_t *ws, double a, const double *x, double *y)
+{
+	vec_job_t job = { VecAxpyDot };
+
+	if ( ws->parts == 1 )
+		return vaxpy_dot(ws->size, a, x, y);
+
+	job.a = a;
+	job.x = x;
+	job.y = y;
+	return vec_run(ws, &job);
+}
+
+static double pscale_dot(solver_t *ws, const double *d, const double *r, double *z)
+{
+	vec_job_t job = { VecScaleDot };
+
+	if ( ws->parts == 1 )
+		return vscale_dot(ws->size, d, r, z);
+
+	job.x = d;
+	job.p = r;
+	job.y = z;
+	return vec_run(ws, &job);
+}
+
+static void paxpy2(solver_t *ws, double a, const double *p, double *x,
+		double b, const double *q, double *y)
+{
+	vec_job_t job = { VecAxpy2 };
+
+	if ( ws->parts == 1 ) {
+		vaxpy2(ws->size, a, p, x, b, q, y);
+		return;
+	}
+
+	job.a = a;
+	job.p = p;
+	job.y = x;
+	job.b = b;
+	job.q = q;
+	job.z = y;
+	vec_run(ws, &job);
+}
+
+static void pxpby(solver_t *ws, const double *x, double b, double *y)
+{
+	vec_job_t job = { VecXpby };
+
+	if ( ws->parts == 1 ) {
+		vxpby(ws->size, x, b, y);
+		return;
+	}
+
+	job.x = x;
+	job.b = b;
+	job.y = y;
+	vec_run(ws, &job);
+}
+
+/* y = A*x, in the tuned format when ws holds A */
+static void sparse_matvec(solver_t *ws, cs *A, double *x, double *y)
+{
+	if ( ws->A && ws->A->A == A ) {
+		cs_spmv(ws->A, x, y, parallel_for_pinned);
+		return;
+	}
+
+	settozero(y, ws->size);
+	cs_gaxpy(A, x, y);
+}
+
+static void jacobi_apply(const precond_t *M, const double *r, double *z);
+
+/* z = M^-1 * r and returns z'r, in one pass for the Jacobi preconditioner */
+static double precond_dot(solver_t *ws, precond_t *M, double *r, double *z)
+{
+	if ( M->apply == jacobi_apply )
+		return pscale_dot(ws, M->d, r, z);
+
+	M->apply(M, r, z);
+	return pdot(ws, z, r);
+}
+
+/* Ends a Krylov loop whose residual turned into NaN or has not dropped by 1%
+ * for ITER_STALL iterations, instead of spinning until iter_max. */
+static int iter_stalled(const char *name, int it, double res, double *best, int *since)
+{
+	if ( isnan(res) || isinf(res) ) {
+		printf("[-] %s: breakdown at iteration %d\n", name, it);
+		return 1;
+	}
+
+	if ( res < 0.99 * *best ) {
+		*best = res;
+		*since = 0;
+		return 0;
+	}
+
+	if ( ++*since < ITER_STALL )
+		return 0;
+
+	printf("[-] %s stagnated at iteration %d, residual %g\n", name, it, res);
+	return 1;
+}
+
+int biconjugate_sparse(solver_t *ws, cs *A, double *x, double *b, precond_t *M, double itol, int size){
+	double rsold;
+	double rsnew;
+	double alpha;
+	double beta;
+
+	int i, since = 0;
+	double best = HUGE_VAL;
+
+
+	//multiply_matrix_vector(A, x, ws->p, size);
+	sparse_matvec(ws, A, x, ws->p);
+	sub_vectors(b, ws->p, ws->r, size);
+
+	for( i = 0 ; i < iter_max(size); i++){
+		iter_count++;
+		rsold = rsnew;
+		rsnew = precond_dot(ws, M, ws->r, ws->z);
+		if(!rsnew){
+			printf("biconjugate FAILS \n");
+			return -1;
+		}
+		if(i == 0 ){
+			memcpy(ws->p, ws->z, size*sizeof(double));
+		}
+		else{
+			beta = rsnew/rsold;
+			pxpby(ws, ws->z, beta, ws->p);
+		}
+		
+		sparse_matvec(ws, A, ws->p, ws->Ap);
+		//multiply_matrix_vector(A,ws->p,ws->Ap,size);
+		alpha = rsnew/pdot(ws, ws->p, ws->Ap);
+
+		paxpy2(ws, alpha, ws->p, x, -alpha, ws->Ap, ws->r);
+
+		if ( sqrt(rsnew) < itol )
+			break;
+
+		if ( iter_stalled("BiCG", i, sqrt(fabs(rsnew)), &best, &since) )
+			break;
+
+	}
+
+	return 0;
+}
+
+void conjugate_sparse(solver_t *ws, cs *A, double *x, double *b, precond_t *M, double itol, int size) {
+	double rsold;
+	double rsnew;
+	double alpha;
+
+	int i, since = 0;
+	double best = HUGE_VAL;
+
+	
+	sparse_matvec(ws, A, x, ws->p);
+	//multiply_matrix_vector(A, x, ws->p, size);
+	sub_vectors(b, ws->p, ws->r, size);
+	rsold = precond_dot(ws, M, ws->r, ws->z);
+	memcpy(ws->p, ws->z, size*sizeof(double));
+
+	for (i=0; i < iter_max(size); i++ ) {
+		iter_count++;
+		sparse_matvec(ws, A, ws->p, ws->Ap);
+		// multiply_matrix_vector(A,ws->p, ws->Ap, size);
+		alpha = rsold/pdot(ws, ws->p, ws->Ap);
+
+		// x += alpha*p and r -= alpha*Ap in one pass, then z = M^-1*r with z'r
+		paxpy2(ws, alpha, ws->p, x, -alpha, ws->Ap, ws->r);
+		rsnew = precond_dot(ws, M, ws->r, ws->z);
+
+		if ( sqrt(rsnew) < itol )
+			break;
+
+		if ( iter_stalled("CG", i, sqrt(fabs(rsnew)), &best, &since) )
+			break;
+
+		pxpby(ws, ws->z, rsnew/rsold, ws->p);
+		rsold = rsnew;
+	}
+}
+
+int biconjugate(solver_t *ws, double *A, double *x, double *b, precond_t *M, double itol, int size){
+	double rsold;
+	double rsnew;
+	double alpha;
+	double beta;
+
+	int i, since = 0;
+	double best = HUGE_VAL;
+
+
+	multiply_matrix_vector(A, x, ws->p, size);
+	sub_vectors(b, ws->p, ws->r, size);
+
+	for( i = 0 ; i < iter_max(size); i++){
+		iter_count++;
+		rsold = rsnew;
+		rsnew = precond_dot(ws, M, ws->r, ws->z);
+		if(!rsnew){
+			printf("biconjugate FAILS \n");
+			return -1;
+		}
+		if(i == 0 ){
+			memcpy(ws->p, ws->z, size*sizeof(double));
+		}
+		else{
+			beta = rsnew/rsold;
+			pxpby(ws, ws->z, beta, ws->p);
+		}
+
+		multiply_matrix_vector(A,ws->p,ws->Ap,size);
+		alpha = rsnew/pdot(ws, ws->p, ws->Ap);
+
+		paxpy2(ws, alpha, ws->p, x, -alpha, ws->Ap, ws->r);
+
+		if ( sqrt(rsnew) < itol )
+			break;
+
+		if ( iter_stalled("BiCG", i, sqrt(fabs(rsnew)), &best, &since) )
+			break;
+
+	}
+
+	return 0;
+}
+
+void conjugate(solver_t *ws, double *A, double *x, double *b, precond_t *M, double itol, int size) {
+	if ( matrix_symmetric(A, size) == 0 ) {
+		printf("O pinakas den einai symmetrikos ( conjugate )\n");
+		exit(0);
+	}
+
+	double rsold;
+	double rsnew;
+	double alpha;
+
+	int i, since = 0;
+	double best = HUGE_VAL;
+
+	multiply_matrix_vector(A, x, ws->p, size);
+	sub_vectors(b, ws->p, ws->r, size);
+	rsold = precond_dot(ws, M, ws->r, ws->z);
+	memcpy(ws->p, ws->z, size*sizeof(double));
+	printf("$$$$$$$$$$$$$$$$$$$$$$ %lf \n",itol);
+	for (i=0; i < iter_max(size); i++ ) {
+		iter_count++;
+		multiply_matrix_vector(A,ws->p, ws->Ap, size);
+		alpha = rsold/pdot(ws, ws->p, ws->Ap);
+
+		// x += alpha*p and r -= alpha*Ap in one pass, then z = M^-1*r with z'r
+		paxpy2(ws, alpha, ws->p, x, -alpha, ws->Ap, ws->r);
+		rsnew = precond_dot(ws, M, ws->r, ws->z);
+
+		if ( sqrt(rsnew) < itol )
+			break;
+
+		if ( iter_stalled("CG", i, sqrt(fabs(rsnew)), &best, &since) )
+			break;
+
+		pxpby(ws, ws->z, rsnew/rsold, ws->p);
+		rsold = rsnew;
+	}
+}
+
+/* y = A*x with the system matrix, dense or sparse */
+static void system_matvec(solver_t *ws, double *x, double *y)
+{
+	if ( sparse_use == 0 )
+		multiply_matrix_vector(G, x, y, ws->size);
+	else
+		sparse_matvec(ws, G_s, x, y);
+}
+
+static double norm_vector(solver_t *ws, double *v)
+{
+	return sqrt(pdot(ws, v, v));
+}
+
+/* BiCGSTAB with right preconditioning, A*M^-1*u = b and x = M^-1*u, so the
+ * residual it tracks is the true one. */
+int bicgstab(solver_t *ws, double *x, double *b, precond_t *M, double itol, int size)
+{
+	int i, j, since = 0;
+	double rho, rho_old = 1, alpha = 1, omega = 1, beta, rv, tt, res;
+	double best = HUGE_VAL;
+	double *r = ws->r, *rhat = ws->rhat, *p = ws->p, *v = ws->Ap;
+	double *s = ws->s, *t = ws->t, *phat = ws->z, *shat = ws->temp;
+
+	system_matvec(ws, x, v);
+	sub_vectors(b, v, r, size);
+	memcpy(rhat, r, size*sizeof(double));
+	settozero(p, size);
+	settozero(v, size);
+
+	if ( norm_vector(ws, r) < itol )
+		return 0;
+
+	for ( i=0; i < iter_max(size); i++ ) {
+		iter_count++;
+		rho = pdot(ws, rhat, r);
+		if ( rho == 0 ) {
+			printf("[-] BiCGSTAB: breakdown at iteration %d (rho = 0)\n", i);
+			return -1;
+		}
+
+		beta = (rho/rho_old) * (alpha/omega);
+		for ( j=0; j<size; j++ )
+			p[j] = r[j] + beta*(p[j] - omega*v[j]);
+
+		M->apply(M, p, phat);
+		system_matvec(ws, phat, v);
+
+		rv = pdot(ws, rhat, v);
+		if ( rv == 0 ) {
+			printf("[-] BiCGSTAB: breakdown at iteration %d (rhat'v = 0)\n", i);
+			return -1;
+		}
+		alpha = rho/rv;
+
+		memcpy(s, r, size*sizeof(double));
+		if ( sqrt(paxpy_dot(ws, -alpha, v, s)) < itol ) {
+			for ( j=0; j<size; j++ )
+				x[j] += alpha*phat[j];
+			return 0;
+		}
+
+		M->apply(M, s, shat);
+		system_matvec(ws, shat, t);
+
+		tt = pdot(ws, t, t);
+		omega = tt == 0 ? 0 : pdot(ws, t, s)/tt;
+
+		for ( j=0; j<size; j++ )
+			x[j] += alpha*phat[j] + omega*shat[j];
+		memcpy(r, s, size*sizeof(double));
+		res = sqrt(paxpy_dot(ws, -omega, t, r));
+		if ( res < itol )
+			return 0;
+
+		if ( omega == 0 ) {
+			printf("[-] BiCGSTAB: breakdown at iteration %d (omega = 0)\n", i);
+			return -1;
+		}
+
+		if ( iter_stalled("BiCGSTAB", i, res, &best, &since) )
+			return -1;
+
+		rho_old = rho;
+	}
+
+	return -1;
+}
+
+/* Restarted GMRES(m) with right preconditioning, modified Gram-Schmidt and
+ * Givens rotations. A restart cycle that does not reduce the residual by
+ * 0.1% means it has stagnated, restarting more will not help. */
+int gmres(solver_t *ws, double *x, double *b, precond_t *M, double itol, int size)
+{
+	int i, j, k, it = 0, m = ws->restart;
+	double beta, res, h, hh = 0, d, tmp, *w;
+	double *V = ws->V, *H = ws->H, *g = ws->g, *c = ws->cs, *sn = ws->sn;
+	double *z = ws->z, *u = ws->temp;
+
+#define Hm(i,j) H[(i)*m + (j)]
+
+	while ( it < iter_max(size) ) {
+		system_matvec(ws, x, u);
+		sub_vectors(b, u, V, size);
+		beta = norm_vector(ws, V);
+		if ( beta < itol )
+			return 0;
+		if ( isnan(beta) ) {
+			printf("[-] GMRES: breakdown at iteration %d\n", it);
+			return -1;
+		}
+
+		multiply_vector_scalar(V, 1/beta, V, size);
+		settozero(g, m+1);
+		g[0] = beta;
+		res = beta;
+
+		for ( j=0; j<m && it < iter_max(size); it++ ) {
+			iter_count++;
+			w = V + (long) (j+1)*size;
+			M->apply(M, V + (long) j*size, z);
+			system_matvec(ws, z, w);
+
+			for ( k=0; k<=j; k++ ) {
+				Hm(k,j) = pdot(ws, w, V + (long) k*size);
+				hh = paxpy_dot(ws, -Hm(k,j), V + (long) k*size, w);
+			}
+			h = sqrt(hh);
+
+			for ( k=0; k<j; k++ ) {
+				tmp = c[k]*Hm(k,j) + sn[k]*Hm(k+1,j);
+				Hm(k+1,j) = -sn[k]*Hm(k,j) + c[k]*Hm(k+1,j);
+				Hm(k,j) = tmp;
+			}
+			d = sqrt(Hm(j,j)*Hm(j,j) + h*h);
+			if ( d == 0 ) {
+				printf("[-] GMRES: breakdown at iteration %d\n", it);
+				return -1;
+			}
+			c[j] = Hm(j,j)/d;
+			sn[j] = h/d;
+			Hm(j,j) = d;
+			g[j+1] = -sn[j]*g[j];
+			g[j] = c[j]*g[j];
+			res = fabs(g[j+1]);
+			j++;
+
+			if ( res < itol || h == 0 )
+				break;  // h == 0: the Krylov space is invariant, the solution is exact
+			multiply_vector_scalar(w, 1/h, w, size);
+		}
+
+		// y = H \ g into g, then x += M^-1 * V*y
+		for ( k=j-1; k>=0; k-- ) {
+			for ( i=k+1; i<j; i++ )
+				g[k] -= Hm(k,i)*g[i];
+			g[k] /= Hm(k,k);
+		}
+		settozero(u, size);
+		for ( k=0; k<j; k++ )
+			for ( i=0; i<size; i++ )
+				u[i] += g[k] * V[(long) k*size + i];
+		M->apply(M, u, z);
+		add_vectors(x, z, x, size);
+
+		if ( res < itol )
+			return 0;
+
+		if ( res > 0.999*beta ) {
+			printf("[-] GMRES(%d) stagnated at iteration %d, residual %g\n", m, it, res);
+			return -1;
+		}
+	}
+
+#undef Hm
+
+	return -1;
+}
+
+/* The recycled solutions, only when recycling is on */
+static void solver_recycle_space(solver_t *ws, int k)
+{
+	free(ws->X);
+	free(ws->Q);
+
+	ws->maxrec = k;
+	ws->nrec = 0;
+	ws->X = (double*) malloc(sizeof(double)*ws->size*k);
+	ws->Q = (double*) malloc(sizeof(double)*ws->size*k);
+	assert(ws->X && ws->Q);
+}
+
+/* The GMRES basis and Hessenberg matrix, only when GMRES is in use */
+static void solver_gmres_space(solver_t *ws, int restart)
+{
+	int m = restart;
+
+	free(ws->V);
+	free(ws->H);
+	free(ws->g);
+	free(ws->cs);
+	free(ws->sn);
+
+	ws->restart = m;
+	ws->V = (double*) malloc(sizeof(double)*ws->size*(m+1));
+	ws->H = (double*) malloc(sizeof(double)*(m+1)*m);
+	ws->g = (double*) malloc(sizeof(double)*(m+1));
+	ws->cs = (double*) malloc(sizeof(double)*m);
+	ws->sn = (double*) malloc(sizeof(double)*m);
+	assert(ws->V && ws->H && ws->g && ws->cs && ws->sn);
+}
+
+static void solver_release(solver_t *ws)
+{
+	if ( ws == NULL )
+		return;
+
+	free(ws->r);
+	free(ws->p);
+	free(ws->z);
+	free(ws->temp);
+	free(ws->Ap);
+	free(ws->y);
+	free(ws->rhs[0]);
+	free(ws->rhs[1]);
+	free(ws->sol[0]);
+	free(ws->sol[1]);
+	free(ws->gx);
+	free(ws->cx);
+	free(ws->rhat);
+	free(ws->s);
+	free(ws->t);
+	free(ws->V);
+	free(ws->H);
+	free(ws->g);
+	free(ws->cs);
+	free(ws->sn);
+	free(ws->X);
+	free(ws->Q);
+	free(ws->start);
+	free(ws->partial);
+	cs_spmvfree(ws->A);
+	free(ws);
+}
+
+solver_t *solver_context(int size)
+{
+	int i, k, nthreads = threads_count();
+	double **v[14];
+	solver_t *ws;
+
+	// the last slot is recycled when no context has this size
+	for ( k=0; k<SOLVER_CONTEXTS-1; k++ )
+		if ( solver[k] && solver[k]->size == size )
+			break;
+	ws = solver[k];
+
+	if ( !ws || ws->size != size || ws->nthreads != nthreads ) {
+		solver_release(ws);
+		ws = (solver_t*) calloc(1, sizeof(solver_t));
+		assert(ws);
+
+		ws->size = size;
+		ws->nthreads = nthreads;
+
+		v[0] = &ws->r;      v[1] = &ws->p;      v[2] = &ws->z;
+		v[3] = &ws->temp;   v[4] = &ws->Ap;     v[5] = &ws->rhs[0];
+		v[6] = &ws->rhs[1]; v[7] = &ws->sol[0]; v[8] = &ws->sol[1];
+		v[9] = &ws->gx;     v[10] = &ws->cx;    v[11] = &ws->rhat;
+		v[12] = &ws->s;     v[13] = &ws->t;
+
+		for ( i=0; i<14; i++ ) {
+			*v[i] = (double*) malloc(sizeof(double)*size);
+			assert(*v[i]);
+		}
+
+		ws->y = (double*) malloc(sizeof(double)*size*nthreads);
+		assert(ws->y);
+
+		// even blocks until the row copy of the matrix sets them by its nonzeros
+		ws->parts = size >= ITER_PAR_MIN ? nthreads : 1;
+		ws->start = (int*) malloc(sizeof(int)*(nthreads+1));
+		ws->partial = (double*) malloc(sizeof(double)*nthreads);
+		assert(ws->start && ws->partial);
+		for ( i=0; i<=ws->parts; i++ )
+			ws->start[i] = (long) size*i/ws->parts;
+	}
+
+	for ( ; k>0; k-- )
+		solver[k] = solver[k-1];
+	solver[0] = ws;
+
+	if ( method_choice == Iterative && method_iter == GMRES && ws->restart != gmres_restart )
+		solver_gmres_space(ws, gmres_restart);
+
+	if ( method_choice == Iterative && ws->maxrec != recycle_size )
+		solver_recycle_space(ws, recycle_size);
+
+	return ws;
+}
+
+void solver_free()
+{
+	int k;
+
+	for ( k=0; k<SOLVER_CONTEXTS; k++ ) {
+		solver_release(solver[k]);
+		solver[k] = NULL;
+	}
+
+	reduction = reduce_free(reduction);
+}
+
+static void jacobi_apply(const precond_t *M, const double *r, double *z)
+{
+	int i;
+
+	for ( i=0; i<M->size; i++ )
+		z[i] = r[i] * M->d[i];
+}
+
+static void ichol_apply(const precond_t *M, const double *r, double *z)
+{
+	csn *F = (csn*) M->data;
+
+	memcpy(z, r, sizeof(double)*M->size);
+	cs_lsolve(F->L, z);
+	cs_ltsolve(F->L, z);
+}
+
+static void ilu_apply(const precond_t *M, const double *r, double *z)
+{
+	csn *F = (csn*) M->data;
+
+	memcpy(z, r, sizeof(double)*M->size);
+	cs_lsolve(F->L, z);
+	cs_usolve(F->U, z);
+}
+
+static void incomplete_release(precond_t *M)
+{
+	cs_nfree((csn*) M->data);
+	M->data = NULL;
+}
+
+/* The dense G in compressed-column form, for the incomplete factorizations */
+static cs *dense_to_cs(int size)
+{
+	int i, j;
+	cs *T, *A;
+
+	T = cs_spalloc(size, size, 4*size, 1, 1);
+	assert(T);
+
+	for ( j=0; j<size; j++ )
+		for ( i=0; i<size; i++ )
+			if ( G[i*size+j] != 0 )
+				cs_entry(T, i, j, G[i*size+j]);
+
+	A = cs_compress(T);
+	assert(A);
+	cs_spfree(T);
+
+	return A;
+}
+
+static int incomplete_setup(precond_t *M, int size)
+{
+	cs *A = sparse_use ? G_s : dense_to_cs(size);
+	csn *F;
+
+	if ( precond_use == IncompleteCholesky )
+		F = cs_ichol(A, precond_droptol, precond_fill);
+	else
+		F = cs_ilu(A, precond_droptol, precond_fill);
+
+	if ( A != G_s )
+		cs_spfree(A);
+
+	if ( F == NULL )
+		return 0;
+
+	M->data = F;
+	M->release = incomplete_release;
+
+	if ( precond_use == IncompleteCholesky ) {
+		M->apply = ichol_apply;
+		printf("[+] %s preconditioner: %d nonzeros in L\n",
+				precond_droptol > 0 ? "ICT" : "IC(0)", F->L->p[size]);
+	} else {
+		M->apply = ilu_apply;
+		printf("[+] %s preconditioner: %d nonzeros in L+U\n",
+				precond_droptol > 0 ? "ILUT" : "ILU(0)", F->L->p[size] + F->U->p[size]);
+	}
+
+	return 1;
+}
+
+static void amg_precond_apply(const precond_t *M, const double *r, double *z)
+{
+	amg_apply((amg_t*) M->data, r, z);
+}
+
+static void amg_release(precond_t *M)
+{
+	amg_free((amg_t*) M->data);
+	M->data = NULL;
+}
+
+/* The hierarchy is built once per matrix, the transient steps share it. */
+static int amg_precond_setup(precond_t *M, int size)
+{
+	cs *A = sparse_use ? G_s : dense_to_cs(size);
+	amg_t *H = amg_setup(A);
+
+	if ( H == NULL ) {
+		if ( A != G_s )
+			cs_spfree(A);
+		return 0;
+	}
+
+	if ( A != G_s )
+		H->owned = A;
+
+	M->data = H;
+	M->apply = amg_precond_apply;
+	M->release = amg_release;
+
+	printf("[+] AMG preconditioner: %d levels, coarsest %d, operator complexity %.2f\n",
+			H->nlev, H->lev[H->nlev-1].A->n, amg_complexity(H));
+
+	return 1;
+}
+
+static int spmv_format = -1;  // picked by timing the first system matrix, kept for the run
+
+/* G_s in the SpMV format of the Krylov solvers, blocked like their vectors */
+static void solver_rows(int size)
+{
+	int k;
+	double rate[CS_SPMV_FORMATS];
+	solver_t *ws = solver_context(size);
+
+	cs_spmvfree(ws->A);
+
+	if ( spmv_format < 0 ) {
+		ws->A = cs_spmv_tune(G_s, ws->parts, parallel_for_pinned, rate);
+		assert(ws->A);
+		spmv_format = ws->A->format;
+
+		printf("[+] SpMV format: %s, %.2f GFLOP/s (", cs_spmv_name(spmv_format), ws->A->gflops);
+		for ( k=0; k<CS_SPMV_FORMATS; k++ )
+			printf("%s%s %.2f", k ? ", " : "", cs_spmv_name(k), rate[k]);
+		printf(")\n");
+	} else {
+		ws->A = cs_spmv_build(G_s, spmv_format, ws->parts, parallel_for_pinned);
+		assert(ws->A);
+	}
+
+	ws->parts = ws->A->parts;
+	for ( k=0; k<=ws->parts; k++ )
+		ws->start[k] = ws->A->start[k];
+}
+
+/* Builds the preconditioner of the current system matrix, G or G_s, and the
+ * row copy of G_s. An existing M is rebuilt in place when the matrix changes,
+ * e.g. for the transient matrix G + alpha*C. */
+static precond_t *precond_build(precond_t *M, int size)
+{
+	int i;
+
+	if ( sparse_use )
+		solver_rows(size);
+
+	solver_context(size)->nrec = 0;  // the recycled solutions belong to the old matrix
+
+	if ( M == NULL || M->size != size ) {
+		precond_free(M);
+		M = (precond_t*) calloc(1, sizeof(precond_t));
+		assert(M);
+		M->size = size;
+		M->d = (double*) malloc(sizeof(double)*size);
+		assert(M->d);
+	}
+
+	if ( M->release )
+		M->release(M);
+	M->release = NULL;
+
+	if ( precond_use == AlgebraicMultigrid ) {
+		if ( amg_precond_setup(M, size) )
+			return M;
+		printf("[-] AMG needs a positive diagonal and an SPD coarse level, falling back to Jacobi\n");
+	} else if ( precond_use != Jacobi ) {
+		if ( incomplete_setup(M, size) )
+			return M;
+		printf("[-] Incomplete factorization failed, falling back to Jacobi\n");
+	}
+
+	M->apply = jacobi_apply;
+
+	if ( sparse_use == 0 ) {
+		for ( i=0; i<size; i++ ) {
+			M->d[i] = G[i*size+i];
+			if ( fabs(M->d[i]) < 0.000001 )
+				M->d[i] = 1;
+			else
+				M->d[i] = 1/M->d[i];
+		}
+	} else {
+		cs_get_diag(G_s, M->d, size);
+	}
+
+	return M;
+}
+
+precond_t *precond_setup(precond_t *M, int size)
+{
+	system_reduce(size);
+	size = system_enter(size);
+	M = precond_build(M, size);
+	system_leave();
+
+	return M;
+}
+
+void precond_free(precond_t *M)
+{
+	if ( M == NULL )
+		return;
+
+	if ( M->release )
+		M->release(M);
+	free(M->d);
+	free(M);
+}
+
+/* Krylov recycling by projection on earlier solutions (Fischer). Q = A*X is
+ * kept orthonormal, so x = X*Q'b has the smallest residual of all the
+ * combinations of the recycled solutions. */
+static void recycle_guess(solver_t *ws, double *b, double *x)
+{
+	int i, k, size = ws->size;
+	double c;
+
+	if ( ws->nrec == 0 )
+		return;
+
+	settozero(x, size);
+	for ( k=0; k<ws->nrec; k++ ) {
+		c = pdot(ws, ws->Q + (long) k*size, b);
+		for ( i=0; i<size; i++ )
+			x[i] += c * ws->X[(long) k*size + i];
+	}
+}
+
+/* Adds a solution to X, orthogonalizing A*x against Q with modified
+ * Gram-Schmidt. A full X starts over from the new solution. */
+static void recycle_add(solver_t *ws, double *x)
+{
+	int i, k, size = ws->size;
+	double h, norm0, norm, *q, *v;
+
+	if ( ws->nrec == ws->maxrec )
+		ws->nrec = 0;
+
+	q = ws->Q + (long) ws->nrec*size;
+	v = ws->X + (long) ws->nrec*size;
+	system_matvec(ws, x, q);
+	memcpy(v, x, sizeof(double)*size);
+	norm0 = norm_vector(ws, q);
+
+	for ( k=0; k<ws->nrec; k++ ) {
+		h = pdot(ws, ws->Q + (long) k*size, q);
+		for ( i=0; i<size; i++ ) {
+			q[i] -= h * ws->Q[(long) k*size + i];
+			v[i] -= h * ws->X[(long) k*size + i];
+		}
+	}
+
+	norm = norm_vector(ws, q);
+	if ( norm <= 1e-12*norm0 || norm == 0 )
+		return;  // already in the span
+
+	multiply_vector_scalar(q, 1/norm, q, size);
+	multiply_vector_scalar(v, 1/norm, v, size);
+	ws->nrec++;
+}
+
+static void solve_krylov(double *b, double *x, precond_t *M, int size, enum IterativeMethods type)
+{
+	solver_t *ws = solver_context(size);
+
+	iter_solves++;
+	recycle_guess(ws, b, x);
+
+	if ( sparse_use == 0 ) {
+		if ( type == BiCG ) {
+			biconjugate(ws, G, x, b, M, itol, size);
+		} else if (type == CG) {
+			conjugate(ws, G, x, b, M, itol, size);
+		} else if (type == BiCGSTAB) {
+			bicgstab(ws, x, b, M, itol, size);
+		} else if (type == GMRES) {
+			gmres(ws, x, b, M, itol, size);
+		} else
+			assert( 0 && "Invalid Iterative Method");
+	} else {
+		if ( type == BiCG ) {
+			biconjugate_sparse(ws, G_s, x, b, M, itol, size);
+		} else if (type == CG) {
+			conjugate_sparse(ws, G_s, x, b, M, itol, size);
+		} else if (type == BiCGSTAB) {
+			bicgstab(ws, x, b, M, itol, size);
+		} else if (type == GMRES) {
+			gmres(ws, x, b, M, itol, size);
+		} else
+			assert( 0 && "Invalid Iterative Method");
+	}
+
+	if ( ws->maxrec )
+		recycle_add(ws, x);
+}
+
+// prints and clears the Krylov iterations of an analysis
+void iter_report(const char *analysis)
+{
+	if ( iter_solves )
+		printf("[#] %s: %ld iterations in %ld solves\n", analysis, iter_count, iter_solves);
+	iter_count = iter_solves = 0;
+}
+
+void solve_iter(double *b, double *x, precond_t *M, int size, enum IterativeMethods type)
+{
+	if ( reduction == NULL ) {
+		solve_krylov(b, x, M, size, type);
+		return;
+	}
+
+	reduce_rhs(reduction, b);
+	reduce_guess(reduction, x);
+	size = system_enter(size);
+	solve_krylov(reduction->b, reduction->x, M, size, type);
+	system_leave();
+	reduce_expand(reduction, b, x);
+}
+
+static void dense_substitute(const int *p, const double *b, double *x, int size,
+		enum NonIterativeMethods type)
+{
+	int i, j;
+
+	for (i=0; i<size; i++ ) {
+		x[i] = b[p[i]];
+
+		for ( j=0; j<i; j++ )
+			x[i] -= x[j] * LU[i*size+j];
+
+		if ( type == CholDecomp )
+			x[i] /= LU[i*size+i];
+	} 
+
+	for ( i=size-1; i>=0; i-- ) {
+		for ( j=i+1; j<size; j++ )
+			x[i] -= x[j] * LU[i*size+j];
+
+		x[i] /= LU[i*size+i];
+	}
+}
+
+typedef struct DENSE_SOLVE_T
+{
+	double *x;
+	int size;
+	int r0, c0, c1;  // rows from r0 on are updated with the columns [c0,c1)
+	int *p;
+	double *B, *X, *Y;  // right hand sides, solutions and per-thread scratch
+	enum NonIterativeMethods type;
+} dense_solve_t;
+
+// x[rows] -= LU[rows][c0:c1] * x[c0:c1] for one chunk of rows
+static void substitute_task(int id, int thread, void *arg)
+{
+	dense_solve_t *ds = (dense_solve_t*) arg;
+	int i, j, size = ds->size;
+	int r0 = ds->r0 + id*SOLVE_CHUNK;
+	int r1 = r0 + SOLVE_CHUNK;
+	double sum, *row;
+
+	if ( ds->r0 < ds->c0 ) {
+		if ( r1 > ds->c0 ) r1 = ds->c0;  // backward: the rows above the block
+	} else if ( r1 > size ) {
+		r1 = size;                       // forward: the rows below the block
+	}
+
+	for ( i=r0; i<r1; i++ ) {
+		row = LU + i*size;
+		sum = 0;
+		for ( j=ds->c0; j<ds->c1; j++ )
+			sum += row[j] * ds->x[j];
+		ds->x[i] -= sum;
+	}
+}
+
+/* Forward and back substitution by blocks of LU_BLOCK columns: the diagonal
+ * block is solved on one thread and the matrix-vector update of the remaining
+ * rows is split between the threads. */
+static void dense_substitute_parallel(const int *p, const double *b, double *x, int size,
+		enum NonIterativeMethods type)
+{
+	int i, j, c0, c1, rows;
+	dense_solve_t ds;
+
+	ds.x = x;
+	ds.size = size;
+
+	for ( i=0; i<size; i++ )
+		x[i] = b[p[i]];
+
+	for ( c0=0; c0<size; c0=c1 ) {
+		c1 = c0 + LU_BLOCK < size ? c0 + LU_BLOCK : size;
+
+		for ( i=c0; i<c1; i++ ) {
+			for ( j=c0; j<i; j++ )
+				x[i] -= x[j] * LU[i*size+j];
+
+			if ( type == CholDecomp )
+				x[i] /= LU[i*size+i];
+		}
+
+		rows = size - c1;
+		ds.r0 = c1;
+		ds.c0 = c0;
+		ds.c1 = c1;
+		parallel_for((rows + SOLVE_CHUNK-1) / SOLVE_CHUNK, substitute_task, &ds);
+	}
+
+	for ( c1=size; c1>0; c1=c0 ) {
+		c0 = c1 - LU_BLOCK > 0 ? c1 - LU_BLOCK : 0;
+
+		for ( i=c1-1; i>=c0; i-- ) {
+			for ( j=i+1; j<c1; j++ )
+				x[i] -= x[j] * LU[i*size+j];
+
+			x[i] /= LU[i*size+i];
+		}
+
+		ds.r0 = 0;
+		ds.c0 = c0;
+		ds.c1 = c1;
+		parallel_for((c0 + SOLVE_CHUNK-1) / SOLVE_CHUNK, substitute_task, &ds);
+	}
+}
+
+#define REFINE_MAX 30  // refinement steps before the double factors take over
+
+// x = F\b with the single precision factors of f, accumulated in double
+static void solve_float(const factor_t *f, const double *b, double *x, double *y)
+{
+	int i, j, size = f->size;
+	const float *LUf = f->LUf;
+
+	if ( f->Nf ) {
+		if ( f->type == CholDecomp )
+			cs_cholsol_float(f->S, f->Nf, b, x, y, size);
+		else
+			cs_lusol_float(f->S, f->Nf, b, x, y, size);
+		return;
+	}
+
+	for (i=0; i<size; i++ ) {
+		x[i] = b[f->pivot[i]];
+
+		for ( j=0; j<i; j++ )
+			x[i] -= x[j] * LUf[i*size+j];
+
+		if ( f->type == CholDecomp )
+			x[i] /= LUf[i*size+i];
+	}
+
+	for ( i=size-1; i>=0; i-- ) {
+		for ( j=i+1; j<size; j++ )
+			x[i] -= x[j] * LUf[i*size+j];
+
+		x[i] /= LUf[i*size+i];
+	}
+}
+
+/* Iterative refinement of the single precision solution against the double
+ * matrix, x -= F\(A*x - b), until the residual is at the rounding level of
+ * double (the test of LAPACK's dsgesv). Returns -1 when a step does not at
+ * least halve the residual: the factors are too poor for this matrix. */
+static int solve_refined(const factor_t *f, const double *b, double *x)
+{
+	int i, it, size = f->size;
+	solver_t *ws = solver_context(size);
+	double *r = ws->r, *d = ws->z;
+	double res, xmax, prev = HUGE_VAL;
+
+	solve_float(f, b, x, ws->y);
+
+	for ( it=0; it<REFINE_MAX; it++ ) {
+		if ( sparse_use == 0 ) {
+			multiply_matrix_vector(G, x, r, size);
+			for ( i=0; i<size; i++ )
+				r[i] -= b[i];
+		} else {
+			for ( i=0; i<size; i++ )
+				r[i] = -b[i];
+			cs_gaxpy(G_s, x, r);
+		}
+
+		for ( res=0, xmax=0, i=0; i<size; i++ ) {
+			if ( fabs(r[i]) > res )
+				res = fabs(r[i]);
+			if ( fabs(x[i]) > xmax )
+				xmax = fabs(x[i]);
+		}
+
+		if ( res <= sqrt(size) * DBL_EPSILON * f->anorm * xmax )
+			return 0;
+		if ( res > 0.5*prev )
+			return -1;
+		prev = res;
+
+		solve_float(f, r, d, ws->y);
+		for ( i=0; i<size; i++ )
+			x[i] -= d[i];
+	}
+
+	return -1;
+}
+
+/* The refinement stalled: the entry gets double factors for good, p is the
+ * caller's copy of the dense row permutation and is brought up to date. */
+static int mixed_fallback(int *p)
+{
+	factor_t *f = current;
+
+	printf("[-] Mixed precision refinement stalled, refactorizing in double\n");
+
+	f->mixed_failed = 1;
+	if ( factor_numeric(f) != 0 ) {
+		printf("[-] Failed to decompose in double precision\n");
+		return -1;
+	}
+
+	S = f->S;
+	N = f->N;
+	LU = f->LU;
+	Lrows = f->Lrows;
+	Urows = f->Urows;
+
+	if ( sparse_use == 0 )
+		memcpy(p, f->pivot, sizeof(int)*f->size);
+
+	return 0;
+}
+
+static void solve_direct(int *p, double *b, double *x, int size, enum NonIterativeMethods type)
+{
+	double *y;
+
+	if ( current && current->mixed ) {
+		if ( solve_refined(current, b, x) == 0 )
+			return;
+
+		if ( mixed_fallback(p) != 0 )
+			return;
+	}
+
+	if ( sparse_use == 0 ) {
+		if ( size >= SOLVE_PARALLEL_MIN && threads_count() > 1 )
+			dense_substitute_parallel(p, b, x, size, type);
+		else
+			dense_substitute(p, b, x, size, type);
+		return;
+	}
+
+	y = solver_context(size)->y;
+
+	if ( Lrows ) {
+		if ( type == CholDecomp )
+			cs_cholsol_levels(S, Lrows, Urows, b, x, y, size, parallel_for);
+		else if ( type == LUDecomp )
+			cs_lusol_levels(S, N, Lrows, Urows, b, x, y, size, parallel_for);
+		else
+			assert(0);
+	} else {
+		if ( type == CholDecomp )
+			cs_cholsol_ws(S, N, b, x, y, size);
+		else if ( type == LUDecomp )
+			cs_lusol_ws(S, N, b, x, y, size);
+		else
+			assert(0);
+	}
+}
+
+static void solve_rhs_task(int id, int thread, void *arg)
+{
+	dense_solve_t *ds = (dense_solve_t*) arg;
+	double *b = ds->B + (long) id*ds->size;
+	double *x = ds->X + (long) id*ds->size;
+	double *y = ds->Y + (long) thread*ds->size;
+
+	if ( sparse_use == 0 ) {
+		dense_substitute(ds->p, b, x, ds->size, ds->type);
+	} else if ( Lrows ) {
+		// one right hand side per thread already, the levels run inline
+		if ( ds->type == CholDecomp )
+			cs_cholsol_levels(S, Lrows, Urows, b, x, y, ds->size, NULL);
+		else
+			cs_lusol_levels(S, N, Lrows, Urows, b, x, y, ds->size, NULL);
+	} else if ( ds->type == CholDecomp ) {
+		cs_cholsol_ws(S, N, b, x, y, ds->size);
+	} else {
+		cs_lusol_ws(S, N, b, x, y, ds->size);
+	}
+}
+
+void solve_lu(int *p, double *b, double *x, int size, enum NonIterativeMethods type)
+{
+	if ( reduction == NULL ) {
+		solve_direct(p, b, x, size, type);
+		return;
+	}
+
+	reduce_rhs(reduction, b);
+	size = system_enter(size);
+	solve_direct(p, reduction->b, reduction->x, size, type);
+	system_leave();
+	reduce_expand(reduction, b, x);
+}
+
+/* Solves for nrhs right hand sides stored one after the other in B, one
+ * thread per right hand side, each with its own slice of the solver scratch. */
+static void solve_direct_multi(int *p, double *B, double *X, int size, int nrhs, enum NonIterativeMethods type)
+{
+	int k;
+	dense_solve_t ds;
+
+	// the refinement shares the solver vectors, one right hand side at a time
+	if ( current && current->mixed ) {
+		for ( k=0; k<nrhs; k++ )
+			solve_direct(p, B + (long) k*size, X + (long) k*size, size, type);
+		return;
+	}
+
+	ds.p = p;
+	ds.B = B;
+	ds.X = X;
+	ds.size = size;
+	ds.type = type;
+	ds.Y = solver_context(size)->y;
+
+	parallel_for(nrhs, solve_rhs_task, &ds);
+}
+
+void solve_lu_multi(int *p, double *B, double *X, int size, int nrhs, enum NonIterativeMethods type)
+{
+	int k, rsize;
+	double *Br, *Xr;
+
+	assert(nrhs <= SOLVE_BATCH);
+
+	if ( reduction == NULL ) {
+		solve_direct_multi(p, B, X, size, nrhs, type);
+		return;
+	}
+
+	rsize = reduction->rsize;
+	if ( reduction->B == NULL ) {
+		reduction->B = (double*) malloc(sizeof(double) * rsize * SOLVE_BATCH);
+		reduction->X = (double*) malloc(sizeof(double) * rsize * SOLVE_BATCH);
+		assert(reduction->B && reduction->X);
+	}
+	Br = reduction->B;
+	Xr = reduction->X;
+
+	for ( k=0; k<nrhs; k++ ) {
+		reduce_rhs(reduction, B + (long) k*size);
+		memcpy(Br + (long) k*rsize, reduction->b, sizeof(double)*rsize);
+	}
+
+	system_enter(size);
+	solve_direct_multi(p, Br, Xr, rsize, nrhs, type);
+	system_leave();
+
+	// the offsets of the sources are per right hand side, reduce_rhs() sets them again
+	for ( k=0; k<nrhs; k++ ) {
+		reduce_rhs(reduction, B + (long) k*size);
+		memcpy(reduction->x, Xr + (long) k*rsize, sizeof(double)*rsize);
+		reduce_expand(reduction, B + (long) k*size, X + (long) k*size);
+	}
+}
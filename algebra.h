@@ -1,10 +1,55 @@
 #ifndef ALGEBRA_H
 #define ALGEBRA_H
 #include "options.h"
+#include "csparse.h"
+
+/* Every vector the solvers need, allocated once per system size so the
+ * solves and the time steps run without touching the heap. */
+typedef struct SOLVER_T
+{
+	int size;
+	int nthreads;
+	double *r, *p, *z, *temp, *Ap;  // Krylov vectors
+	double *rhat, *s, *t;           // BiCGSTAB
+	int restart;                    // GMRES: the basis holds restart+1 vectors
+	double *V, *H, *g, *cs, *sn;
+	double *y;                      // triangular solve scratch, size per thread
+	double *rhs[2];                 // double-buffered right hand sides
+	double *sol[2];                 // double-buffered solutions
+	double *gx, *cx;                // history terms of the transient steps
+	int parts;                      // blocks of the parallel vector operations
+	int *start;                     // block k is start[k]..start[k+1]-1, the row blocks of A
+	double *partial;                // per block dot products
+	csmv *A;                        // G_s in the fastest SpMV format, A->A is G_s
+	int nrec, maxrec;               // recycled solutions of the current matrix
+	double *X, *Q;                  // X and A*X, maxrec vectors each, Q orthonormal
+} solver_t;
+
+solver_t *solver_context(int size);
+void solver_free();
+
+/* A preconditioner M of the system matrix, apply computes z = M^-1 * r. */
+typedef struct PRECOND_T precond_t;
+struct PRECOND_T
+{
+	int size;
+	void (*apply)(const precond_t *M, const double *r, double *z);
+	void (*release)(precond_t *M);  // frees what the kind owns, may be NULL
+	double *d;   // Jacobi: the inverse of the diagonal
+	void *data;  // IC/ILU: the incomplete factors
+};
+
+precond_t *precond_setup(precond_t *M, int size);
+void precond_free(precond_t *M);
 
 int  decompose(int size,  int **p, enum NonIterativeMethods type);
-void solve(double *m , int *P, double *sol, double *rhs,int  size);
+void factor_cache_free();
+void solve(precond_t *M, int *P, double *sol, double *rhs, int size);
 void solve_lu(int *p, double *b, double *x,  int size, enum NonIterativeMethods type);
-void solve_iter(double *b, double *x, double *m, int size, enum IterativeMethods type);
+#define SOLVE_BATCH 64  // right hand sides solve_lu_multi takes at once
+void solve_lu_multi(int *p, double *B, double *X, int size, int nrhs, enum NonIterativeMethods type);
+void solve_iter(double *b, double *x, precond_t *M, int size, enum IterativeMethods type);
+void iter_report(const char *analysis);
+void multiply_matrix_vector(double *mat, double *vector, double *output, int size );
 
 #endif
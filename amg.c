@@ -0,0 +1,314 @@
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "csparse.h"
+#include "amg.h"
+
+/* Inverse diagonal of A and the Gershgorin bound of the spectral radius of
+ * D^-1*A. Returns 0 when a diagonal entry is not positive. */
+static int amg_diagonal(const cs *A, double *dinv, double *rho)
+{
+	int i, j, p, n = A->n;
+	double *rowsum = (double*) calloc(n, sizeof(double));
+
+	assert(rowsum);
+
+	for ( j=0; j<n; j++ )
+		dinv[j] = 0;
+
+	for ( j=0; j<n; j++ ) {
+		for ( p=A->p[j]; p<A->p[j+1]; p++ ) {
+			i = A->i[p];
+			if ( i == j )
+				dinv[j] += A->x[p];
+			rowsum[i] += fabs(A->x[p]);
+		}
+	}
+
+	*rho = 0;
+	for ( j=0; j<n; j++ ) {
+		if ( dinv[j] <= 0 ) {
+			free(rowsum);
+			return 0;
+		}
+		dinv[j] = 1/dinv[j];
+		if ( rowsum[j]*dinv[j] > *rho )
+			*rho = rowsum[j]*dinv[j];
+	}
+
+	free(rowsum);
+	return 1;
+}
+
+static int amg_strong(const double *dinv, int i, int j, double a)
+{
+	return i != j && a*a*dinv[i]*dinv[j] >= AMG_STRENGTH*AMG_STRENGTH;
+}
+
+/* Greedy aggregation over the strong connections, A is symmetric so the
+ * column of a node lists its neighbours. Returns the number of aggregates. */
+static int amg_aggregate(const cs *A, const double *dinv, int *agg)
+{
+	int i, j, p, n = A->n, nagg = 0, free_nbrs;
+	char *joined = (char*) calloc(n, sizeof(char));
+
+	assert(joined);
+
+	for ( i=0; i<n; i++ )
+		agg[i] = -1;
+
+	// 1: a node whose strong neighbours are all free starts an aggregate with them
+	for ( j=0; j<n; j++ ) {
+		if ( agg[j] != -1 )
+			continue;
+
+		for ( free_nbrs=1, p=A->p[j]; p<A->p[j+1] && free_nbrs; p++ )
+			if ( amg_strong(dinv, A->i[p], j, A->x[p]) && agg[A->i[p]] != -1 )
+				free_nbrs = 0;
+
+		if ( !free_nbrs )
+			continue;
+
+		agg[j] = nagg;
+		for ( p=A->p[j]; p<A->p[j+1]; p++ )
+			if ( amg_strong(dinv, A->i[p], j, A->x[p]) )
+				agg[A->i[p]] = nagg;
+		nagg++;
+	}
+
+	// 2: the rest join the aggregate of a strong neighbour from step 1
+	for ( j=0; j<n; j++ ) {
+		if ( agg[j] != -1 )
+			continue;
+
+		for ( p=A->p[j]; p<A->p[j+1]; p++ ) {
+			i = A->i[p];
+			if ( amg_strong(dinv, i, j, A->x[p]) && agg[i] != -1 && !joined[i] ) {
+				agg[j] = agg[i];
+				joined[j] = 1;
+				break;
+			}
+		}
+	}
+
+	// 3: whatever is left forms aggregates with its free strong neighbours
+	for ( j=0; j<n; j++ ) {
+		if ( agg[j] != -1 )
+			continue;
+
+		agg[j] = nagg;
+		for ( p=A->p[j]; p<A->p[j+1]; p++ )
+			if ( amg_strong(dinv, A->i[p], j, A->x[p]) && agg[A->i[p]] == -1 )
+				agg[A->i[p]] = nagg;
+		nagg++;
+	}
+
+	free(joined);
+	return nagg;
+}
+
+/* P = (I - omega*D^-1*A) * P0, P0 the piecewise constant interpolation of
+ * the aggregates. Column c of A*P0 is the sum of the columns of the nodes in
+ * aggregate c, so both come from one pass over A. */
+static cs *amg_prolongator(const cs *A, const double *dinv, double omega,
+		const int *agg, int nagg)
+{
+	int i, j, p, n = A->n;
+	cs *T, *P;
+
+	T = cs_spalloc(n, nagg, n + A->p[n], 1, 1);
+	assert(T);
+
+	for ( j=0; j<n; j++ ) {
+		cs_entry(T, j, agg[j], 1);
+		for ( p=A->p[j]; p<A->p[j+1]; p++ ) {
+			i = A->i[p];
+			cs_entry(T, i, agg[j], -omega*dinv[i]*A->x[p]);
+		}
+	}
+
+	P = cs_compress(T);
+	cs_spfree(T);
+
+	return P;
+}
+
+static void amg_level_alloc(amg_level_t *L)
+{
+	int n = L->A->n;
+
+	L->dinv = (double*) malloc(sizeof(double)*n);
+	L->x = (double*) malloc(sizeof(double)*n);
+	L->b = (double*) malloc(sizeof(double)*n);
+	L->r = (double*) malloc(sizeof(double)*n);
+	assert(L->dinv && L->x && L->b && L->r);
+}
+
+amg_t *amg_setup(const cs *A)
+{
+	int l, nagg, *agg;
+	double rho;
+	amg_level_t *L;
+	cs *AP, *R;
+	amg_t *H;
+
+	if ( !A || !CS_CSC(A) || A->m != A->n )
+		return NULL;
+
+	H = (amg_t*) calloc(1, sizeof(amg_t));
+	agg = (int*) malloc(sizeof(int)*A->n);
+	assert(H && agg);
+
+	H->lev[0].A = (cs*) A;
+
+	for ( l=0; ; l++ ) {
+		L = &H->lev[l];
+		H->nlev = l+1;
+		amg_level_alloc(L);
+
+		if ( !amg_diagonal(L->A, L->dinv, &rho) ) {
+			free(agg);
+			return amg_free(H);
+		}
+
+		if ( L->A->n <= AMG_COARSE_SIZE || l == AMG_MAX_LEVELS-1 )
+			break;
+
+		nagg = amg_aggregate(L->A, L->dinv, agg);
+		if ( nagg == L->A->n )
+			break;  // nothing left to coarsen
+
+		L->P = amg_prolongator(L->A, L->dinv, 4.0/(3.0*rho), agg, nagg);
+		AP = L->P ? cs_multiply(L->A, L->P) : NULL;
+		R = L->P ? cs_transpose(L->P, 1) : NULL;
+		H->lev[l+1].A = AP && R ? cs_multiply(R, AP) : NULL;  // P'*A*P
+		cs_spfree(AP);
+		cs_spfree(R);
+
+		if ( H->lev[l+1].A == NULL ) {
+			free(agg);
+			return amg_free(H);
+		}
+	}
+
+	free(agg);
+
+	// the coarsest level is solved exactly, a pivot that is not positive means
+	// it is not SPD and the hierarchy is no use to CG
+	L = &H->lev[H->nlev-1];
+	H->S = cs_schol(1, L->A);
+	H->N = H->S ? cs_chol_strict(L->A, H->S) : NULL;
+	H->y = (double*) malloc(sizeof(double)*L->A->n);
+	assert(H->y);
+
+	if ( H->N == NULL )
+		return amg_free(H);
+
+	return H;
+}
+
+/* Gauss-Seidel sweep, forward or backward. A is symmetric so column i is
+ * row i. */
+static void amg_smooth(const amg_level_t *L, const double *b, double *x, int forward)
+{
+	int i, k, p, n = L->A->n;
+	const int *Ap = L->A->p, *Ai = L->A->i;
+	const double *Ax = L->A->x;
+	double s;
+
+	for ( k=0; k<n; k++ ) {
+		i = forward ? k : n-1-k;
+		s = b[i];
+		for ( p=Ap[i]; p<Ap[i+1]; p++ )
+			if ( Ai[p] != i )
+				s -= Ax[p]*x[Ai[p]];
+		x[i] = s*L->dinv[i];
+	}
+}
+
+static void amg_cycle(amg_t *H, int l, const double *b, double *x)
+{
+	int i, j, p, n;
+	amg_level_t *L = &H->lev[l], *C;
+	const cs *A = L->A, *P = L->P;
+	double s;
+
+	if ( l == H->nlev-1 ) {
+		cs_cholsol_ws(H->S, H->N, b, x, H->y, A->n);
+		return;
+	}
+
+	n = A->n;
+	C = &H->lev[l+1];
+
+	memset(x, 0, sizeof(double)*n);
+	amg_smooth(L, b, x, 1);
+
+	// r = b - A*x, restricted with P'
+	memcpy(L->r, b, sizeof(double)*n);
+	for ( j=0; j<n; j++ )
+		for ( p=A->p[j]; p<A->p[j+1]; p++ )
+			L->r[A->i[p]] -= A->x[p]*x[j];
+
+	for ( j=0; j<P->n; j++ ) {
+		for ( s=0, p=P->p[j]; p<P->p[j+1]; p++ )
+			s += P->x[p]*L->r[P->i[p]];
+		C->b[j] = s;
+	}
+
+	amg_cycle(H, l+1, C->b, C->x);
+
+	for ( j=0; j<P->n; j++ )
+		for ( p=P->p[j]; p<P->p[j+1]; p++ ) {
+			i = P->i[p];
+			x[i] += P->x[p]*C->x[j];
+		}
+
+	amg_smooth(L, b, x, 0);
+}
+
+void amg_apply(amg_t *H, const double *b, double *x)
+{
+	amg_cycle(H, 0, b, x);
+}
+
+/* Nonzeros of all the levels over those of the finest */
+double amg_complexity(const amg_t *H)
+{
+	int l;
+	double nnz = 0;
+
+	for ( l=0; l<H->nlev; l++ )
+		nnz += H->lev[l].A->p[H->lev[l].A->n];
+
+	return nnz / H->lev[0].A->p[H->lev[0].A->n];
+}
+
+amg_t *amg_free(amg_t *H)
+{
+	int l;
+	amg_level_t *L;
+
+	if ( H == NULL )
+		return NULL;
+
+	for ( l=0; l<H->nlev; l++ ) {
+		L = &H->lev[l];
+		if ( l > 0 )
+			cs_spfree(L->A);
+		cs_spfree(L->P);
+		free(L->dinv);
+		free(L->x);
+		free(L->b);
+		free(L->r);
+	}
+
+	cs_sfree(H->S);
+	cs_nfree(H->N);
+	cs_spfree(H->owned);
+	free(H->y);
+	free(H);
+
+	return NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef AMG_H
+#define AMG_H
+#include "csparse.h"
+
+/* Smoothed-aggregation algebraic multigrid for symmetric positive definite
+ * systems, used as a preconditioner: one symmetric V-cycle per application.
+ * Level 0 is the caller's matrix and has to outlive the hierarchy. */
+
+#define AMG_MAX_LEVELS 25
+#define AMG_COARSE_SIZE 1000  // at or below this many unknowns the level is factorized
+#define AMG_STRENGTH 0.08     // |a_ij| >= AMG_STRENGTH * sqrt(a_ii*a_jj) is a strong connection
+
+typedef struct AMG_LEVEL_T
+{
+	cs *A;          // operator of the level
+	cs *P;          // smoothed prolongation from the next level
+	double *dinv;   // inverse of the diagonal of A
+	double *x, *b, *r;
+} amg_level_t;
+
+typedef struct AMG_T
+{
+	int nlev;
+	amg_level_t lev[AMG_MAX_LEVELS];
+	css *S;         // Cholesky of the coarsest level
+	csn *N;
+	double *y;
+	cs *owned;      // level 0 when the hierarchy was handed it to free
+} amg_t;
+
+amg_t *amg_setup(const cs *A);
+void amg_apply(amg_t *H, const double *b, double *x);
+double amg_complexity(const amg_t *H);
+amg_t *amg_free(amg_t *H);
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "arena.h"
+
+#define ARENA_FIRST (64 << 10)   // first block
+#define ARENA_MAX (64 << 20)     // blocks stop doubling here
+#define ARENA_ALIGN 16
+
+struct ARENA_BLOCK_T
+{
+  struct ARENA_BLOCK_T *next;
+  size_t used, size;
+  char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+/* Blocks come from calloc and are never reused, so what is carved out of
+ * them is already zero. An object larger than a quarter of a block gets a
+ * block of its own, behind the one being carved. */
+void *arena_alloc(arena_t *a, size_t size)
+{
+  arena_block_t *b;
+  size_t n;
+  void *p;
+
+  size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+  if ( a->head && a->head->used + size <= a->head->size ) {
+    p = a->head->data + a->head->used;
+    a->head->used += size;
+    return p;
+  }
+
+  if ( a->next_size == 0 )
+    a->next_size = ARENA_FIRST;
+
+  n = size > a->next_size/4 ? size : a->next_size;
+  b = (arena_block_t*) calloc(1, sizeof(arena_block_t) + n);
+  assert(b);
+  b->size = n;
+  b->used = size;
+
+  if ( n == size && a->head ) {
+    b->next = a->head->next;
+    a->head->next = b;
+  } else {
+    b->next = a->head;
+    a->head = b;
+    if ( a->next_size < ARENA_MAX )
+      a->next_size *= 2;
+  }
+
+  return b->data;
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t n)
+{
+  char *p = (char*) arena_alloc(a, n + 1);
+
+  memcpy(p, s, n);
+
+  return p;
+}
+
+void arena_release(arena_t *a)
+{
+  arena_block_t *b, *next;
+
+  for ( b=a->head; b; b=next ) {
+    next = b->next;
+    free(b);
+  }
+
+  a->head = NULL;
+  a->next_size = 0;
+}
@@ -0,0 +1,20 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+/* Region allocator: objects are carved out of large blocks and only ever
+ * released all at once. A zeroed arena_t is an empty arena. */
+
+typedef struct ARENA_BLOCK_T arena_block_t;
+
+typedef struct ARENA_T
+{
+  arena_block_t *head;   // block being carved, the older ones follow
+  size_t next_size;      // size of the next block, doubled up to a cap
+} arena_t;
+
+void *arena_alloc(arena_t *a, size_t size);   // zeroed, aligned for any type
+char *arena_strndup(arena_t *a, const char *s, size_t n);
+void arena_release(arena_t *a);
+
+#endif
@@ -0,0 +1,141 @@
+/* Microbenchmark of the node name interner against the table it replaced
+ * (1023 buckets, each grown by realloc one entry at a time). Interns n
+ * distinct names, then looks every one of them up again.
+ *
+ *   make bench && ./bench_hash [nodes ...]      (default 1000000 10000000)
+ *
+ * The old table is quadratic, it is only timed up to OLD_MAX nodes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "hash_table.h"
+
+#define OLD_MAX 1000000
+#define OLD_SIZE 1023
+
+extern int unique_hash;
+
+typedef struct OLD_HASH_T
+{
+  char *str;
+  int id;
+} old_hash_t;
+
+typedef struct OLD_BUCKET_T
+{
+  old_hash_t *hashes;
+  int size;
+} old_bucket_t;
+
+static old_bucket_t old[OLD_SIZE];
+static int old_unique;
+
+static int old_hash(unsigned char *str)
+{
+  unsigned long h = 5381;
+  int c;
+
+  while ((c = *(str++)))
+    h = ((h << 5) + h) + c;
+
+  return h % OLD_SIZE;
+}
+
+static int old_get(char *str)
+{
+  int h = old_hash((unsigned char*) str);
+  int i;
+
+  for (i=0; i<old[h].size; i++ ) {
+    if ( strcasecmp(old[h].hashes[i].str, str) == 0 ) {
+      free(str);
+      return old[h].hashes[i].id;
+    }
+  }
+
+  old[h].hashes = (old_hash_t*) realloc(old[h].hashes, sizeof(old_hash_t)*(old[h].size+1));
+  old[h].hashes[old[h].size].str = str;
+  old[h].hashes[old[h].size++].id = old_unique;
+
+  return old_unique++;
+}
+
+static void old_cleanup()
+{
+  int i, j;
+
+  for (i=0; i<OLD_SIZE; i++ ) {
+    for (j=0; j<old[i].size; j++ )
+      free(old[i].hashes[j].str);
+    free(old[i].hashes);
+  }
+  memset(old, 0, sizeof(old));
+}
+
+static double now()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9*t.tv_nsec;
+}
+
+// names shaped like the nets of an extracted grid
+static char *node_name(int k, char *buf)
+{
+  sprintf(buf, "N_%d_%d", k / 4096, k % 4096);
+  return buf;
+}
+
+static void bench(int n)
+{
+  double t0, t1, t2;
+  char buf[64];
+  int k, sum = 0;
+
+  hash_initialize();
+  t0 = now();
+  for (k=0; k<n; k++ )
+    sum += hash_get(node_name(k, buf));
+  t1 = now();
+  for (k=0; k<n; k++ )
+    sum -= hash_get(node_name(k, buf));
+  t2 = now();
+  hash_cleanup();
+
+  printf("[$] %9d nodes  new: insert %7.3fs  lookup %7.3fs%s\n", n, t1-t0, t2-t1, sum ? "  (ids differ!)" : "");
+
+  if ( n > OLD_MAX ) {
+    printf("[$] %9d nodes  old: skipped, quadratic\n", n);
+    return;
+  }
+
+  old_unique = 1;
+  t0 = now();
+  for (k=0; k<n; k++ )
+    old_get(strdup(node_name(k, buf)));
+  t1 = now();
+  for (k=0; k<n; k++ )
+    old_get(strdup(node_name(k, buf)));
+  t2 = now();
+  old_cleanup();
+
+  printf("[$] %9d nodes  old: insert %7.3fs  lookup %7.3fs\n", n, t1-t0, t2-t1);
+}
+
+int main(int argc, char *argv[])
+{
+  int i;
+
+  if ( argc < 2 ) {
+    bench(1000000);
+    bench(10000000);
+  }
+
+  for (i=1; i<argc; i++ )
+    bench(atoi(argv[i]));
+
+  return 0;
+}
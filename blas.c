@@ -0,0 +1,821 @@
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+#include "blas.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLAS_X86
+#include <immintrin.h>
+#endif
+
+// tile sizes of the blocked product, B tiles stay in L2
+#define GEMM_KC 128
+#define GEMM_NC 256
+
+typedef void (*gemm_kernel_t)(int m, int n, int k, const double *A, int lda,
+		const double *B, int ldb, double *C, int ldc);
+
+static gemm_kernel_t gemm_kernel = NULL;
+static const char *kernel_name = "generic";
+
+/* The kernels are picked on the first call, which may come from several
+ * pool threads at once: every entry point goes through blas_once, a thread
+ * never sees gemm_kernel set before the vector and single kernels are. */
+static pthread_once_t blas_once = PTHREAD_ONCE_INIT;
+
+static void vec_kernels_init(int level);
+static void sgemm_kernels_init(int level);
+
+// C -= A*B, plain loops; used for the edges of the vectorized kernels too
+static void gemm_ref(int m, int n, int k, const double *A, int lda,
+		const double *B, int ldb, double *C, int ldc)
+{
+	int i, j, p;
+	double a, *c;
+	const double *b;
+
+	for ( i=0; i<m; i++ ) {
+		c = C + i*ldc;
+		for ( p=0; p<k; p++ ) {
+			a = A[i*lda+p];
+			b = B + p*ldb;
+			for ( j=0; j<n; j++ )
+				c[j] -= a * b[j];
+		}
+	}
+}
+
+// 4x4 register block, for CPUs without a vector unit we know about
+static void gemm_generic(int m, int n, int k, const double *A, int lda,
+		const double *B, int ldb, double *C, int ldc)
+{
+	int i, j, p, r;
+	double c[4][4], a[4];
+	const double *b;
+
+	for ( i=0; i+4<=m; i+=4 ) {
+		for ( j=0; j+4<=n; j+=4 ) {
+			for ( r=0; r<4; r++ ) {
+				c[r][0] = c[r][1] = c[r][2] = c[r][3] = 0;
+			}
+
+			for ( p=0; p<k; p++ ) {
+				b = B + p*ldb + j;
+				for ( r=0; r<4; r++ ) {
+					a[r] = A[(i+r)*lda+p];
+					c[r][0] += a[r]*b[0];
+					c[r][1] += a[r]*b[1];
+					c[r][2] += a[r]*b[2];
+					c[r][3] += a[r]*b[3];
+				}
+			}
+
+			for ( r=0; r<4; r++ ) {
+				C[(i+r)*ldc+j  ] -= c[r][0];
+				C[(i+r)*ldc+j+1] -= c[r][1];
+				C[(i+r)*ldc+j+2] -= c[r][2];
+				C[(i+r)*ldc+j+3] -= c[r][3];
+			}
+		}
+		gemm_ref(4, n-j, k, A+i*lda, lda, B+j, ldb, C+i*ldc+j, ldc);
+	}
+	gemm_ref(m-i, n, k, A+i*lda, lda, B, ldb, C+i*ldc, ldc);
+}
+
+#ifdef BLAS_X86
+// 4x8 block: 8 ymm accumulators, one broadcast of A per row and step
+__attribute__((target("avx2,fma")))
+static void gemm_avx2(int m, int n, int k, const double *A, int lda,
+		const double *B, int ldb, double *C, int ldc)
+{
+	int i, j, p;
+	const double *a, *b;
+	double *c;
+	__m256d c00, c01, c10, c11, c20, c21, c30, c31, b0, b1, t;
+
+	for ( i=0; i+4<=m; i+=4 ) {
+		a = A + i*lda;
+		for ( j=0; j+8<=n; j+=8 ) {
+			c00 = c01 = c10 = c11 = _mm256_setzero_pd();
+			c20 = c21 = c30 = c31 = _mm256_setzero_pd();
+
+			for ( p=0; p<k; p++ ) {
+				b = B + p*ldb + j;
+				b0 = _mm256_loadu_pd(b);
+				b1 = _mm256_loadu_pd(b+4);
+
+				t = _mm256_broadcast_sd(a+p);
+				c00 = _mm256_fmadd_pd(t, b0, c00);
+				c01 = _mm256_fmadd_pd(t, b1, c01);
+				t = _mm256_broadcast_sd(a+lda+p);
+				c10 = _mm256_fmadd_pd(t, b0, c10);
+				c11 = _mm256_fmadd_pd(t, b1, c11);
+				t = _mm256_broadcast_sd(a+2*lda+p);
+				c20 = _mm256_fmadd_pd(t, b0, c20);
+				c21 = _mm256_fmadd_pd(t, b1, c21);
+				t = _mm256_broadcast_sd(a+3*lda+p);
+				c30 = _mm256_fmadd_pd(t, b0, c30);
+				c31 = _mm256_fmadd_pd(t, b1, c31);
+			}
+
+			c = C + i*ldc + j;
+			_mm256_storeu_pd(c,   _mm256_sub_pd(_mm256_loadu_pd(c),   c00));
+			_mm256_storeu_pd(c+4, _mm256_sub_pd(_mm256_loadu_pd(c+4), c01));
+			c += ldc;
+			_mm256_storeu_pd(c,   _mm256_sub_pd(_mm256_loadu_pd(c),   c10));
+			_mm256_storeu_pd(c+4, _mm256_sub_pd(_mm256_loadu_pd(c+4), c11));
+			c += ldc;
+			_mm256_storeu_pd(c,   _mm256_sub_pd(_mm256_loadu_pd(c),   c20));
+			_mm256_storeu_pd(c+4, _mm256_sub_pd(_mm256_loadu_pd(c+4), c21));
+			c += ldc;
+			_mm256_storeu_pd(c,   _mm256_sub_pd(_mm256_loadu_pd(c),   c30));
+			_mm256_storeu_pd(c+4, _mm256_sub_pd(_mm256_loadu_pd(c+4), c31));
+		}
+		gemm_ref(4, n-j, k, a, lda, B+j, ldb, C+i*ldc+j, ldc);
+	}
+
+	// leftover rows one at a time, thin updates are common in sparse factorizations
+	for ( ; i<m; i++ ) {
+		a = A + i*lda;
+		for ( j=0; j+8<=n; j+=8 ) {
+			c00 = c01 = _mm256_setzero_pd();
+
+			for ( p=0; p<k; p++ ) {
+				b = B + p*ldb + j;
+				t = _mm256_broadcast_sd(a+p);
+				c00 = _mm256_fmadd_pd(t, _mm256_loadu_pd(b), c00);
+				c01 = _mm256_fmadd_pd(t, _mm256_loadu_pd(b+4), c01);
+			}
+
+			c = C + i*ldc + j;
+			_mm256_storeu_pd(c,   _mm256_sub_pd(_mm256_loadu_pd(c),   c00));
+			_mm256_storeu_pd(c+4, _mm256_sub_pd(_mm256_loadu_pd(c+4), c01));
+		}
+		gemm_ref(1, n-j, k, a, lda, B+j, ldb, C+i*ldc+j, ldc);
+	}
+}
+
+// 4x16 block on zmm registers
+__attribute__((target("avx512f")))
+static void gemm_avx512(int m, int n, int k, const double *A, int lda,
+		const double *B, int ldb, double *C, int ldc)
+{
+	int i, j, p;
+	const double *a, *b;
+	double *c;
+	__m512d c00, c01, c10, c11, c20, c21, c30, c31, b0, b1, t;
+
+	for ( i=0; i+4<=m; i+=4 ) {
+		a = A + i*lda;
+		for ( j=0; j+16<=n; j+=16 ) {
+			c00 = c01 = c10 = c11 = _mm512_setzero_pd();
+			c20 = c21 = c30 = c31 = _mm512_setzero_pd();
+
+			for ( p=0; p<k; p++ ) {
+				b = B + p*ldb + j;
+				b0 = _mm512_loadu_pd(b);
+				b1 = _mm512_loadu_pd(b+8);
+
+				t = _mm512_set1_pd(a[p]);
+				c00 = _mm512_fmadd_pd(t, b0, c00);
+				c01 = _mm512_fmadd_pd(t, b1, c01);
+				t = _mm512_set1_pd(a[lda+p]);
+				c10 = _mm512_fmadd_pd(t, b0, c10);
+				c11 = _mm512_fmadd_pd(t, b1, c11);
+				t = _mm512_set1_pd(a[2*lda+p]);
+				c20 = _mm512_fmadd_pd(t, b0, c20);
+				c21 = _mm512_fmadd_pd(t, b1, c21);
+				t = _mm512_set1_pd(a[3*lda+p]);
+				c30 = _mm512_fmadd_pd(t, b0, c30);
+				c31 = _mm512_fmadd_pd(t, b1, c31);
+			}
+
+			c = C + i*ldc + j;
+			_mm512_storeu_pd(c,   _mm512_sub_pd(_mm512_loadu_pd(c),   c00));
+			_mm512_storeu_pd(c+8, _mm512_sub_pd(_mm512_loadu_pd(c+8), c01));
+			c += ldc;
+			_mm512_storeu_pd(c,   _mm512_sub_pd(_mm512_loadu_pd(c),   c10));
+			_mm512_storeu_pd(c+8, _mm512_sub_pd(_mm512_loadu_pd(c+8), c11));
+			c += ldc;
+			_mm512_storeu_pd(c,   _mm512_sub_pd(_mm512_loadu_pd(c),   c20));
+			_mm512_storeu_pd(c+8, _mm512_sub_pd(_mm512_loadu_pd(c+8), c21));
+			c += ldc;
+			_mm512_storeu_pd(c,   _mm512_sub_pd(_mm512_loadu_pd(c),   c30));
+			_mm512_storeu_pd(c+8, _mm512_sub_pd(_mm512_loadu_pd(c+8), c31));
+		}
+		gemm_avx2(4, n-j, k, a, lda, B+j, ldb, C+i*ldc+j, ldc);
+	}
+	gemm_avx2(m-i, n, k, A+i*lda, lda, B, ldb, C+i*ldc, ldc);
+}
+#endif
+
+static void blas_init()
+{
+	gemm_kernel = gemm_generic;
+	kernel_name = "generic";
+
+#ifdef BLAS_X86
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2")
+			&& __builtin_cpu_supports("fma") ) {
+		gemm_kernel = gemm_avx512;
+		kernel_name = "avx512";
+		vec_kernels_init(2);
+		sgemm_kernels_init(2);
+		return;
+	} else if ( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ) {
+		gemm_kernel = gemm_avx2;
+		kernel_name = "avx2";
+		vec_kernels_init(1);
+		sgemm_kernels_init(1);
+		return;
+	}
+#endif
+	vec_kernels_init(0);
+	sgemm_kernels_init(0);
+}
+
+const char *blas_kernel_name()
+{
+	pthread_once(&blas_once, blas_init);
+
+	return kernel_name;
+}
+
+// C -= A*B, tiled so that a KC x NC block of B is reused from cache
+void dgemm_sub(int m, int n, int k, const double *A, int lda,
+		const double *B, int ldb, double *C, int ldc)
+{
+	int j, p, nb, kb;
+
+	pthread_once(&blas_once, blas_init);
+
+	for ( j=0; j<n; j+=GEMM_NC ) {
+		nb = n-j < GEMM_NC ? n-j : GEMM_NC;
+		for ( p=0; p<k; p+=GEMM_KC ) {
+			kb = k-p < GEMM_KC ? k-p : GEMM_KC;
+			gemm_kernel(m, nb, kb, A+p, lda, B+p*ldb+j, ldb, C+j, ldc);
+		}
+	}
+}
+
+// B = inv(L)*B for a unit lower triangular m x m L, B is m x n
+void dtrsm_lower_unit(int m, int n, const double *L, int ldl, double *B, int ldb)
+{
+	int i;
+
+	for ( i=1; i<m; i++ )
+		gemm_ref(1, n, i, L+i*ldl, ldl, B, ldb, B+i*ldb, ldb);
+}
+
+/* Cholesky of an m x n panel stored by columns, A(i,j) = A[j*lda+i], whose
+ * first n rows hold the diagonal block: L11 overwrites its lower triangle and
+ * L21 = A21*inv(L11)' the rows below it. Non-positive pivots are replaced by
+ * 1. work holds n*POTRF_NB doubles. */
+void dpotrf_panel(int m, int n, double *A, int lda, double *work)
+{
+	int i, j, p, c, j0, nb;
+	double a, *a_j, *a_p;
+
+	for ( j0=0; j0<n; j0+=POTRF_NB ) {
+		nb = n-j0 < POTRF_NB ? n-j0 : POTRF_NB;
+
+		// A(j0:m,j0:j0+nb) -= L(j0:m,0:j0) * L(j0:j0+nb,0:j0)', on the transposed (row-major) view
+		if ( j0 > 0 ) {
+			for ( c=0; c<nb; c++ )
+				for ( p=0; p<j0; p++ )
+					work[c*j0+p] = A[p*lda+j0+c];
+
+			dgemm_sub(nb, m-j0, j0, work, j0, A+j0, lda, A+j0*lda+j0, lda);
+		}
+
+		for ( j=j0; j<j0+nb; j++ ) {
+			a_j = A + j*lda;
+
+			for ( p=j0; p<j; p++ ) {
+				a_p = A + p*lda;
+				a = a_p[j];
+				for ( i=j; i<m; i++ )
+					a_j[i] -= a_p[i] * a;
+			}
+
+			a = a_j[j] > 0.0 ? sqrt(a_j[j]) : 1.0;
+			a_j[j] = a;
+			for ( i=j+1; i<m; i++ )
+				a_j[i] /= a;
+		}
+	}
+}
+
+/* Single precision products for the mixed precision factorizations, the
+ * same blocking as the double ones with twice the lanes per register. */
+
+typedef void (*sgemm_kernel_t)(int m, int n, int k, const float *A, int lda,
+		const float *B, int ldb, float *C, int ldc);
+
+static sgemm_kernel_t sgemm_kernel = NULL;
+
+static void sgemm_ref(int m, int n, int k, const float *A, int lda,
+		const float *B, int ldb, float *C, int ldc)
+{
+	int i, j, p;
+	float a, *c;
+	const float *b;
+
+	for ( i=0; i<m; i++ ) {
+		c = C + i*ldc;
+		for ( p=0; p<k; p++ ) {
+			a = A[i*lda+p];
+			b = B + p*ldb;
+			for ( j=0; j<n; j++ )
+				c[j] -= a * b[j];
+		}
+	}
+}
+
+#ifdef BLAS_X86
+// 4x16 block: 8 ymm accumulators of 8 floats
+__attribute__((target("avx2,fma")))
+static void sgemm_avx2(int m, int n, int k, const float *A, int lda,
+		const float *B, int ldb, float *C, int ldc)
+{
+	int i, j, p;
+	const float *a, *b;
+	float *c;
+	__m256 c00, c01, c10, c11, c20, c21, c30, c31, b0, b1, t;
+
+	for ( i=0; i+4<=m; i+=4 ) {
+		a = A + i*lda;
+		for ( j=0; j+16<=n; j+=16 ) {
+			c00 = c01 = c10 = c11 = _mm256_setzero_ps();
+			c20 = c21 = c30 = c31 = _mm256_setzero_ps();
+
+			for ( p=0; p<k; p++ ) {
+				b = B + p*ldb + j;
+				b0 = _mm256_loadu_ps(b);
+				b1 = _mm256_loadu_ps(b+8);
+
+				t = _mm256_broadcast_ss(a+p);
+				c00 = _mm256_fmadd_ps(t, b0, c00);
+				c01 = _mm256_fmadd_ps(t, b1, c01);
+				t = _mm256_broadcast_ss(a+lda+p);
+				c10 = _mm256_fmadd_ps(t, b0, c10);
+				c11 = _mm256_fmadd_ps(t, b1, c11);
+				t = _mm256_broadcast_ss(a+2*lda+p);
+				c20 = _mm256_fmadd_ps(t, b0, c20);
+				c21 = _mm256_fmadd_ps(t, b1, c21);
+				t = _mm256_broadcast_ss(a+3*lda+p);
+				c30 = _mm256_fmadd_ps(t, b0, c30);
+				c31 = _mm256_fmadd_ps(t, b1, c31);
+			}
+
+			c = C + i*ldc + j;
+			_mm256_storeu_ps(c,   _mm256_sub_ps(_mm256_loadu_ps(c),   c00));
+			_mm256_storeu_ps(c+8, _mm256_sub_ps(_mm256_loadu_ps(c+8), c01));
+			c += ldc;
+			_mm256_storeu_ps(c,   _mm256_sub_ps(_mm256_loadu_ps(c),   c10));
+			_mm256_storeu_ps(c+8, _mm256_sub_ps(_mm256_loadu_ps(c+8), c11));
+			c += ldc;
+			_mm256_storeu_ps(c,   _mm256_sub_ps(_mm256_loadu_ps(c),   c20));
+			_mm256_storeu_ps(c+8, _mm256_sub_ps(_mm256_loadu_ps(c+8), c21));
+			c += ldc;
+			_mm256_storeu_ps(c,   _mm256_sub_ps(_mm256_loadu_ps(c),   c30));
+			_mm256_storeu_ps(c+8, _mm256_sub_ps(_mm256_loadu_ps(c+8), c31));
+		}
+		sgemm_ref(4, n-j, k, a, lda, B+j, ldb, C+i*ldc+j, ldc);
+	}
+	sgemm_ref(m-i, n, k, A+i*lda, lda, B, ldb, C+i*ldc, ldc);
+}
+
+// 4x32 block on zmm registers
+__attribute__((target("avx512f")))
+static void sgemm_avx512(int m, int n, int k, const float *A, int lda,
+		const float *B, int ldb, float *C, int ldc)
+{
+	int i, j, p;
+	const float *a, *b;
+	float *c;
+	__m512 c00, c01, c10, c11, c20, c21, c30, c31, b0, b1, t;
+
+	for ( i=0; i+4<=m; i+=4 ) {
+		a = A + i*lda;
+		for ( j=0; j+32<=n; j+=32 ) {
+			c00 = c01 = c10 = c11 = _mm512_setzero_ps();
+			c20 = c21 = c30 = c31 = _mm512_setzero_ps();
+
+			for ( p=0; p<k; p++ ) {
+				b = B + p*ldb + j;
+				b0 = _mm512_loadu_ps(b);
+				b1 = _mm512_loadu_ps(b+16);
+
+				t = _mm512_set1_ps(a[p]);
+				c00 = _mm512_fmadd_ps(t, b0, c00);
+				c01 = _mm512_fmadd_ps(t, b1, c01);
+				t = _mm512_set1_ps(a[lda+p]);
+				c10 = _mm512_fmadd_ps(t, b0, c10);
+				c11 = _mm512_fmadd_ps(t, b1, c11);
+				t = _mm512_set1_ps(a[2*lda+p]);
+				c20 = _mm512_fmadd_ps(t, b0, c20);
+				c21 = _mm512_fmadd_ps(t, b1, c21);
+				t = _mm512_set1_ps(a[3*lda+p]);
+				c30 = _mm512_fmadd_ps(t, b0, c30);
+				c31 = _mm512_fmadd_ps(t, b1, c31);
+			}
+
+			c = C + i*ldc + j;
+			_mm512_storeu_ps(c,    _mm512_sub_ps(_mm512_loadu_ps(c),    c00));
+			_mm512_storeu_ps(c+16, _mm512_sub_ps(_mm512_loadu_ps(c+16), c01));
+			c += ldc;
+			_mm512_storeu_ps(c,    _mm512_sub_ps(_mm512_loadu_ps(c),    c10));
+			_mm512_storeu_ps(c+16, _mm512_sub_ps(_mm512_loadu_ps(c+16), c11));
+			c += ldc;
+			_mm512_storeu_ps(c,    _mm512_sub_ps(_mm512_loadu_ps(c),    c20));
+			_mm512_storeu_ps(c+16, _mm512_sub_ps(_mm512_loadu_ps(c+16), c21));
+			c += ldc;
+			_mm512_storeu_ps(c,    _mm512_sub_ps(_mm512_loadu_ps(c),    c30));
+			_mm512_storeu_ps(c+16, _mm512_sub_ps(_mm512_loadu_ps(c+16), c31));
+		}
+		sgemm_avx2(4, n-j, k, a, lda, B+j, ldb, C+i*ldc+j, ldc);
+	}
+	sgemm_avx2(m-i, n, k, A+i*lda, lda, B, ldb, C+i*ldc, ldc);
+}
+#endif
+
+// 0: generic, 1: avx2, 2: avx512
+static void sgemm_kernels_init(int level)
+{
+	sgemm_kernel = sgemm_ref;
+
+#ifdef BLAS_X86
+	if ( level == 2 )
+		sgemm_kernel = sgemm_avx512;
+	else if ( level == 1 )
+		sgemm_kernel = sgemm_avx2;
+#endif
+}
+
+void sgemm_sub(int m, int n, int k, const float *A, int lda,
+		const float *B, int ldb, float *C, int ldc)
+{
+	int j, p, nb, kb;
+
+	pthread_once(&blas_once, blas_init);
+
+	for ( j=0; j<n; j+=GEMM_NC ) {
+		nb = n-j < GEMM_NC ? n-j : GEMM_NC;
+		for ( p=0; p<k; p+=GEMM_KC ) {
+			kb = k-p < GEMM_KC ? k-p : GEMM_KC;
+			sgemm_kernel(m, nb, kb, A+p, lda, B+p*ldb+j, ldb, C+j, ldc);
+		}
+	}
+}
+
+void strsm_lower_unit(int m, int n, const float *L, int ldl, float *B, int ldb)
+{
+	int i;
+
+	for ( i=1; i<m; i++ )
+		sgemm_ref(1, n, i, L+i*ldl, ldl, B, ldb, B+i*ldb, ldb);
+}
+
+/* Fused vector kernels of the Krylov solvers. Each one is a single pass over
+ * its operands; the vectorized variants keep several partial sums so the
+ * additions of a dot product do not wait on each other. */
+
+typedef struct VEC_KERNELS_T
+{
+	double (*dot)(int n, const double *x, const double *y);
+	double (*axpy_dot)(int n, double a, const double *x, double *y);
+	double (*scale_dot)(int n, const double *d, const double *r, double *z);
+	void (*axpy2)(int n, double a, const double *p, double *x,
+			double b, const double *q, double *y);
+	void (*xpby)(int n, const double *x, double b, double *y);
+} vec_kernels_t;
+
+static vec_kernels_t vk;
+
+static double dot_generic(int n, const double *x, const double *y)
+{
+	int i;
+	double s = 0;
+
+	for ( i=0; i<n; i++ )
+		s += x[i]*y[i];
+	return s;
+}
+
+static double axpy_dot_generic(int n, double a, const double *x, double *y)
+{
+	int i;
+	double s = 0;
+
+	for ( i=0; i<n; i++ ) {
+		y[i] += a*x[i];
+		s += y[i]*y[i];
+	}
+	return s;
+}
+
+static double scale_dot_generic(int n, const double *d, const double *r, double *z)
+{
+	int i;
+	double s = 0;
+
+	for ( i=0; i<n; i++ ) {
+		z[i] = d[i]*r[i];
+		s += z[i]*r[i];
+	}
+	return s;
+}
+
+static void axpy2_generic(int n, double a, const double *p, double *x,
+		double b, const double *q, double *y)
+{
+	int i;
+
+	for ( i=0; i<n; i++ ) {
+		x[i] += a*p[i];
+		y[i] += b*q[i];
+	}
+}
+
+static void xpby_generic(int n, const double *x, double b, double *y)
+{
+	int i;
+
+	for ( i=0; i<n; i++ )
+		y[i] = x[i] + b*y[i];
+}
+
+#ifdef BLAS_X86
+__attribute__((target("avx2,fma")))
+static double hsum_avx2(__m256d v)
+{
+	__m128d h = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+}
+
+__attribute__((target("avx2,fma")))
+static double dot_avx2(int n, const double *x, const double *y)
+{
+	int i;
+	double s;
+	__m256d s0 = _mm256_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+
+	for ( i=0; i+16<=n; i+=16 ) {
+		s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x+i), _mm256_loadu_pd(y+i), s0);
+		s1 = _mm256_fmadd_pd(_mm256_loadu_pd(x+i+4), _mm256_loadu_pd(y+i+4), s1);
+		s2 = _mm256_fmadd_pd(_mm256_loadu_pd(x+i+8), _mm256_loadu_pd(y+i+8), s2);
+		s3 = _mm256_fmadd_pd(_mm256_loadu_pd(x+i+12), _mm256_loadu_pd(y+i+12), s3);
+	}
+	for ( ; i+4<=n; i+=4 )
+		s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x+i), _mm256_loadu_pd(y+i), s0);
+
+	s = hsum_avx2(_mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+	for ( ; i<n; i++ )
+		s += x[i]*y[i];
+	return s;
+}
+
+__attribute__((target("avx2,fma")))
+static double axpy_dot_avx2(int n, double a, const double *x, double *y)
+{
+	int i;
+	double s;
+	__m256d va = _mm256_set1_pd(a), s0 = _mm256_setzero_pd(), s1 = s0, y0, y1;
+
+	for ( i=0; i+8<=n; i+=8 ) {
+		y0 = _mm256_fmadd_pd(va, _mm256_loadu_pd(x+i), _mm256_loadu_pd(y+i));
+		y1 = _mm256_fmadd_pd(va, _mm256_loadu_pd(x+i+4), _mm256_loadu_pd(y+i+4));
+		_mm256_storeu_pd(y+i, y0);
+		_mm256_storeu_pd(y+i+4, y1);
+		s0 = _mm256_fmadd_pd(y0, y0, s0);
+		s1 = _mm256_fmadd_pd(y1, y1, s1);
+	}
+
+	s = hsum_avx2(_mm256_add_pd(s0, s1));
+	for ( ; i<n; i++ ) {
+		y[i] += a*x[i];
+		s += y[i]*y[i];
+	}
+	return s;
+}
+
+__attribute__((target("avx2,fma")))
+static double scale_dot_avx2(int n, const double *d, const double *r, double *z)
+{
+	int i;
+	double s;
+	__m256d s0 = _mm256_setzero_pd(), s1 = s0, r0, r1, z0, z1;
+
+	for ( i=0; i+8<=n; i+=8 ) {
+		r0 = _mm256_loadu_pd(r+i);
+		r1 = _mm256_loadu_pd(r+i+4);
+		z0 = _mm256_mul_pd(_mm256_loadu_pd(d+i), r0);
+		z1 = _mm256_mul_pd(_mm256_loadu_pd(d+i+4), r1);
+		_mm256_storeu_pd(z+i, z0);
+		_mm256_storeu_pd(z+i+4, z1);
+		s0 = _mm256_fmadd_pd(z0, r0, s0);
+		s1 = _mm256_fmadd_pd(z1, r1, s1);
+	}
+
+	s = hsum_avx2(_mm256_add_pd(s0, s1));
+	for ( ; i<n; i++ ) {
+		z[i] = d[i]*r[i];
+		s += z[i]*r[i];
+	}
+	return s;
+}
+
+__attribute__((target("avx2,fma")))
+static void axpy2_avx2(int n, double a, const double *p, double *x,
+		double b, const double *q, double *y)
+{
+	int i;
+	__m256d va = _mm256_set1_pd(a), vb = _mm256_set1_pd(b);
+
+	for ( i=0; i+4<=n; i+=4 ) {
+		_mm256_storeu_pd(x+i, _mm256_fmadd_pd(va, _mm256_loadu_pd(p+i), _mm256_loadu_pd(x+i)));
+		_mm256_storeu_pd(y+i, _mm256_fmadd_pd(vb, _mm256_loadu_pd(q+i), _mm256_loadu_pd(y+i)));
+	}
+	for ( ; i<n; i++ ) {
+		x[i] += a*p[i];
+		y[i] += b*q[i];
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void xpby_avx2(int n, const double *x, double b, double *y)
+{
+	int i;
+	__m256d vb = _mm256_set1_pd(b);
+
+	for ( i=0; i+4<=n; i+=4 )
+		_mm256_storeu_pd(y+i, _mm256_fmadd_pd(vb, _mm256_loadu_pd(y+i), _mm256_loadu_pd(x+i)));
+	for ( ; i<n; i++ )
+		y[i] = x[i] + b*y[i];
+}
+
+__attribute__((target("avx512f")))
+static double dot_avx512(int n, const double *x, const double *y)
+{
+	int i;
+	double s;
+	__m512d s0 = _mm512_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+
+	for ( i=0; i+32<=n; i+=32 ) {
+		s0 = _mm512_fmadd_pd(_mm512_loadu_pd(x+i), _mm512_loadu_pd(y+i), s0);
+		s1 = _mm512_fmadd_pd(_mm512_loadu_pd(x+i+8), _mm512_loadu_pd(y+i+8), s1);
+		s2 = _mm512_fmadd_pd(_mm512_loadu_pd(x+i+16), _mm512_loadu_pd(y+i+16), s2);
+		s3 = _mm512_fmadd_pd(_mm512_loadu_pd(x+i+24), _mm512_loadu_pd(y+i+24), s3);
+	}
+	for ( ; i+8<=n; i+=8 )
+		s0 = _mm512_fmadd_pd(_mm512_loadu_pd(x+i), _mm512_loadu_pd(y+i), s0);
+
+	s = _mm512_reduce_add_pd(_mm512_add_pd(_mm512_add_pd(s0, s1), _mm512_add_pd(s2, s3)));
+	for ( ; i<n; i++ )
+		s += x[i]*y[i];
+	return s;
+}
+
+__attribute__((target("avx512f")))
+static double axpy_dot_avx512(int n, double a, const double *x, double *y)
+{
+	int i;
+	double s;
+	__m512d va = _mm512_set1_pd(a), s0 = _mm512_setzero_pd(), s1 = s0, y0, y1;
+
+	for ( i=0; i+16<=n; i+=16 ) {
+		y0 = _mm512_fmadd_pd(va, _mm512_loadu_pd(x+i), _mm512_loadu_pd(y+i));
+		y1 = _mm512_fmadd_pd(va, _mm512_loadu_pd(x+i+8), _mm512_loadu_pd(y+i+8));
+		_mm512_storeu_pd(y+i, y0);
+		_mm512_storeu_pd(y+i+8, y1);
+		s0 = _mm512_fmadd_pd(y0, y0, s0);
+		s1 = _mm512_fmadd_pd(y1, y1, s1);
+	}
+
+	s = _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+	for ( ; i<n; i++ ) {
+		y[i] += a*x[i];
+		s += y[i]*y[i];
+	}
+	return s;
+}
+
+__attribute__((target("avx512f")))
+static double scale_dot_avx512(int n, const double *d, const double *r, double *z)
+{
+	int i;
+	double s;
+	__m512d s0 = _mm512_setzero_pd(), s1 = s0, r0, r1, z0, z1;
+
+	for ( i=0; i+16<=n; i+=16 ) {
+		r0 = _mm512_loadu_pd(r+i);
+		r1 = _mm512_loadu_pd(r+i+8);
+		z0 = _mm512_mul_pd(_mm512_loadu_pd(d+i), r0);
+		z1 = _mm512_mul_pd(_mm512_loadu_pd(d+i+8), r1);
+		_mm512_storeu_pd(z+i, z0);
+		_mm512_storeu_pd(z+i+8, z1);
+		s0 = _mm512_fmadd_pd(z0, r0, s0);
+		s1 = _mm512_fmadd_pd(z1, r1, s1);
+	}
+
+	s = _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+	for ( ; i<n; i++ ) {
+		z[i] = d[i]*r[i];
+		s += z[i]*r[i];
+	}
+	return s;
+}
+
+__attribute__((target("avx512f")))
+static void axpy2_avx512(int n, double a, const double *p, double *x,
+		double b, const double *q, double *y)
+{
+	int i;
+	__m512d va = _mm512_set1_pd(a), vb = _mm512_set1_pd(b);
+
+	for ( i=0; i+8<=n; i+=8 ) {
+		_mm512_storeu_pd(x+i, _mm512_fmadd_pd(va, _mm512_loadu_pd(p+i), _mm512_loadu_pd(x+i)));
+		_mm512_storeu_pd(y+i, _mm512_fmadd_pd(vb, _mm512_loadu_pd(q+i), _mm512_loadu_pd(y+i)));
+	}
+	for ( ; i<n; i++ ) {
+		x[i] += a*p[i];
+		y[i] += b*q[i];
+	}
+}
+
+__attribute__((target("avx512f")))
+static void xpby_avx512(int n, const double *x, double b, double *y)
+{
+	int i;
+	__m512d vb = _mm512_set1_pd(b);
+
+	for ( i=0; i+8<=n; i+=8 )
+		_mm512_storeu_pd(y+i, _mm512_fmadd_pd(vb, _mm512_loadu_pd(y+i), _mm512_loadu_pd(x+i)));
+	for ( ; i<n; i++ )
+		y[i] = x[i] + b*y[i];
+}
+#endif
+
+// 0: generic, 1: avx2, 2: avx512
+static void vec_kernels_init(int level)
+{
+	vk.dot = dot_generic;
+	vk.axpy_dot = axpy_dot_generic;
+	vk.scale_dot = scale_dot_generic;
+	vk.axpy2 = axpy2_generic;
+	vk.xpby = xpby_generic;
+
+#ifdef BLAS_X86
+	if ( level == 2 ) {
+		vk.dot = dot_avx512;
+		vk.axpy_dot = axpy_dot_avx512;
+		vk.scale_dot = scale_dot_avx512;
+		vk.axpy2 = axpy2_avx512;
+		vk.xpby = xpby_avx512;
+	} else if ( level == 1 ) {
+		vk.dot = dot_avx2;
+		vk.axpy_dot = axpy_dot_avx2;
+		vk.scale_dot = scale_dot_avx2;
+		vk.axpy2 = axpy2_avx2;
+		vk.xpby = xpby_avx2;
+	}
+#endif
+}
+
+double vdot(int n, const double *x, const double *y)
+{
+	pthread_once(&blas_once, blas_init);
+
+	return vk.dot(n, x, y);
+}
+
+double vaxpy_dot(int n, double a, const double *x, double *y)
+{
+	pthread_once(&blas_once, blas_init);
+
+	return vk.axpy_dot(n, a, x, y);
+}
+
+double vscale_dot(int n, const double *d, const double *r, double *z)
+{
+	pthread_once(&blas_once, blas_init);
+
+	return vk.scale_dot(n, d, r, z);
+}
+
+void vaxpy2(int n, double a, const double *p, double *x,
+		double b, const double *q, double *y)
+{
+	pthread_once(&blas_once, blas_init);
+
+	vk.axpy2(n, a, p, x, b, q, y);
+}
+
+void vxpby(int n, const double *x, double b, double *y)
+{
+	pthread_once(&blas_once, blas_init);
+
+	vk.xpby(n, x, b, y);
+}
@@ -0,0 +1,28 @@
+#ifndef BLAS_H
+#define BLAS_H
+
+/* Dense kernels for row-major matrices with explicit leading dimensions.
+ * The vectorized variants are picked at run time from the CPU features. */
+
+void dgemm_sub(int m, int n, int k, const double *A, int lda,
+		const double *B, int ldb, double *C, int ldc);
+void dtrsm_lower_unit(int m, int n, const double *L, int ldl, double *B, int ldb);
+
+#define POTRF_NB 32  // column block of dpotrf_panel, its workspace is n*POTRF_NB
+void dpotrf_panel(int m, int n, double *A, int lda, double *work);
+const char *blas_kernel_name();
+
+/* Single precision C -= A*B and B = inv(L)*B, for the mixed precision factors */
+void sgemm_sub(int m, int n, int k, const float *A, int lda,
+		const float *B, int ldb, float *C, int ldc);
+void strsm_lower_unit(int m, int n, const float *L, int ldl, float *B, int ldb);
+
+/* Fused vector kernels of the Krylov solvers, same dispatch as the products */
+double vdot(int n, const double *x, const double *y);                     // x'y
+double vaxpy_dot(int n, double a, const double *x, double *y);            // y += a*x, returns y'y
+double vscale_dot(int n, const double *d, const double *r, double *z);    // z = d.*r, returns z'r
+void vaxpy2(int n, double a, const double *p, double *x,
+		double b, const double *q, double *y);                            // x += a*p, y += b*q
+void vxpby(int n, const double *x, double b, double *y);                  // y = x + b*y
+
+#endif
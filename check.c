@@ -3,34 +3,44 @@
 #include <math.h>
 int main(int argc , char *argv[]){
 	int i,size1,size2;
-	double sum , var;
-	if (argc!=5){
-		printf("./executable file1 file2 size1 size2\n");
+	double sum , var, tol;
+	if (argc!=5 && argc!=6){
+		printf("./executable file1 file2 size1 size2 [tolerance]\n");
 		exit(0);
 	}
 	FILE *f1,*f2;
 	f1 = fopen(argv[1],"r");
 	f2 = fopen(argv[2],"r");
+	if(f1==NULL || f2==NULL){
+		printf("missing %s\n", f1 ? argv[2] : argv[1]);
+		return(1);
+	}
 	size1 = atoi(argv[3]);
 	size2 = atoi(argv[4]);
+	tol = argc==6 ? atof(argv[5]) : 1e-6;
 	printf("SIZE %d----%d\n",size1,	size2);
-	if(size1!=size2){
+	if(size1!=size2 || size1==0){
 		printf("differnet sizes error\n");
-		return(0);
+		return(1);
 	}
 	double *first = (double*) calloc (size1,sizeof(double));
 	double *second = (double*) calloc (size1,sizeof(double));
 	sum = 0.0;
 	var = 0.0;
 	for(i = 0 ; i < size1 ; i++){
-		fscanf(f1," %lf",&first[i]);
-		fscanf(f2," %lf",&second[i]);
+		if(fscanf(f1," %lf",&first[i])!=1 || fscanf(f2," %lf",&second[i])!=1){
+			printf("short file error\n");
+			return(1);
+		}
 		sum = sum + fabs(first[i] - second[i]);
 		var = var + (first[i] - second[i])*(first[i] - second[i]);
 	}
 	sum = sum / ((double) size1);
 	var = var/  ((double) size1);
 	printf("average = %g variance = %g \n",sum,var);
-	
-	
+	if(!(sum<=tol)){
+		printf("%s: average above %g\n",argv[1],tol);
+		return(1);
+	}
+	return(0);
 }
\ No newline at end of file
@@ -1,7 +1,17 @@
-./zice $1 CORRECT 0
-cc=$?
-./zice $1 CHECKING 1
-rc=$?
-./check CORRECT CHECKING $cc $rc
-#rm CORRECT
-#rm CHECKING
\ No newline at end of file
+# usage: ./checking.sh <deck> [tolerance]
+# Solves the deck with its own options (CORRECT) and with the dense LU
+# (CHECKING, DEBUG 1), each in its own directory, then compares the DC points
+# and the plot files with ./check. Exits non-zero on a mismatch.
+deck=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+rm -rf CORRECT CHECKING
+mkdir CORRECT CHECKING
+(cd CORRECT && ../zice "$deck" dc 0 > log)
+(cd CHECKING && ../zice "$deck" dc 1 > log)
+ret=0
+for f in dc $(cd CHECKING && ls | grep '^plot_'); do
+  cc=$(cat CORRECT/$f 2>/dev/null | wc -w)
+  rc=$(cat CHECKING/$f | wc -w)
+  ./check CORRECT/$f CHECKING/$f $cc $rc $2 || ret=1
+done
+grep '^\[[-#]\]' CORRECT/log
+exit $ret
@@ -0,0 +1,121 @@
+# usage: ./checking_netlist.sh
+# The mapped netlist reader and its image against the grammar alone. A deck
+# read through a pipe goes through the grammar only (the reference). The
+# same deck, mapped with one and with four threads, and then written to and
+# restored from its image, must give the same G, C, DC point and plot files.
+# A copy of tests/netlist/edge.sp padded past three 4MB chunks puts its
+# boundary block across each chunk boundary. Exits non-zero on a mismatch.
+export LC_ALL=C
+dir=netlist_check
+zice=$(pwd)/zice
+ret=0
+rm -rf $dir
+mkdir $dir
+
+# run <name> <deck> [VAR=value ...]: solves the deck in $dir/<name>
+run() {
+  name=$1 deck=$2
+  shift 2
+  mkdir $dir/$name
+  (cd $dir/$name && env "$@" $zice ../$deck dc 0 > log)
+}
+
+# reference <name> <deck>: the grammar alone, no image
+reference() {
+  mkdir $dir/$1
+  (cd $dir/$1 && cat ../$2 | ZICE_NO_CACHE=1 $zice /dev/stdin dc 0 > log)
+}
+
+# same <reference> <name>: both parsed, the reference solved, the same files
+same() {
+  for r in $1 $2; do
+    grep -q "^Error\[\|^Unexpected character" $dir/$r/log && { echo "[-] $r: the deck does not parse"; ret=1; }
+  done
+  [ -s $dir/$1/dc ] || { echo "[-] $1: no DC point"; ret=1; }
+  for f in $( (ls $dir/$1; ls $dir/$2) | grep -v '^log$' | sort -u ); do
+    cmp -s $dir/$1/$f $dir/$2/$f || { echo "[-] $2: $f differs from the grammar"; ret=1; }
+  done
+}
+
+# logged <name> <pattern>
+logged() {
+  grep -q "$2" $dir/$1/log || { echo "[-] $1: no \"$2\""; ret=1; }
+}
+
+# check <deck>: the reader with one and four threads, then the image
+check() {
+  deck=$1
+  reference $deck.ref $deck
+  run $deck.1 $deck ZICE_NO_CACHE=1 ZICE_THREADS=1
+  run $deck.4 $deck ZICE_NO_CACHE=1 ZICE_THREADS=4
+  rm -f $dir/$deck.zbin
+  run $deck.save $deck ZICE_THREADS=4
+  run $deck.load $deck ZICE_THREADS=1
+  logged $deck.save "image saved"
+  logged $deck.load "restored"
+  for r in 1 4 save load; do
+    same $deck.ref $deck.$r
+  done
+}
+
+cp tests/netlist/edge.sp tests/netlist/error.sp $dir/
+
+# edge.sp with a grounded resistor ladder (and comment lines) in front of its
+# dot commands, the boundary block repeated across each 4MB boundary. The
+# k-th boundary falls about k/4 of the way into the block.
+awk -v chunk=4194304 '
+  function out(s) { printf "%s\n", s; bytes += length(s) + 1 }
+  function rung() {
+    out(sprintf("Rf%d x%d x%d 1.5", n, n, n+1))
+    if ( n % 10 == 0 )
+      out(sprintf("Rg%d x%d 0 100", n, n))
+    n++
+  }
+  /^\* boundary block/ { inblock = 1 }
+  inblock { block = block $0 "\n" }
+  /^\* end of boundary block/ { inblock = 0 }
+  /^\./ { dot = dot $0 "\n"; next }
+  { out($0) }
+  END {
+    for ( k = 1; k <= 3; k++ ) {
+      target = k*chunk - k*length(block)/4
+      while ( bytes < target - 200 ) {
+        rung()
+        out("* padding ------------------------------------------------------------------------------------------------------------")
+      }
+      while ( bytes < target )
+        rung()
+      printf "%s", block
+      bytes += length(block)
+    }
+    printf "%s", dot
+  }' $dir/edge.sp > $dir/big.sp
+
+check edge.sp
+check big.sp
+
+# an element edit misses the image, a dot command edit does not
+sed 's/^R8 12 0 3/R8 12 0 4/' $dir/edge.sp > $dir/edit.sp
+cp $dir/edge.sp.zbin $dir/edit.sp.zbin
+reference edit.sp.ref edit.sp
+run edit.sp.miss edit.sp
+logged edit.sp.miss "image saved"
+same edit.sp.ref edit.sp.miss
+
+sed 's/^\.tran 1e-3 2e-2/.tran 1e-3 1e-2/' $dir/edge.sp > $dir/tran.sp
+cp $dir/edge.sp.zbin $dir/tran.sp.zbin
+reference tran.sp.ref tran.sp
+run tran.sp.hit tran.sp
+logged tran.sp.hit "restored"
+logged tran.sp.hit "changed since its image"
+same tran.sp.ref tran.sp.hit
+
+# a syntax error stops both readers on the same line
+reference error.sp.ref error.sp
+run error.sp.4 error.sp ZICE_NO_CACHE=1 ZICE_THREADS=4
+logged error.sp.ref "Error\[6\]"
+grep Error $dir/error.sp.ref/log > $dir/error.ref
+grep Error $dir/error.sp.4/log | cmp -s - $dir/error.ref || { echo "[-] error.sp: the errors differ from the grammar"; ret=1; }
+
+[ $ret = 0 ] && echo "[+] Netlist reader matches the grammar"
+exit $ret
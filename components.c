@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "arena.h"
 #include "components.h"
 int voltages = 0;
 int currents = 0;
@@ -13,10 +15,29 @@ r_t *p_r = NULL;
 l_t *p_l = NULL;
 c_t *p_c = NULL;
 
+/* The elements, their names and transient specs and the identifiers of the
+ * parser all live in one arena, components_cleanup() drops it whole. */
+static arena_t circuit;
+
+void *circuit_alloc(size_t size)
+{
+  return arena_alloc(&circuit, size);
+}
+
+char *circuit_strndup(const char *s, size_t n)
+{
+  return arena_strndup(&circuit, s, n);
+}
+
+char *circuit_strdup(const char *s)
+{
+  return arena_strndup(&circuit, s, strlen(s));
+}
+
 void new_v(char *string_id, int plus, int minus, double value, transient_t *transient)
 {
   v_t *v;
-  v = (v_t*) calloc(1,sizeof(v_t));
+  v = (v_t*) circuit_alloc(sizeof(v_t));
   v->id = voltages++;
   v->plus = plus;
   v->minus = minus;
@@ -35,7 +56,7 @@ void new_v(char *string_id, int plus, int minus, double value, transient_t *tran
 void new_i(char *string_id, int plus, int minus, double value, transient_t *transient)
 {
   i_t *i;
-  i = (i_t*) calloc(1,sizeof(i_t));
+  i = (i_t*) circuit_alloc(sizeof(i_t));
   i->id = currents++;
   i->plus = plus;
   i->minus = minus;
@@ -53,7 +74,7 @@ void new_i(char *string_id, int plus, int minus, double value, transient_t *tran
 void new_r(int plus, int minus, double value)
 {
   r_t *r;
-  r = (r_t*) calloc(1,sizeof(r_t));
+  r = (r_t*) circuit_alloc(sizeof(r_t));
   r->id = resistors++;
   r->plus = plus;
   r->minus = minus;
@@ -69,7 +90,7 @@ void new_r(int plus, int minus, double value)
 void new_c(int plus, int minus, double value)
 {
   c_t *c;
-  c = (c_t*) calloc(1,sizeof(c_t));
+  c = (c_t*) circuit_alloc(sizeof(c_t));
   c->id = capacitors++;
   c->plus = plus;
   c->minus = minus;
@@ -85,7 +106,7 @@ void new_c(int plus, int minus, double value)
 void new_l(int plus, int minus, double value)
 {
   l_t *l;
-  l = (l_t*) calloc(1,sizeof(i_t));
+  l = (l_t*) circuit_alloc(sizeof(l_t));
   l->id = inductors++;
   l->plus = plus;
   l->minus = minus;
@@ -98,40 +119,42 @@ void new_l(int plus, int minus, double value)
 #endif
 }
 
-void cleanup_t1(v_t *root)
+/* Bulk counterpart of the new_*() calls: adds the elements in the order
+ * given, with the ids that many single calls would hand out */
+void components_append(const element_t *e, int n)
 {
-  v_t *p, *next;
-
-  for ( p=root; p; p=next ) {
-    next = p->next;
-    if ( p->transient ) {
-			if ( p->transient->type == Pwl )
-				free(p->transient->tpwl.pairs);
-
-      free(p->transient);
-		}
-    free(p);
-  }
-}
-
-void cleanup_t2(r_t *root)
-{
-  r_t *p, *next;
-
-  for ( p=root; p; p=next ) {
-    next = p->next;
-    free(p);
+  int k;
+
+  for ( k=0; k<n; k++ ) {
+    switch ( e[k].type ) {
+      case 'v':
+        new_v(e[k].string_id, e[k].plus, e[k].minus, e[k].val, e[k].transient);
+      break;
+
+      case 'i':
+        new_i(e[k].string_id, e[k].plus, e[k].minus, e[k].val, e[k].transient);
+      break;
+
+      case 'r':
+        new_r(e[k].plus, e[k].minus, e[k].val);
+      break;
+
+      case 'c':
+        new_c(e[k].plus, e[k].minus, e[k].val);
+      break;
+
+      case 'l':
+        new_l(e[k].plus, e[k].minus, e[k].val);
+      break;
+    }
   }
 }
 
 void components_cleanup()
 {
-  cleanup_t1(p_v);
-  cleanup_t1(p_i);
-  cleanup_t2(p_r);
-  cleanup_t2(p_c);
-  cleanup_t2(p_l);
+  arena_release(&circuit);
 
+  p_v = p_i = NULL;
+  p_r = p_c = p_l = NULL;
   inductors = resistors = capacitors = voltages = currents = 0;
 }
-
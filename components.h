@@ -1,5 +1,6 @@
 #ifndef COMPONENTS_H
 #define COMPONENTS_H
+#include <stddef.h>
 
 enum TransientType { Sin, Pwl, Pulse, Exp };
 
@@ -64,6 +65,17 @@ typedef struct R_T
   struct R_T *next;
 } r_t;
 
+/* An element for the bulk append, type is the first letter of its name in
+ * lower case, string_id and transient are kept for 'v' and 'i' only */
+typedef struct ELEMENT_T
+{
+  char type;
+  int plus, minus;
+  double val;
+  char *string_id;
+  transient_t *transient;
+} element_t;
+
 extern int voltages;
 extern int currents;
 extern int resistors;
@@ -83,9 +95,16 @@ void new_i(char *string_id, int plus, int minus, double value, transient_t *tran
 void new_r(int plus, int minus, double value);
 void new_c(int plus, int minus, double value);
 void new_l(int plus, int minus, double value);
+void components_append(const element_t *e, int n);
 
 void components_cleanup();
 
+/* Memory that lives as long as the circuit, zeroed. The names and transient
+ * specs handed to new_v()/new_i() must come from here. */
+void *circuit_alloc(size_t size);
+char *circuit_strndup(const char *s, size_t n);
+char *circuit_strdup(const char *s);
+
 
 
 #endif
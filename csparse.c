@@ -2,7 +2,9 @@
 #include <math.h>
 #include <limits.h>
 #include <assert.h>
+#include <time.h>
 #include "csparse.h"
+#include "blas.h"
 
 
 /********************************************************************************
@@ -155,6 +157,64 @@ cs *cs_compress(const cs *T) {
 	return (cs_done(C, w, NULL, 1)); /* success; free w and return C */
 }
 
+cs *cs_compress_map(const cs *T, int *map) {
+
+	int m, n, nz, p, q, i, j, k, *Cp, *Ci, *w, *slot, *Ti, *Tj;
+	double *Cx, *Tx;
+	cs *C;
+	if (!CS_TRIPLET (T) || !map)
+		return (NULL); /* check inputs */
+	m = T->m;
+	n = T->n;
+	Ti = T->i;
+	Tj = T->p;
+	Tx = T->x;
+	nz = T->nz;
+	C = cs_spalloc(m, n, nz, 1, 0); /* allocate result, values cleared */
+	w = (int *) cs_calloc(CS_MAX (m, n), sizeof(int)); /* get workspace */
+	slot = (int *) cs_malloc(nz, sizeof(int));
+	if (!C || !w || !slot) {
+		cs_free(slot);
+		return (cs_done(C, w, NULL, 0)); /* out of memory */
+	}
+	Cp = C->p;
+	Ci = C->i;
+	Cx = C->x;
+	for (k = 0; k < nz; k++)
+		w[Tj[k]]++; /* column counts */
+	cs_cumsum(Cp, w, n); /* column pointers */
+	for (k = 0; k < nz; k++) {
+		Ci[p = w[Tj[k]]++] = Ti[k]; /* A(i,j) is the pth entry in C */
+		map[k] = p;
+	}
+	for (i = 0; i < m; i++)
+		w[i] = -1; /* row i not yet seen */
+	nz = 0;
+	for (j = 0; j < n; j++) {
+		q = nz; /* column j will start at q */
+		for (p = Cp[j]; p < Cp[j + 1]; p++) {
+			i = Ci[p];
+			if (w[i] >= q) {
+				slot[p] = w[i]; /* A(i,j) is a duplicate */
+			} else {
+				w[i] = nz; /* record where row i occurs */
+				Ci[nz] = i;
+				slot[p] = nz++;
+			}
+		}
+		Cp[j] = q; /* record start of column j */
+	}
+	Cp[n] = nz; /* finalize C */
+	for (k = 0; k < T->nz; k++) {
+		map[k] = slot[map[k]]; /* kth triplet lives in C->x[map[k]] */
+		if (Tx)
+			Cx[map[k]] += Tx[k];
+	}
+	cs_free(slot);
+	cs_sprealloc(C, 0); /* remove extra space from C */
+	return (cs_done(C, w, NULL, 1)); /* success; free w and return C */
+}
+
 double cs_cumsum(int *p, int *c, int n) {
 
 	int i, nz = 0;
@@ -597,6 +657,130 @@ int *cs_post(const int *parent, int n) {
 	return (cs_idone(post, NULL, w, 1)); /* success; free w, return post */
 }
 
+/* sift down for the max-heap of subtrees keyed by their weight */
+static void cs_theap_down(int *heap, int size, int i, const double *w) {
+
+	int c, t;
+	for (c = 2 * i + 1; c < size; i = c, c = 2 * i + 1) {
+		if (c + 1 < size && w[heap[c + 1]] > w[heap[c]])
+			c++;
+		if (w[heap[c]] <= w[heap[i]])
+			break;
+		t = heap[c];
+		heap[c] = heap[i];
+		heap[i] = t;
+	}
+}
+
+static void cs_theap_push(int *heap, int *size, int j, const double *w) {
+
+	int i, t;
+	heap[(*size)++] = j;
+	for (i = *size - 1; i > 0 && w[heap[(i - 1) / 2]] < w[heap[i]]; i = (i - 1) / 2) {
+		t = heap[i];
+		heap[i] = heap[(i - 1) / 2];
+		heap[(i - 1) / 2] = t;
+	}
+}
+
+static int cs_theap_pop(int *heap, int *size, const double *w) {
+
+	int j = heap[0];
+	heap[0] = heap[--(*size)];
+	cs_theap_down(heap, *size, 0, w);
+	return (j);
+}
+
+cst *cs_tsfree(cst *T) {
+
+	if (!T)
+		return (NULL);
+	cs_free(T->order);
+	cs_free(T->ptr);
+	return ((cst *) cs_free(T));
+}
+
+cst *cs_tschedule(const int *parent, const int *colptr, int n, int parts) {
+
+	int i, j, k, p, nheap, *post, *first, *head, *next, *heap, *istop, *w;
+	double *weight, target;
+	cst *T;
+	if (!parent || n < 0 || parts < 1)
+		return (NULL);
+	post = cs_post(parent, n);
+	T = (cst *) cs_calloc(1, sizeof(cst));
+	weight = (double *) cs_malloc(n, sizeof(double));
+	w = (int *) cs_malloc(5 * n, sizeof(int));
+	if (T) {
+		T->order = (int *) cs_malloc(n, sizeof(int));
+		T->ptr = (int *) cs_malloc(n + 1, sizeof(int));
+	}
+	if (!post || !T || !weight || !w || !T->order || !T->ptr) {
+		cs_free(post);
+		cs_free(weight);
+		cs_free(w);
+		return (cs_tsfree(T));
+	}
+	first = w;
+	head = w + n;
+	next = w + 2 * n;
+	heap = w + 3 * n;
+	istop = w + 4 * n;
+	for (j = 0; j < n; j++) {
+		first[j] = -1;
+		head[j] = -1;
+		istop[j] = 0;
+		weight[j] = colptr ? colptr[j + 1] - colptr[j] : 1;
+	}
+	for (k = 0; k < n; k++) /* subtree weights and first descendants */
+	{
+		j = post[k];
+		for (i = j; i != -1 && first[i] == -1; i = parent[i])
+			first[i] = k; /* subtree of i is post [first [i] .. k] */
+		if (parent[j] != -1)
+			weight[parent[j]] += weight[j];
+	}
+	nheap = 0;
+	target = 0;
+	for (j = n - 1; j >= 0; j--) {
+		if (parent[j] == -1) {
+			target += weight[j];
+			cs_theap_push(heap, &nheap, j, weight);
+		} else {
+			next[j] = head[parent[j]]; /* add j to the children of its parent */
+			head[parent[j]] = j;
+		}
+	}
+	target /= parts;
+	/* split the heaviest subtree until all of them are light enough */
+	while (nheap > 0 && weight[heap[0]] > target && head[heap[0]] != -1) {
+		j = cs_theap_pop(heap, &nheap, weight);
+		istop[j] = 1; /* j waits for all of its subtrees */
+		for (i = head[j]; i != -1; i = next[i])
+			cs_theap_push(heap, &nheap, i, weight);
+	}
+	/* subtrees from the heaviest to the lightest, each one in postorder */
+	p = 0;
+	T->nsub = 0;
+	while (nheap > 0) {
+		j = cs_theap_pop(heap, &nheap, weight);
+		T->ptr[T->nsub++] = p;
+		for (k = first[j]; post[k] != j; k++)
+			T->order[p++] = post[k];
+		T->order[p++] = j;
+	}
+	T->ptr[T->nsub] = p;
+	for (k = 0; k < n; k++) /* then the nodes left at the top, in postorder */
+	{
+		if (istop[post[k]])
+			T->order[p++] = post[k];
+	}
+	cs_free(post);
+	cs_free(weight);
+	cs_free(w);
+	return (T);
+}
+
 int cs_leaf(int i, int j, const int *first, int *maxfirst, int *prevleaf, int *ancestor, int *jleaf) {
 
 	int q, s, sparent, jprev;
@@ -1092,73 +1276,708 @@ css *cs_schol(int order, const cs *A) {
 	return ((S->lnz >= 0) ? S : cs_sfree(S));
 }
 
-csn *cs_chol(const cs *A, const css *S) {
+/* computes L(k,:), the body of the up-looking loop shared by cs_chol() and cs_chol_par(),
+ * returns 0 if the pivot was not positive and has been replaced by 1 */
+static int cs_chol_row(const cs *C, int k, const int *parent, cs *L, int *c, int *s, double *x) {
 
 	double d, lki;
-	double *Lx, *x, *Cx;
-	int top, i, p, k, n, *Li, *Lp, *cp, *pinv, *s, *c, *parent, *Cp, *Ci;
-	cs *L, *C, *E;
-	csn *N;
-	if (!CS_CSC (A) || !S || !S->cp || !S->parent)
-		return (NULL);
-	n = A->n;
-	N = (csn *) cs_calloc(1, sizeof(csn)); /* allocate result */
-	c = (int *) cs_malloc(2 * n, sizeof(int)); /* get int workspace */
-	x = (double *) cs_malloc(n, sizeof(double)); /* get double workspace */
-	cp = S->cp;
-	pinv = S->pinv;
-	parent = S->parent;
-	C = pinv ? cs_symperm(A, pinv, 1) : ((cs *) A);
-	E = pinv ? C : NULL; /* E is alias for A, or a copy E=A(p,p) */
-	if (!N || !c || !x || !C)
-		return (cs_ndone(N, E, c, x, 0));
-	s = c + n;
+	double *Lx, *Cx;
+	int top, i, p, *Li, *Lp, *Cp, *Ci;
 	Cp = C->p;
 	Ci = C->i;
 	Cx = C->x;
-	N->L = L = cs_spalloc(n, n, cp[n], 1, 0); /* allocate result */
-	if (!L)
-		return (cs_ndone(N, E, c, x, 0));
 	Lp = L->p;
 	Li = L->i;
 	Lx = L->x;
+	/* --- Nonzero pattern of L(k,:) ------------------------------------ */
+	top = cs_ereach(C, k, parent, s, c); /* find pattern of L(k,:) */
+	x[k] = 0; /* x (0:k) is now zero */
+	for (p = Cp[k]; p < Cp[k + 1]; p++) /* x = full(triu(C(:,k))) */
+	{
+		if (Ci[p] <= k)
+			x[Ci[p]] = Cx[p];
+	}
+	d = x[k]; /* d = C(k,k) */
+	x[k] = 0; /* clear x for k+1st iteration */
+	/* --- Triangular solve --------------------------------------------- */
+	for (; top < C->n; top++) /* solve L(0:k-1,0:k-1) * x = C(:,k) */
+	{
+		i = s[top]; /* s [top..n-1] is pattern of L(k,:) */
+		lki = x[i] / Lx[Lp[i]]; /* L(k,i) = x (i) / L(i,i) */
+		x[i] = 0; /* clear x for k+1st iteration */
+		for (p = Lp[i] + 1; p < c[i]; p++) {
+			x[Li[p]] -= Lx[p] * lki;
+		}
+		d -= lki * lki; /* d = d - L(k,i)*L(k,i) */
+		p = c[i]++;
+		Li[p] = k; /* store L(k,i) in column i */
+		Lx[p] = lki;
+	}
+	/* --- Compute L(k,k) ----------------------------------------------- */
+	p = c[k]++;
+	Li[p] = k; /* store L(k,k) = sqrt (d) in column k */
+	Lx[p] = d > 0 ? sqrt(d) : 1;
+	return (d > 0);
+}
+
+/* allocates L and the column pointers c for cs_chol() and cs_chol_par() */
+static csn *cs_chol_alloc(const cs *A, const css *S, cs **C, int **c) {
+
+	int k, n;
+	csn *N;
+	n = A->n;
+	*C = NULL;
+	N = (csn *) cs_calloc(1, sizeof(csn)); /* allocate result */
+	*c = (int *) cs_malloc(2 * n, sizeof(int)); /* get int workspace */
+	if (!N || !*c)
+		return (cs_ndone(N, NULL, *c, NULL, 0));
+	*C = S->pinv ? cs_symperm(A, S->pinv, 1) : ((cs *) A);
+	if (!*C)
+		return (cs_ndone(N, NULL, *c, NULL, 0));
+	N->L = cs_spalloc(n, n, S->cp[n], 1, 0); /* allocate result */
+	if (!N->L)
+		return (cs_ndone(N, S->pinv ? *C : NULL, *c, NULL, 0));
 	for (k = 0; k < n; k++)
-		Lp[k] = c[k] = cp[k];
+		N->L->p[k] = (*c)[k] = S->cp[k];
+	N->L->p[n] = S->cp[n]; /* finalize L */
+	return (N);
+}
+
+static csn *cs_chol_seq(const cs *A, const css *S, int strict) {
+
+	double *x;
+	int k, n, *s, *c;
+	cs *C;
+	csn *N;
+	if (!CS_CSC (A) || !S || !S->cp || !S->parent)
+		return (NULL);
+	n = A->n;
+	N = cs_chol_alloc(A, S, &C, &c);
+	if (!N)
+		return (NULL);
+	x = (double *) cs_malloc(n, sizeof(double)); /* get double workspace */
+	if (!x)
+		return (cs_ndone(N, S->pinv ? C : NULL, c, x, 0));
+	s = c + n;
 	for (k = 0; k < n; k++) /* compute L(k,:) for L*L' = C */
+		if (!cs_chol_row(C, k, S->parent, N->L, c, s, x) && strict)
+			return (cs_ndone(N, S->pinv ? C : NULL, c, x, 0)); /* not pos def */
+	return (cs_ndone(N, S->pinv ? C : NULL, c, x, 1)); /* success: free E,s,x; return N */
+}
+
+csn *cs_chol(const cs *A, const css *S) {
+
+	return (cs_chol_seq(A, S, 0));
+}
+
+csn *cs_chol_strict(const cs *A, const css *S) {
+
+	return (cs_chol_seq(A, S, 1));
+}
+
+typedef struct cs_chol_job {
+	const cs *C;
+	const int *parent;
+	const cst *T;
+	cs *L;
+	int *c;
+	int *s; /* n ints per thread */
+	double *x;
+} cs_chol_job;
+
+static void cs_chol_task(int id, int thread, void *arg) {
+
+	cs_chol_job *job = (cs_chol_job *) arg;
+	int p, n = job->C->n;
+	for (p = job->T->ptr[id]; p < job->T->ptr[id + 1]; p++)
+		cs_chol_row(job->C, job->T->order[p], job->parent, job->L, job->c, job->s + thread * n, job->x);
+}
+
+csn *cs_chol_par(const cs *A, const css *S, const cst *T, cs_parfor parfor, int nthreads) {
+
+	int p, n, *c;
+	cs *C;
+	csn *N;
+	cs_chol_job job;
+	if (!CS_CSC (A) || !S || !S->cp || !S->parent || !T || !parfor || nthreads < 1)
+		return (NULL);
+	n = A->n;
+	N = cs_chol_alloc(A, S, &C, &c);
+	if (!N)
+		return (NULL);
+	job.C = C;
+	job.parent = S->parent;
+	job.T = T;
+	job.L = N->L;
+	job.c = c;
+	job.s = (int *) cs_malloc(n * nthreads, sizeof(int));
+	/* rows of unrelated subtrees touch disjoint parts of x and c, so both are shared */
+	job.x = (double *) cs_malloc(n, sizeof(double));
+	if (!job.s || !job.x) {
+		cs_free(job.s);
+		return (cs_ndone(N, S->pinv ? C : NULL, c, job.x, 0));
+	}
+	parfor(T->nsub, cs_chol_task, &job);
+	for (p = T->ptr[T->nsub]; p < n; p++) /* the top of the tree, in postorder */
+		cs_chol_row(C, T->order[p], S->parent, N->L, c, job.s, job.x);
+	cs_free(job.s);
+	return (cs_ndone(N, S->pinv ? C : NULL, c, job.x, 1));
+}
+
+static int cs_icmp(const void *a, const void *b) {
+
+	return (*(const int *) a - *(const int *) b);
+}
+
+/* below this many flops a descendant update is done with plain dot products */
+#define CS_SUPER_GEMM_MIN 4096
+
+csn *cs_chol_super(const cs *A, const css *S) {
+
+	double d, *Lsx, *X, *X2, *Xc, *Xd, *B, *U, *work, *Cx;
+	int i, j, k, p, q, s, t, n, ns, f, l, w, m, wd, md, p1, p2, mm, nn, maxw, maxmw;
+	int *parent, *cp, *super, *col2sup, *nchild, *rowptr, *rows, *R, *Rd, *flag, *map;
+	int *head, *lnext, *lpos, *shead, *snext, *Cp, *Ci, *msup, *rel;
+	long lnz, *xoff;
+	cs *C, *E, *L;
+	csn *N;
+	if (!CS_CSC (A) || !S || !S->cp || !S->parent)
+		return (NULL);
+	n = A->n;
+	parent = S->parent;
+	cp = S->cp;
+	super = (int *) cs_malloc(n + 1, sizeof(int));
+	col2sup = (int *) cs_malloc(n, sizeof(int));
+	nchild = (int *) cs_calloc(n, sizeof(int));
+	if (!super || !col2sup || !nchild) {
+		cs_free(super);
+		cs_free(col2sup);
+		return (cs_free(nchild));
+	}
+	/* --- Fundamental supernodes from the etree and the column counts --- */
+	for (j = 0; j < n; j++)
+		if (parent[j] != -1)
+			nchild[parent[j]]++;
+	for (ns = 0, j = 0; j < n; j++) {
+		if (j == 0 || parent[j - 1] != j || nchild[j] != 1 || cp[j] - cp[j - 1] != cp[j + 1] - cp[j] + 1)
+			super[ns++] = j; /* j starts a new supernode */
+	}
+	super[ns] = n;
+	/* --- Relaxed amalgamation: merge a supernode into the next one when it is
+	 * its child and the explicit zeros this adds to L stay few ----------- */
+	msup = nchild; /* nchild is no longer needed */
+	for (k = 0, s = 0; s < ns; s++) {
+		f = super[s];
+		l = super[s + 1];
+		m = cp[f + 1] - cp[f];
+		if (k > 0 && parent[f - 1] == f) {
+			w = l - super[k - 1];
+			mm = f - super[k - 1] + m; /* rows of the merged supernode */
+			d = (double) w * mm - (double) w * (w - 1) / 2; /* its entries */
+			d = (d - (cp[l] - cp[super[k - 1]])) / d; /* and the fraction of zeros */
+			if (w <= 4 || (w <= 16 && d < 0.8) || (w <= 48 && d < 0.1) || d < 0.05) {
+				msup[k - 1] = mm;
+				continue;
+			}
+		}
+		super[k] = f;
+		msup[k++] = m;
+	}
+	ns = k;
+	super[ns] = n;
+	for (s = 0; s < ns; s++)
+		for (j = super[s]; j < super[s + 1]; j++)
+			col2sup[j] = s;
+	/* --- Row structure of the supernodes --------------------------------- */
+	C = S->pinv ? cs_symperm(A, S->pinv, 1) : ((cs *) A);
+	E = C ? cs_transpose(C, 1) : NULL; /* E = tril(A(p,p)) */
+	if (S->pinv)
+		cs_spfree(C);
+	rowptr = (int *) cs_malloc(ns + 1, sizeof(int));
+	xoff = (long *) cs_malloc(ns + 1, sizeof(long));
+	for (lnz = 0, s = 0; s < ns; s++)
+		lnz += msup[s];
+	rows = (int *) cs_malloc(lnz > 0 ? lnz : 1, sizeof(int));
+	flag = (int *) cs_malloc(n, sizeof(int));
+	map = (int *) cs_malloc(n, sizeof(int));
+	head = (int *) cs_malloc(4 * ns, sizeof(int));
+	N = (csn *) cs_calloc(1, sizeof(csn));
+	Lsx = B = U = work = NULL;
+	if (!E || !rowptr || !xoff || !rows || !flag || !map || !head || !N)
+		goto done;
+	lnext = head + ns;
+	shead = head + 2 * ns;
+	snext = head + 3 * ns;
+	Cp = E->p;
+	Ci = E->i;
+	Cx = E->x;
+	for (s = 0; s < ns; s++)
+		shead[s] = -1;
+	for (s = ns - 1; s >= 0; s--) /* children of each supernode */
 	{
-		/* --- Nonzero pattern of L(k,:) ------------------------------------ */
-		top = cs_ereach(C, k, parent, s, c); /* find pattern of L(k,:) */
-		x[k] = 0; /* x (0:k) is now zero */
-		for (p = Cp[k]; p < Cp[k + 1]; p++) /* x = full(triu(C(:,k))) */
+		j = parent[super[s + 1] - 1];
+		if (j == -1)
+			continue;
+		snext[s] = shead[col2sup[j]];
+		shead[col2sup[j]] = s;
+	}
+	for (j = 0; j < n; j++)
+		flag[j] = -1;
+	maxw = maxmw = 0;
+	rowptr[0] = 0;
+	xoff[0] = 0;
+	for (s = 0; s < ns; s++) {
+		f = super[s];
+		l = super[s + 1];
+		w = l - f;
+		m = msup[s];
+		R = rows + rowptr[s];
+		k = 0;
+		for (j = f; j < l; j++) {
+			R[k++] = j;
+			flag[j] = s;
+		}
+		for (j = f; j < l; j++) /* rows of A(:,f:l-1) */
 		{
-			if (Ci[p] <= k)
-				x[Ci[p]] = Cx[p];
+			for (p = Cp[j]; p < Cp[j + 1]; p++) {
+				i = Ci[p];
+				if (flag[i] != s) {
+					flag[i] = s;
+					R[k++] = i;
+				}
+			}
 		}
-		d = x[k]; /* d = C(k,k) */
-		x[k] = 0; /* clear x for k+1st iteration */
-		/* --- Triangular solve --------------------------------------------- */
-		for (; top < n; top++) /* solve L(0:k-1,0:k-1) * x = C(:,k) */
+		for (t = shead[s]; t != -1; t = snext[t]) /* and rows of the children */
 		{
-			i = s[top]; /* s [top..n-1] is pattern of L(k,:) */
-			lki = x[i] / Lx[Lp[i]]; /* L(k,i) = x (i) / L(i,i) */
-			x[i] = 0; /* clear x for k+1st iteration */
-			for (p = Lp[i] + 1; p < c[i]; p++) {
-				x[Li[p]] -= Lx[p] * lki;
+			for (p = rowptr[t] + super[t + 1] - super[t]; p < rowptr[t + 1]; p++) {
+				i = rows[p];
+				if (flag[i] != s) {
+					flag[i] = s;
+					R[k++] = i;
+				}
 			}
-			d -= lki * lki; /* d = d - L(k,i)*L(k,i) */
-			p = c[i]++;
-			Li[p] = k; /* store L(k,i) in column i */
-			Lx[p] = lki;
 		}
-		/* --- Compute L(k,k) ----------------------------------------------- */
-		if (d <= 0)
-			d=1;
-		p = c[k]++;
-		Li[p] = k; /* store L(k,k) = sqrt (d) in column k */
-		Lx[p] = sqrt(d);
+		if (k != m)
+			goto done; /* column counts do not match the pattern */
+		qsort(R + w, m - w, sizeof(int), cs_icmp);
+		rowptr[s + 1] = rowptr[s] + m;
+		xoff[s + 1] = xoff[s] + (long) m * w;
+		if (w > maxw)
+			maxw = w;
+		if (m * w > maxmw)
+			maxmw = m * w;
+	}
+	Lsx = (double *) cs_malloc(xoff[ns] > 0 ? xoff[ns] : 1, sizeof(double));
+	U = (double *) cs_malloc(maxmw, sizeof(double));
+	B = (double *) cs_malloc(maxw * maxw, sizeof(double));
+	work = (double *) cs_malloc(maxw * POTRF_NB, sizeof(double));
+	if (!Lsx || !U || !B || !work)
+		goto done;
+	/* --- Left-looking numeric factorization, one dense panel per supernode */
+	lpos = shead; /* next row of each supernode to apply, reuses shead */
+	rel = flag;
+	for (s = 0; s < ns; s++)
+		head[s] = -1;
+	for (s = 0; s < ns; s++) {
+		f = super[s];
+		l = super[s + 1];
+		w = l - f;
+		m = rowptr[s + 1] - rowptr[s];
+		R = rows + rowptr[s];
+		X = Lsx + xoff[s]; /* m x w, by columns */
+		for (p = 0; p < m * w; p++)
+			X[p] = 0;
+		for (p = 0; p < m; p++)
+			map[R[p]] = p;
+		for (j = f; j < l; j++)
+			for (p = Cp[j]; p < Cp[j + 1]; p++)
+				X[(j - f) * m + map[Ci[p]]] = Cx[p];
+		/* updates from the supernodes linked to s */
+		for (t = head[s]; t != -1; t = q) {
+			q = lnext[t];
+			wd = super[t + 1] - super[t];
+			md = rowptr[t + 1] - rowptr[t];
+			Rd = rows + rowptr[t];
+			Xd = Lsx + xoff[t];
+			p1 = lpos[t];
+			for (p2 = p1; p2 < md && Rd[p2] < l; p2++)
+				;
+			mm = md - p1;
+			nn = p2 - p1;
+			for (i = 0; i < mm; i++) /* rows of t in the panel of s */
+				rel[i] = map[Rd[p1 + i]];
+			if ((long) mm * nn * wd < CS_SUPER_GEMM_MIN) {
+				for (j = 0; j < nn; j++) {
+					X2 = X + (Rd[p1 + j] - f) * m;
+					for (p = 0; p < wd; p++) {
+						Xc = Xd + p * md + p1;
+						d = Xc[j];
+						for (i = j; i < mm; i++)
+							X2[rel[i]] -= Xc[i] * d;
+					}
+				}
+			} else {
+				for (j = 0; j < nn; j++) /* B = Ld(p1:p2-1,:) */
+					for (p = 0; p < wd; p++)
+						B[j * wd + p] = Xd[p * md + p1 + j];
+				for (p = 0; p < mm * nn; p++)
+					U[p] = 0;
+				dgemm_sub(nn, mm, wd, B, wd, Xd + p1, md, U, mm); /* U = -(Ld*B')' */
+				for (j = 0; j < nn; j++) {
+					X2 = X + (Rd[p1 + j] - f) * m;
+					for (i = j; i < mm; i++)
+						X2[rel[i]] += U[j * mm + i];
+				}
+			}
+			lpos[t] = p2;
+			if (p2 < md) /* t updates the supernode of row Rd [p2] next */
+			{
+				k = col2sup[Rd[p2]];
+				lnext[t] = head[k];
+				head[k] = t;
+			}
+		}
+		dpotrf_panel(m, w, X, m, work);
+		lpos[s] = w;
+		if (w < m) {
+			k = col2sup[R[w]];
+			lnext[s] = head[k];
+			head[k] = s;
+		}
+	}
+	/* --- Copy the panels into L, the explicit zeros of the merges included */
+	for (lnz = 0, s = 0; s < ns; s++) {
+		w = super[s + 1] - super[s];
+		lnz += (long) w * msup[s] - (long) w * (w - 1) / 2;
+	}
+	N->L = L = cs_spalloc(n, n, lnz, 1, 0);
+	if (!L)
+		goto done;
+	for (k = 0, s = 0; s < ns; s++) {
+		f = super[s];
+		w = super[s + 1] - f;
+		m = rowptr[s + 1] - rowptr[s];
+		R = rows + rowptr[s];
+		X = Lsx + xoff[s];
+		for (j = 0; j < w; j++) {
+			L->p[f + j] = k;
+			memcpy(L->i + k, R + j, (m - j) * sizeof(int));
+			memcpy(L->x + k, X + j * m + j, (m - j) * sizeof(double));
+			k += m - j;
+		}
+	}
+	L->p[n] = k;
+	done:
+	cs_free(super);
+	cs_free(col2sup);
+	cs_free(msup);
+	cs_spfree(E);
+	cs_free(rowptr);
+	cs_free(xoff);
+	cs_free(rows);
+	cs_free(flag);
+	cs_free(map);
+	cs_free(head);
+	cs_free(Lsx);
+	cs_free(U);
+	cs_free(B);
+	cs_free(work);
+	if (N && !N->L)
+		return (cs_nfree(N));
+	return (N);
+}
+
+/* Moves the keep entries of idx[0..nz) with the largest |x| to the front,
+ * keep < nz (Wirth's selection) */
+static void cs_ikeep(int *idx, const double *x, int nz, int keep) {
+
+	int i, j, lo = 0, hi = nz - 1, t;
+	double v;
+	while (lo < hi) {
+		v = fabs(x[idx[keep]]);
+		i = lo;
+		j = hi;
+		do {
+			while (fabs(x[idx[i]]) > v)
+				i++;
+			while (v > fabs(x[idx[j]]))
+				j--;
+			if (i <= j) {
+				t = idx[i];
+				idx[i++] = idx[j];
+				idx[j--] = t;
+			}
+		} while (i <= j);
+		if (j < keep)
+			lo = i;
+		if (keep < i)
+			hi = j;
+	}
+}
+
+/* Drops the entries of idx[0..nz) below tol, keeps the keep largest of the
+ * rest and sorts them by row. Returns how many are left. */
+static int cs_idrop(int *idx, const double *x, int nz, double tol, int keep) {
+
+	int k, m;
+	for (m = 0, k = 0; k < nz; k++)
+		if (fabs(x[idx[k]]) >= tol && x[idx[k]] != 0)
+			idx[m++] = idx[k];
+	if (m > keep) {
+		cs_ikeep(idx, x, m, keep);
+		m = keep;
 	}
-	Lp[n] = cp[n]; /* finalize L */
-	return (cs_ndone(N, E, c, x, 1)); /* success: free E,s,x; return N */
+	qsort(idx, m, sizeof(int), cs_icmp);
+	return (m);
+}
+
+/* Makes room for nz more entries in the columns of C */
+static int cs_igrow(cs *C, int used, int nz) {
+
+	if (used + nz <= C->nzmax)
+		return (1);
+	return (cs_sprealloc(C, 2 * C->nzmax + nz));
+}
+
+csn *cs_ichol(const cs *A, double droptol, int fill) {
+
+	double d, anorm, lkj, tol, *x, *Ax, *Lx;
+	int i, j, k, kn, p, q, n, nz, na, m, lnz, *Ap, *Ai, *Li, *mark, *idx, *head, *next, *pos, *w;
+	cs *L;
+	csn *N;
+	if (!CS_CSC (A))
+		return (NULL);
+	n = A->n;
+	Ap = A->p;
+	Ai = A->i;
+	Ax = A->x;
+	N = (csn *) cs_calloc(1, sizeof(csn));
+	if (!N)
+		return (NULL);
+	N->L = L = cs_spalloc(n, n, Ap[n] / 2 + n + (droptol > 0 ? n * fill : 0), 1, 0);
+	x = (double *) cs_malloc(n, sizeof(double));
+	w = (int *) cs_malloc(5 * n, sizeof(int));
+	if (!x || !w || !L)
+		return (cs_ndone(N, NULL, w, x, 0));
+	mark = w;
+	idx = w + n;
+	head = w + 2 * n;
+	next = w + 3 * n;
+	pos = w + 4 * n;
+	for (j = 0; j < n; j++) {
+		mark[j] = -1;
+		head[j] = -1;
+	}
+	for (lnz = 0, j = 0; j < n; j++) {
+		L->p[j] = lnz;
+		/* --- x = tril (A (:,j)) ------------------------------------------ */
+		mark[j] = j;
+		idx[0] = j;
+		x[j] = 0;
+		for (nz = 1, d = 0, p = Ap[j]; p < Ap[j + 1]; p++) {
+			i = Ai[p];
+			if (i < j)
+				continue;
+			if (mark[i] != j) {
+				mark[i] = j;
+				idx[nz++] = i;
+				x[i] = 0;
+			}
+			x[i] += Ax[p];
+			d += Ax[p] * Ax[p];
+		}
+		na = nz - 1;
+		anorm = sqrt(d);
+		tol = droptol * anorm;
+		/* --- x -= L (j:n,k) * L (j,k) for every column k with L (j,k) != 0 */
+		Li = L->i;
+		Lx = L->x;
+		for (k = head[j]; k != -1; k = kn) {
+			kn = next[k];
+			q = pos[k];
+			lkj = Lx[q];
+			for (p = q; p < L->p[k + 1]; p++) {
+				i = Li[p];
+				if (mark[i] != j) {
+					if (droptol <= 0)
+						continue; /* IC(0): no fill outside the pattern of A */
+					mark[i] = j;
+					idx[nz++] = i;
+					x[i] = 0;
+				}
+				x[i] -= Lx[p] * lkj;
+			}
+			if (++q < L->p[k + 1]) { /* k joins the list of its next row */
+				pos[k] = q;
+				next[k] = head[Li[q]];
+				head[Li[q]] = k;
+			}
+		}
+		/* --- L (:,j) ------------------------------------------------------- */
+		d = x[j];
+		if (d > 0) {
+			d = sqrt(d);
+			m = cs_idrop(idx + 1, x, nz - 1, droptol > 0 ? tol : 0, droptol > 0 ? na + fill : nz - 1);
+		} else { /* breakdown, e.g. a voltage source row: keep only a diagonal */
+			d = anorm > 0 ? sqrt(anorm) : 1;
+			m = 0;
+		}
+		if (!cs_igrow(L, lnz, m + 1))
+			return (cs_ndone(N, NULL, w, x, 0));
+		Li = L->i;
+		Lx = L->x;
+		Li[lnz] = j;
+		Lx[lnz++] = d;
+		for (k = 1; k <= m; k++) {
+			Li[lnz] = idx[k];
+			Lx[lnz++] = x[idx[k]] / d;
+		}
+		if (m > 0) {
+			pos[j] = L->p[j] + 1;
+			next[j] = head[idx[1]];
+			head[idx[1]] = j;
+		}
+	}
+	L->p[n] = lnz;
+	cs_sprealloc(L, 0);
+	return (cs_ndone(N, NULL, w, x, 1));
+}
+
+/* Pops the smallest row index of the heap */
+static int cs_iheap_pop(int *heap, int *size) {
+
+	int i, c, t, j = heap[0];
+	heap[0] = heap[--(*size)];
+	for (i = 0; (c = 2 * i + 1) < *size; i = c) {
+		if (c + 1 < *size && heap[c + 1] < heap[c])
+			c++;
+		if (heap[i] <= heap[c])
+			break;
+		t = heap[i];
+		heap[i] = heap[c];
+		heap[c] = t;
+	}
+	return (j);
+}
+
+static void cs_iheap_push(int *heap, int *size, int j) {
+
+	int i, t;
+	heap[(*size)++] = j;
+	for (i = *size - 1; i > 0 && heap[(i - 1) / 2] > heap[i]; i = (i - 1) / 2) {
+		t = heap[i];
+		heap[i] = heap[(i - 1) / 2];
+		heap[(i - 1) / 2] = t;
+	}
+}
+
+csn *cs_ilu(const cs *A, double droptol, int fill) {
+
+	double d, ujj, ukj, tol, *x, *Ax, *Lx;
+	int i, j, k, p, n, nz, nu, nl, mu, ml, lo, nheap, lnz, unz, *Ap, *Ai, *Li, *mark, *idx, *heap, *w;
+	cs *L, *U;
+	csn *N;
+	if (!CS_CSC (A))
+		return (NULL);
+	n = A->n;
+	Ap = A->p;
+	Ai = A->i;
+	Ax = A->x;
+	N = (csn *) cs_calloc(1, sizeof(csn));
+	if (!N)
+		return (NULL);
+	N->L = L = cs_spalloc(n, n, Ap[n] / 2 + n + (droptol > 0 ? n * fill : 0), 1, 0);
+	N->U = U = cs_spalloc(n, n, Ap[n] / 2 + n + (droptol > 0 ? n * fill : 0), 1, 0);
+	x = (double *) cs_malloc(n, sizeof(double));
+	w = (int *) cs_malloc(3 * n, sizeof(int));
+	if (!x || !w || !L || !U)
+		return (cs_ndone(N, NULL, w, x, 0));
+	mark = w;
+	idx = w + n;
+	heap = w + 2 * n;
+	for (j = 0; j < n; j++)
+		mark[j] = -1;
+	for (lnz = 0, unz = 0, j = 0; j < n; j++) {
+		L->p[j] = lnz;
+		U->p[j] = unz;
+		/* --- x = A (:,j), rows above j go to the heap -------------------- */
+		mark[j] = j;
+		idx[0] = j;
+		x[j] = 0;
+		for (nz = 1, nheap = 0, d = 0, p = Ap[j]; p < Ap[j + 1]; p++) {
+			i = Ai[p];
+			if (mark[i] != j) {
+				mark[i] = j;
+				idx[nz++] = i;
+				x[i] = 0;
+				if (i < j)
+					cs_iheap_push(heap, &nheap, i);
+			}
+			x[i] += Ax[p];
+			d += Ax[p] * Ax[p];
+		}
+		for (nu = 0, k = 1; k < nz; k++)
+			nu += (idx[k] < j);
+		nl = nz - 1 - nu;
+		tol = droptol * sqrt(d);
+		/* --- x -= L (:,k) * U (k,j) in increasing k ---------------------- */
+		Li = L->i;
+		Lx = L->x;
+		while (nheap > 0) {
+			k = cs_iheap_pop(heap, &nheap);
+			ukj = x[k];
+			if (droptol > 0 && fabs(ukj) < tol) {
+				x[k] = 0; /* dropped, cs_idrop skips it */
+				continue;
+			}
+			for (p = L->p[k] + 1; p < L->p[k + 1]; p++) {
+				i = Li[p];
+				if (mark[i] != j) {
+					if (droptol <= 0)
+						continue; /* ILU(0): no fill outside the pattern of A */
+					mark[i] = j;
+					idx[nz++] = i;
+					x[i] = 0;
+					if (i < j)
+						cs_iheap_push(heap, &nheap, i);
+				}
+				x[i] -= Lx[p] * ukj;
+			}
+		}
+		ujj = x[j];
+		if (ujj == 0) /* zero pivot: replace it by a small multiple of the column norm */
+			ujj = d > 0 ? (droptol > 0 ? tol : 1e-6 * sqrt(d)) : 1;
+		/* --- split x into U (:,j) and L (:,j), then drop ------------------ */
+		for (mu = 0, k = 1; k < nz; k++) {
+			if (idx[k] < j) {
+				i = idx[k];
+				idx[k] = idx[1 + mu];
+				idx[1 + mu++] = i;
+			}
+		}
+		lo = 1 + mu;
+		mu = cs_idrop(idx + 1, x, mu, droptol > 0 ? tol : 0, droptol > 0 ? nu + fill : mu);
+		ml = cs_idrop(idx + lo, x, nz - lo, droptol > 0 ? tol : 0, droptol > 0 ? nl + fill : nz - lo);
+		if (!cs_igrow(U, unz, mu + 1) || !cs_igrow(L, lnz, ml + 1))
+			return (cs_ndone(N, NULL, w, x, 0));
+		for (k = 1; k <= mu; k++) {
+			U->i[unz] = idx[k];
+			U->x[unz++] = x[idx[k]];
+		}
+		U->i[unz] = j; /* the diagonal goes last in U, first in L */
+		U->x[unz++] = ujj;
+		L->i[lnz] = j;
+		L->x[lnz++] = 1;
+		for (k = 0; k < ml; k++) {
+			L->i[lnz] = idx[lo + k];
+			L->x[lnz++] = x[idx[lo + k]] / ujj;
+		}
+	}
+	L->p[n] = lnz;
+	U->p[n] = unz;
+	cs_sprealloc(L, 0);
+	cs_sprealloc(U, 0);
+	return (cs_ndone(N, NULL, w, x, 1));
 }
 
 int cs_rechol(const cs *A, const csn *N, int *pinv, int *c, double *x) {
@@ -1251,21 +2070,28 @@ int cs_reltol(cs *A, double tol) {
  *                            UTILITY FUNCTIONS                                 *
  *                                                                              *
  ********************************************************************************/
-double cs_atxy(cs *A, int x, int y)
+int cs_slot(const cs *A, int i, int j)
 {
-  int i;
-  csi *Ap, *Ai ;
-  double *Ax ;
+	int p;
 
-  if (CS_CSC (A)) {
-		Ap = A->p ; Ai = A->i ; Ax = A->x ;
-		
-		for ( i=Ap[y]; i < Ap[y+1] ; i++ ) {
-			if ( Ai[i] == x )
-				return Ax[i];
-		}
+	if (!CS_CSC (A) || j < 0 || j >= A->n)
+		return -1;
+
+	for ( p=A->p[j]; p < A->p[j+1]; p++ )
+		if ( A->i[p] == i )
+			return p;
+
+	return -1;
+}
+
+double cs_atxy(cs *A, int x, int y)
+{
+  int i;
+
+  if (CS_CSC (A)) {
+		i = cs_slot(A, x, y);
 
-		return 0;
+		return i < 0 ? 0 : A->x[i];
 	} else if ( CS_TRIPLET(A) ) {
 
 		for ( i = 0 ; i < A->nz; i++ ) 
@@ -1300,26 +2126,43 @@ int cs_add_to_entry(cs *T, int i, int j, double x)
 void cs_get_diag(const cs *T,  double *m, int size)
 {
 
-  int i,j,c;
+  int j,c;
+	char *found;
+
+	if ( CS_CSC(T) ) {
+		for (j=0; j < size; j++ ) {
+			m[j] = 1;
+			for ( c = T->p[j]; c < T->p[j+1]; c++ )
+				if ( T->i[c] == j ) {
+					m[j] = T->x[c];
+					if (fabs(m[j])>0.0001)
+						m[j] = 1/T->x[c];
+					break;
+				}
+		}
+		return;
+	}
 
-  for (i=0; i < size; i++ ) {
-    for ( j=0; j < size; j++ ) {
-      for ( c = 0 ; c < T->nz; c++ ) 
-        if ( T->i[c] == i && T->p[c] == j ) {
-          break;
-        }
+	// triplets: one pass gathers the diagonal, duplicates add up like cs_compress
+	found = (char*) calloc(size, sizeof(char));
+	assert(found);
 
-			if ( i == j ) {
-	      if ( c != T->nz ) {
-  	    	m[i] = T->x[c];
-					if (fabs(m[i])>0.0001)
-						m[i] = 1/T->x[c];
-    	  } else {
-					m[i] = 1;
-      	}
-			}
-    }
-  }
+	for ( c = 0; c < T->nz; c++ ) {
+		j = T->i[c];
+		if ( j != T->p[c] || j >= size )
+			continue;
+		m[j] = found[j] ? m[j] + T->x[c] : T->x[c];
+		found[j] = 1;
+	}
+
+	for ( j = 0; j < size; j++ ) {
+		if ( !found[j] )
+			m[j] = 1;
+		else if ( fabs(m[j]) > 0.0001 )
+			m[j] = 1/m[j];
+	}
+
+	free(found);
 }
 
 int cs_print_formated(const cs *T, FILE* f, int size)
@@ -1327,6 +2170,20 @@ int cs_print_formated(const cs *T, FILE* f, int size)
 
   int i,j,c;
 	
+	if ( CS_CSC(T) ) {
+		for (i=0; i < size; i++ ) {
+			for ( j=0; j < size; j++ ) {
+				c = cs_slot(T, i, j);
+				if ( c >= 0 )
+					fprintf(f, "%10g\t", T->x[c]);
+				else
+					fprintf(f,"         0\t");
+			}
+			fprintf(f,"\n");
+		}
+		return 1;
+	}
+
 	if (!CS_TRIPLET(T) )
 		assert(0);
 
@@ -1517,6 +2374,369 @@ csn *cs_lu (const cs *A, const css *S, double tol)
     return (cs_ndone (N, NULL, xi, x, 1)) ;     /* success */
 }
 
+/* --- Single precision factors for the mixed precision solves --------------- */
+/* L and U only hold the pattern, the values are the floats Lx and Ux */
+
+csnf *cs_nffree (csnf *N)
+{
+    if (!N) return (NULL) ;
+    cs_spfree (N->L) ;
+    cs_spfree (N->U) ;
+    cs_free (N->Lx) ;
+    cs_free (N->Ux) ;
+    cs_free (N->pinv) ;
+    return ((csnf *) cs_free (N)) ;
+}
+
+static csnf *cs_nfdone (csnf *N, cs *C, void *w, void *x, csi ok)
+{
+    cs_spfree (C) ;                     /* free temporary matrix */
+    cs_free (w) ;                       /* free workspace */
+    cs_free (x) ;
+    return (ok ? N : cs_nffree (N)) ;
+}
+
+/* grows the pattern of A and its float values together */
+static csi cs_nfgrow (cs *A, float **Ax, csi nzmax)
+{
+    csi ok ;
+    if (nzmax <= 0) nzmax = A->p [A->n] ;
+    *Ax = cs_realloc (*Ax, nzmax, sizeof (float), &ok) ;
+    return (ok && cs_sprealloc (A, nzmax)) ;
+}
+
+/* x = L\B(:,k) like cs_spsolve() with lo set, on the float values Lx */
+static csi cs_spsolve_float (cs *L, const float *Lx, const cs *B, csi k, csi *xi,
+    float *x, const csi *pinv)
+{
+    csi j, J, p, px, top, n, *Lp, *Li, *Bp, *Bi ;
+    double *Bx ;
+    Lp = L->p ; Li = L->i ; n = L->n ;
+    Bp = B->p ; Bi = B->i ; Bx = B->x ;
+    top = cs_reach (L, B, k, xi, pinv) ;        /* xi[top..n-1]=Reach(B(:,k)) */
+    for (p = top ; p < n ; p++) x [xi [p]] = 0 ;    /* clear x */
+    for (p = Bp [k] ; p < Bp [k+1] ; p++) x [Bi [p]] = (float) Bx [p] ;
+    for (px = top ; px < n ; px++)
+    {
+        j = xi [px] ;
+        J = pinv ? (pinv [j]) : j ;
+        if (J < 0) continue ;
+        x [j] /= Lx [Lp [J]] ;
+        for (p = Lp [J]+1 ; p < Lp [J+1] ; p++)
+        {
+            x [Li [p]] -= Lx [p] * x [j] ;
+        }
+    }
+    return (top) ;
+}
+
+csnf *cs_lu_float (const cs *A, const css *S, double tol)
+{
+    cs *L, *U ;
+    csnf *N ;
+    float pivot, *x, a, t ;
+    int *Lp, *Li, *Up, *Ui, *pinv, *xi, *q, n, ipiv, k, top, p, i, col, lnz,unz;
+    if (!CS_CSC (A) || !S) return (NULL) ;          /* check inputs */
+    n = A->n ;
+    q = S->q ; lnz = S->lnz ; unz = S->unz ;
+    x = cs_malloc (n, sizeof (float)) ;             /* get float workspace */
+    xi = cs_malloc (2*n, sizeof (int)) ;            /* get int workspace */
+    N = cs_calloc (1, sizeof (csnf)) ;              /* allocate result */
+    if (!x || !xi || !N) return (cs_nfdone (N, NULL, xi, x, 0)) ;
+    N->L = L = cs_spalloc (n, n, lnz, 0, 0) ;       /* patterns of L and U */
+    N->U = U = cs_spalloc (n, n, unz, 0, 0) ;
+    N->pinv = pinv = cs_malloc (n, sizeof (int)) ;
+    if (!L || !U || !pinv) return (cs_nfdone (N, NULL, xi, x, 0)) ;
+    N->Lx = cs_malloc (L->nzmax, sizeof (float)) ;
+    N->Ux = cs_malloc (U->nzmax, sizeof (float)) ;
+    if (!N->Lx || !N->Ux) return (cs_nfdone (N, NULL, xi, x, 0)) ;
+    Lp = L->p ; Up = U->p ;
+    for (i = 0 ; i < n ; i++) x [i] = 0 ;           /* clear workspace */
+    for (i = 0 ; i < n ; i++) pinv [i] = -1 ;       /* no rows pivotal yet */
+    for (k = 0 ; k <= n ; k++) Lp [k] = 0 ;         /* no cols of L yet */
+    lnz = unz = 0 ;
+    for (k = 0 ; k < n ; k++)       /* compute L(:,k) and U(:,k) */
+    {
+        Lp [k] = lnz ;
+        Up [k] = unz ;
+        if ((lnz + n > L->nzmax && !cs_nfgrow (L, &N->Lx, 2*L->nzmax + n)) ||
+            (unz + n > U->nzmax && !cs_nfgrow (U, &N->Ux, 2*U->nzmax + n)))
+        {
+            return (cs_nfdone (N, NULL, xi, x, 0)) ;
+        }
+        Li = L->i ; Ui = U->i ;
+        col = q ? (q [k]) : k ;
+        top = cs_spsolve_float (L, N->Lx, A, col, xi, x, pinv) ;
+        ipiv = -1 ;
+        a = -1 ;
+        for (p = top ; p < n ; p++)
+        {
+            i = xi [p] ;
+            if (pinv [i] < 0)
+            {
+                if ((t = fabsf (x [i])) > a)
+                {
+                    a = t ;
+                    ipiv = i ;
+                }
+            }
+            else
+            {
+                Ui [unz] = pinv [i] ;
+                N->Ux [unz++] = x [i] ;
+            }
+        }
+        if (ipiv == -1 || a <= 0) return (cs_nfdone (N, NULL, xi, x, 0)) ;
+        if (pinv [col] < 0 && fabsf (x [col]) >= a*tol) ipiv = col ;
+        pivot = x [ipiv] ;
+        Ui [unz] = k ;
+        N->Ux [unz++] = pivot ;
+        pinv [ipiv] = k ;
+        Li [lnz] = ipiv ;
+        N->Lx [lnz++] = 1 ;
+        for (p = top ; p < n ; p++)
+        {
+            i = xi [p] ;
+            if (pinv [i] < 0)
+            {
+                Li [lnz] = i ;
+                N->Lx [lnz++] = x [i] / pivot ;
+            }
+            x [i] = 0 ;
+        }
+    }
+    Lp [n] = lnz ;
+    Up [n] = unz ;
+    Li = L->i ;
+    for (p = 0 ; p < lnz ; p++) Li [p] = pinv [Li [p]] ;
+    cs_nfgrow (L, &N->Lx, 0) ;
+    cs_nfgrow (U, &N->Ux, 0) ;
+    return (cs_nfdone (N, NULL, xi, x, 1)) ;
+}
+
+/* up-looking like cs_chol(), but a non-positive pivot fails instead of
+ * being replaced by 1, refinement could not recover from it */
+csnf *cs_chol_float (const cs *A, const css *S)
+{
+    float d, lki, *Lx, *x ;
+    double *Cx ;
+    int top, i, p, k, n, *Li, *Lp, *Cp, *Ci, *c, *s ;
+    cs *C ;
+    csnf *N ;
+    if (!CS_CSC (A) || !S || !S->cp || !S->parent) return (NULL) ;
+    n = A->n ;
+    N = cs_calloc (1, sizeof (csnf)) ;
+    c = cs_malloc (2*n, sizeof (int)) ;
+    x = cs_malloc (n, sizeof (float)) ;
+    if (!N || !c || !x) return (cs_nfdone (N, NULL, c, x, 0)) ;
+    C = S->pinv ? cs_symperm (A, S->pinv, 1) : ((cs *) A) ;
+    if (!C) return (cs_nfdone (N, NULL, c, x, 0)) ;
+    N->L = cs_spalloc (n, n, S->cp [n], 0, 0) ;
+    N->Lx = cs_malloc (S->cp [n] > 0 ? S->cp [n] : 1, sizeof (float)) ;
+    if (!N->L || !N->Lx) return (cs_nfdone (N, S->pinv ? C : NULL, c, x, 0)) ;
+    s = c + n ;
+    Cp = C->p ; Ci = C->i ; Cx = C->x ;
+    Lp = N->L->p ; Li = N->L->i ; Lx = N->Lx ;
+    for (k = 0 ; k < n ; k++) Lp [k] = c [k] = S->cp [k] ;
+    Lp [n] = S->cp [n] ;
+    for (k = 0 ; k < n ; k++)
+    {
+        top = cs_ereach (C, k, S->parent, s, c) ;   /* pattern of L(k,:) */
+        x [k] = 0 ;
+        for (p = Cp [k] ; p < Cp [k+1] ; p++)
+        {
+            if (Ci [p] <= k) x [Ci [p]] = (float) Cx [p] ;
+        }
+        d = x [k] ;
+        x [k] = 0 ;
+        for ( ; top < n ; top++)
+        {
+            i = s [top] ;
+            lki = x [i] / Lx [Lp [i]] ;
+            x [i] = 0 ;
+            for (p = Lp [i] + 1 ; p < c [i] ; p++)
+            {
+                x [Li [p]] -= Lx [p] * lki ;
+            }
+            d -= lki * lki ;
+            p = c [i]++ ;
+            Li [p] = k ;
+            Lx [p] = lki ;
+        }
+        if (d <= 0) return (cs_nfdone (N, S->pinv ? C : NULL, c, x, 0)) ;
+        p = c [k]++ ;
+        Li [p] = k ;
+        Lx [p] = sqrtf (d) ;
+    }
+    return (cs_nfdone (N, S->pinv ? C : NULL, c, x, 1)) ;
+}
+
+/* triangular solves on double vectors with the float values of the factors */
+static void cs_lsolve_float (const cs *L, const float *Lx, double *x)
+{
+    csi p, j, n = L->n, *Lp = L->p, *Li = L->i ;
+    for (j = 0 ; j < n ; j++)
+    {
+        x [j] /= Lx [Lp [j]] ;
+        for (p = Lp [j]+1 ; p < Lp [j+1] ; p++) x [Li [p]] -= Lx [p] * x [j] ;
+    }
+}
+
+static void cs_ltsolve_float (const cs *L, const float *Lx, double *x)
+{
+    csi p, j, n = L->n, *Lp = L->p, *Li = L->i ;
+    for (j = n-1 ; j >= 0 ; j--)
+    {
+        for (p = Lp [j]+1 ; p < Lp [j+1] ; p++) x [j] -= Lx [p] * x [Li [p]] ;
+        x [j] /= Lx [Lp [j]] ;
+    }
+}
+
+static void cs_usolve_float (const cs *U, const float *Ux, double *x)
+{
+    csi p, j, n = U->n, *Up = U->p, *Ui = U->i ;
+    for (j = n-1 ; j >= 0 ; j--)
+    {
+        x [j] /= Ux [Up [j+1]-1] ;
+        for (p = Up [j] ; p < Up [j+1]-1 ; p++) x [Ui [p]] -= Ux [p] * x [j] ;
+    }
+}
+
+csi cs_lusol_float (const css *S, const csnf *N, const double *b, double *x,
+    double *y, int n)
+{
+    if (!S || !N || !b || !x || !y) return (0) ;
+    cs_ipvec (N->pinv, b, y, n) ;       /* y = b(p) */
+    cs_lsolve_float (N->L, N->Lx, y) ;  /* y = L\y */
+    cs_usolve_float (N->U, N->Ux, y) ;  /* y = U\y */
+    cs_ipvec (S->q, y, x, n) ;          /* x(q) = y */
+    return (1) ;
+}
+
+csi cs_cholsol_float (const css *S, const csnf *N, const double *b, double *x,
+    double *y, int n)
+{
+    if (!S || !N || !b || !x || !y) return (0) ;
+    cs_ipvec (S->pinv, b, y, n) ;       /* y = P*b */
+    cs_lsolve_float (N->L, N->Lx, y) ;  /* y = L\y */
+    cs_ltsolve_float (N->L, N->Lx, y) ; /* y = L'\y */
+    cs_pvec (S->pinv, y, x, n) ;        /* x = P'*y */
+    return (1) ;
+}
+
+/* numeric LU refactorization reusing the pivot sequence and the L/U pattern of N */
+/* recomputes L(:,k) and U(:,k), shared by cs_relu() and cs_relu_par() */
+static csi cs_relu_col (const cs *A, const css *S, csn *N, csi k, double tol,
+    double *x)
+{
+    double pivot, ujk, a, t, *Lx, *Ux, *Ax ;
+    csi *Lp, *Li, *Up, *Ui, *Ap, *Ai, *pinv, p, j, pj, col ;
+    Ap = A->p ; Ai = A->i ; Ax = A->x ; pinv = N->pinv ;
+    Lp = N->L->p ; Li = N->L->i ; Lx = N->L->x ;
+    Up = N->U->p ; Ui = N->U->i ; Ux = N->U->x ;
+    /* --- Scatter A(:,col) over the known pattern --------------------------- */
+    col = S->q ? (S->q [k]) : k ;
+    for (p = Up [k] ; p < Up [k+1] ; p++) x [Ui [p]] = 0 ;
+    for (p = Lp [k] ; p < Lp [k+1] ; p++) x [Li [p]] = 0 ;
+    for (p = Ap [col] ; p < Ap [col+1] ; p++) x [pinv [Ai [p]]] += Ax [p] ;
+    /* --- Triangular solve in the order cs_lu discovered -------------------- */
+    for (p = Up [k] ; p < Up [k+1]-1 ; p++)
+    {
+        j = Ui [p] ;            /* U(j,k) is final once x(j) is reached */
+        ujk = Ux [p] = x [j] ;
+        for (pj = Lp [j]+1 ; pj < Lp [j+1] ; pj++)
+        {
+            x [Li [pj]] -= Lx [pj] * ujk ;
+        }
+    }
+    /* --- Check that the old pivot is still acceptable ---------------------- */
+    pivot = x [k] ;
+    a = 0 ;
+    for (p = Lp [k]+1 ; p < Lp [k+1] ; p++)
+    {
+        if ((t = fabs (x [Li [p]])) > a) a = t ;
+    }
+    if (pivot == 0 || fabs (pivot) < tol * a)
+    {
+        return (0) ;                /* pivot degraded, needs a full cs_lu */
+    }
+    /* --- Divide by pivot --------------------------------------------------- */
+    Ux [Up [k+1]-1] = pivot ;       /* last entry in U(:,k) is U(k,k) */
+    Lx [Lp [k]] = 1 ;               /* first entry in L(:,k) is L(k,k) = 1 */
+    for (p = Lp [k]+1 ; p < Lp [k+1] ; p++)
+    {
+        Lx [p] = x [Li [p]] / pivot ;
+    }
+    return (1) ;
+}
+
+/* checks that N can be refactorized in place with the pattern of A */
+static csi cs_relu_ok (const cs *A, const css *S, const csn *N)
+{
+    if (!CS_CSC (A) || !S || !N || !N->L || !N->U || !N->pinv) return (0) ;
+    return (N->L->n == A->n && N->U->n == A->n) ;
+}
+
+csi cs_relu (const cs *A, const css *S, csn *N, double tol)
+{
+    double *x ;
+    csi k, ok = 1 ;
+    if (!cs_relu_ok (A, S, N)) return (0) ;
+    x = cs_malloc (A->n, sizeof (double)) ;         /* get double workspace */
+    if (!x) return (0) ;
+    for (k = 0 ; k < A->n && ok ; k++)  /* recompute L(:,k) and U(:,k) */
+    {
+        ok = cs_relu_col (A, S, N, k, tol, x) ;
+    }
+    cs_free (x) ;
+    return (ok) ;
+}
+
+typedef struct cs_relu_job
+{
+    const cs *A ;
+    const css *S ;
+    const cst *T ;
+    csn *N ;
+    double tol ;
+    double *x ;         /* n doubles per thread */
+    volatile csi failed ;
+} cs_relu_job ;
+
+static void cs_relu_task (int id, int thread, void *arg)
+{
+    cs_relu_job *job = (cs_relu_job *) arg ;
+    csi p, n = job->A->n ;
+    for (p = job->T->ptr [id] ; p < job->T->ptr [id+1] && !job->failed ; p++)
+    {
+        if (!cs_relu_col (job->A, job->S, job->N, job->T->order [p], job->tol,
+            job->x + (size_t) thread * n))
+        {
+            job->failed = 1 ;
+        }
+    }
+}
+
+csi cs_relu_par (const cs *A, const css *S, csn *N, double tol, const cst *T,
+    cs_parfor parfor, int nthreads)
+{
+    csi p, n ;
+    cs_relu_job job ;
+    if (!cs_relu_ok (A, S, N) || !T || !parfor || nthreads < 1) return (0) ;
+    n = A->n ;
+    job.A = A ; job.S = S ; job.T = T ; job.N = N ; job.tol = tol ;
+    job.failed = 0 ;
+    job.x = cs_malloc (n * nthreads, sizeof (double)) ;
+    if (!job.x) return (0) ;
+    parfor (T->nsub, cs_relu_task, &job) ;
+    for (p = T->ptr [T->nsub] ; p < n && !job.failed ; p++)
+    {
+        if (!cs_relu_col (A, S, N, T->order [p], tol, job.x)) job.failed = 1 ;
+    }
+    cs_free (job.x) ;
+    return (!job.failed) ;
+}
+
 static csi cs_vcount (const cs *A, css *S)
 {
     csi i, k, p, pa, n = A->n, m = A->m, *Ap = A->p, *Ai = A->i, *next, *head,
@@ -1758,6 +2978,222 @@ csi cs_cholsol (css *S, csn *N , double *b, double *x, int n)
 }
 
 
+/* C = A' like cs_transpose(), map [p] is the position of A->x [p] in C */
+static cs *cs_transpose_map (const cs *A, csi *map)
+{
+    csi p, q, j, n, m, *Ap, *Ai, *w ;
+    cs *C ;
+    m = A->m ; n = A->n ; Ap = A->p ; Ai = A->i ;
+    C = cs_spalloc (n, m, Ap [n], 1, 0) ;
+    w = cs_calloc (m, sizeof (csi)) ;
+    if (!C || !w) return (cs_done (C, w, NULL, 0)) ;
+    for (p = 0 ; p < Ap [n] ; p++) w [Ai [p]]++ ;
+    cs_cumsum (C->p, w, m) ;
+    for (j = 0 ; j < n ; j++)
+    {
+        for (p = Ap [j] ; p < Ap [j+1] ; p++)
+        {
+            C->i [q = w [Ai [p]]++] = j ;
+            C->x [q] = A->x [p] ;
+            map [p] = q ;
+        }
+    }
+    return (cs_done (C, w, NULL, 1)) ;
+}
+
+cstri *cs_tfree (cstri *T)
+{
+    if (!T) return (NULL) ;
+    cs_spfree (T->R) ;
+    cs_free (T->map) ;
+    cs_free (T->levptr) ;
+    cs_free (T->rows) ;
+    return ((cstri *) cs_free (T)) ;
+}
+
+cstri *cs_tlevels (const cs *A, csi lower, csi trans)
+{
+    csi i, p, k, n, nz, d, *Rp, *Ri, *level, *map2, *cnt ;
+    cs *R1 ;
+    cstri *T ;
+    if (!CS_CSC (A) || A->m != A->n) return (NULL) ;
+    n = A->n ; nz = A->p [n] ;
+    T = cs_calloc (1, sizeof (cstri)) ;
+    if (!T) return (NULL) ;
+    T->lower = (lower != 0) ;
+    T->map = cs_malloc (nz, sizeof (csi)) ;
+    T->rows = cs_malloc (n, sizeof (csi)) ;
+    T->levptr = cs_malloc (n+2, sizeof (csi)) ;
+    level = cs_malloc (n, sizeof (csi)) ;
+    map2 = trans ? cs_malloc (nz, sizeof (csi)) : NULL ;
+    if (!T->map || !T->rows || !T->levptr || !level || (trans && !map2))
+    {
+        cs_free (level) ; cs_free (map2) ;
+        return (cs_tfree (T)) ;
+    }
+    /* rows of the triangular matrix to solve with, A' or (A')' = A */
+    T->R = cs_transpose_map (A, T->map) ;
+    if (trans && T->R)
+    {
+        R1 = T->R ;
+        T->R = cs_transpose_map (R1, map2) ;
+        for (p = 0 ; p < nz ; p++) T->map [p] = map2 [T->map [p]] ;
+        cs_spfree (R1) ;
+    }
+    cs_free (map2) ;
+    if (!T->R)
+    {
+        cs_free (level) ;
+        return (cs_tfree (T)) ;
+    }
+    Rp = T->R->p ; Ri = T->R->i ;
+    /* --- level of each row, the diagonal must be last (lower) or first ---- */
+    T->nlev = 0 ;
+    for (k = 0 ; k < n ; k++)
+    {
+        i = T->lower ? k : n-1-k ;
+        d = T->lower ? Rp [i+1]-1 : Rp [i] ;
+        if (Rp [i] == Rp [i+1] || Ri [d] != i)
+        {
+            cs_free (level) ;
+            return (cs_tfree (T)) ;     /* not triangular or zero-free diagonal */
+        }
+        level [i] = 0 ;
+        for (p = Rp [i] ; p < Rp [i+1] ; p++)
+        {
+            if (p != d && level [Ri [p]] >= level [i]) level [i] = level [Ri [p]] + 1 ;
+        }
+        if (level [i] >= T->nlev) T->nlev = level [i] + 1 ;
+    }
+    /* --- rows sorted by level --------------------------------------------- */
+    cnt = T->levptr ;
+    for (k = 0 ; k <= T->nlev ; k++) cnt [k] = 0 ;
+    for (i = 0 ; i < n ; i++) cnt [level [i]+1]++ ;
+    for (k = 0 ; k < T->nlev ; k++) cnt [k+1] += cnt [k] ;
+    for (i = 0 ; i < n ; i++) T->rows [cnt [level [i]]++] = i ;
+    for (k = T->nlev ; k > 0 ; k--) cnt [k] = cnt [k-1] ;
+    cnt [0] = 0 ;                       /* levptr [l] = first row of level l */
+    cs_free (level) ;
+    return (T) ;
+}
+
+void cs_tvalues (cstri *T, const cs *A)
+{
+    csi p, nz = A->p [A->n] ;
+    double *Rx = T->R->x, *Ax = A->x ;
+    for (p = 0 ; p < nz ; p++) Rx [T->map [p]] = Ax [p] ;
+}
+
+/* x(i) for the rows first..last-1 of one level */
+static void cs_trows (const cstri *T, csi first, csi last, double *x)
+{
+    csi i, p, k, d, *Rp = T->R->p, *Ri = T->R->i ;
+    double s, *Rx = T->R->x ;
+    for (k = first ; k < last ; k++)
+    {
+        i = T->rows [k] ;
+        if (T->lower)
+        {
+            d = Rp [i+1]-1 ;
+            p = Rp [i] ;
+        }
+        else
+        {
+            d = Rp [i] ;
+            p = d+1 ;
+        }
+        s = x [i] ;
+        for ( ; p < Rp [i+1] ; p++)
+        {
+            if (p != d) s -= Rx [p] * x [Ri [p]] ;
+        }
+        x [i] = s / Rx [d] ;
+    }
+}
+
+typedef struct cs_tsolve_job
+{
+    const cstri *T ;
+    double *x ;
+    csi first, last ;
+} cs_tsolve_job ;
+
+static void cs_tsolve_task (int id, int thread, void *arg)
+{
+    cs_tsolve_job *job = (cs_tsolve_job *) arg ;
+    csi first = job->first + id * CS_LEVEL_CHUNK ;
+    csi last = first + CS_LEVEL_CHUNK < job->last ? first + CS_LEVEL_CHUNK : job->last ;
+    cs_trows (job->T, first, last, job->x) ;
+}
+
+csi cs_tsolve (const cstri *T, double *x, cs_parfor parfor)
+{
+    csi l, size ;
+    cs_tsolve_job job ;
+    if (!T || !x) return (0) ;
+    job.T = T ;
+    job.x = x ;
+    for (l = 0 ; l < T->nlev ; l++)
+    {
+        job.first = T->levptr [l] ;
+        job.last = T->levptr [l+1] ;
+        size = job.last - job.first ;
+        if (parfor && size >= 2 * CS_LEVEL_CHUNK)
+        {
+            parfor ((size + CS_LEVEL_CHUNK - 1) / CS_LEVEL_CHUNK, cs_tsolve_task, &job) ;
+        }
+        else
+        {
+            cs_trows (T, job.first, job.last, x) ;
+        }
+    }
+    return (1) ;
+}
+
+csi cs_lusol_ws (const css *S, const csn *N, const double *b, double *x,
+    double *y, int n)
+{
+    if (!S || !N || !b || !x || !y) return (0) ;
+    cs_ipvec (N->pinv, b, y, n) ;       /* y = b(p) */
+    cs_lsolve (N->L, y) ;               /* y = L\y */
+    cs_usolve (N->U, y) ;               /* y = U\y */
+    cs_ipvec (S->q, y, x, n) ;          /* x(q) = y */
+    return (1) ;
+}
+
+csi cs_cholsol_ws (const css *S, const csn *N, const double *b, double *x,
+    double *y, int n)
+{
+    if (!S || !N || !b || !x || !y) return (0) ;
+    cs_ipvec (S->pinv, b, y, n) ;       /* y = P*b */
+    cs_lsolve (N->L, y) ;               /* y = L\y */
+    cs_ltsolve (N->L, y) ;              /* y = L'\y */
+    cs_pvec (S->pinv, y, x, n) ;        /* x = P'*y */
+    return (1) ;
+}
+
+csi cs_lusol_levels (const css *S, const csn *N, const cstri *L, const cstri *U,
+    const double *b, double *x, double *y, int n, cs_parfor parfor)
+{
+    if (!S || !N || !L || !U || !b || !x || !y) return (0) ;
+    cs_ipvec (N->pinv, b, y, n) ;       /* y = b(p) */
+    cs_tsolve (L, y, parfor) ;          /* y = L\y */
+    cs_tsolve (U, y, parfor) ;          /* y = U\y */
+    cs_ipvec (S->q, y, x, n) ;          /* x(q) = y */
+    return (1) ;
+}
+
+csi cs_cholsol_levels (const css *S, const cstri *L, const cstri *Lt,
+    const double *b, double *x, double *y, int n, cs_parfor parfor)
+{
+    if (!S || !L || !Lt || !b || !x || !y) return (0) ;
+    cs_ipvec (S->pinv, b, y, n) ;       /* y = P*b */
+    cs_tsolve (L, y, parfor) ;          /* y = L\y */
+    cs_tsolve (Lt, y, parfor) ;         /* y = L'\y */
+    cs_pvec (S->pinv, y, x, n) ;        /* x = P'*y */
+    return (1) ;
+}
+
 csi cs_gaxpy_transpose (const cs *A, const double *x, double *y)
 {
     csi p, j, n, *Ap, *Ai ;
@@ -1792,3 +3228,496 @@ csi cs_gaxpy (const cs *A, const double *x, double *y)
     return (1) ;
 }
 
+/* start [k] = first row of block k, where the nonzeros plus rows before it
+ * reach k/parts of the total, rounded down to a multiple of align */
+static void cs_row_split (const csi *rowptr, csi m, int parts, csi align, csi *start)
+{
+    csi i, k, lo, hi, nz = rowptr [m] ;
+    double w ;
+    start [0] = 0 ;
+    for (k = 1 ; k < parts ; k++)
+    {
+        w = (double) k * (nz + m) / parts ;
+        lo = start [k-1] ; hi = m ;
+        while (lo < hi)
+        {
+            i = (lo + hi) / 2 ;
+            if (rowptr [i] + i < w) lo = i+1 ; else hi = i ;
+        }
+        lo -= lo % align ;
+        start [k] = lo > start [k-1] ? lo : start [k-1] ;
+    }
+    start [parts] = m ;
+}
+
+csr *cs_csrfree (csr *A)
+{
+    if (!A) return (NULL) ;
+    cs_free (A->p) ;
+    cs_free (A->j) ;
+    cs_free (A->x) ;
+    cs_free (A->start) ;
+    return ((csr *) cs_free (A)) ;
+}
+
+typedef struct cs_csr_job
+{
+    const csr *A ;
+    const cs *T ;       /* A' in compressed-column form, the rows of A */
+    const double *x ;
+    double *y ;
+} cs_csr_job ;
+
+static void cs_csr_copy_task (int id, int thread, void *arg)
+{
+    cs_csr_job *job = (cs_csr_job *) arg ;
+    const csr *A = job->A ;
+    csi p, first = A->p [A->start [id]], last = A->p [A->start [id+1]] ;
+    for (p = first ; p < last ; p++)
+    {
+        A->j [p] = job->T->i [p] ;
+        A->x [p] = job->T->x [p] ;
+    }
+}
+
+csr *cs_csr (const cs *A, int parts, cs_parfor parfor)
+{
+    csi i, k, m, nz ;
+    cs *T ;
+    csr *R ;
+    cs_csr_job job ;
+    if (!CS_CSC (A) || parts < 1) return (NULL) ;
+    T = cs_transpose (A, 1) ;
+    if (!T) return (NULL) ;
+    m = A->m ; nz = T->p [m] ;
+    if (parts > m) parts = m > 0 ? m : 1 ;
+    R = cs_calloc (1, sizeof (csr)) ;
+    if (!R)
+    {
+        cs_spfree (T) ;
+        return (NULL) ;
+    }
+    R->m = m ; R->n = A->n ; R->parts = parts ;
+    R->p = cs_malloc (m+1, sizeof (csi)) ;
+    R->j = cs_malloc (nz, sizeof (csi)) ;      /* not touched until the copy */
+    R->x = cs_malloc (nz, sizeof (double)) ;
+    R->start = cs_malloc (parts+1, sizeof (csi)) ;
+    if (!R->p || !R->j || !R->x || !R->start)
+    {
+        cs_spfree (T) ;
+        return (cs_csrfree (R)) ;
+    }
+    for (i = 0 ; i <= m ; i++) R->p [i] = T->p [i] ;
+    cs_row_split (R->p, m, parts, 1, R->start) ;
+    job.A = R ; job.T = T ;
+    if (parfor)
+    {
+        parfor (parts, cs_csr_copy_task, &job) ;
+    }
+    else
+    {
+        for (k = 0 ; k < parts ; k++) cs_csr_copy_task (k, 0, &job) ;
+    }
+    cs_spfree (T) ;
+    return (R) ;
+}
+
+static void cs_csr_gemv_task (int id, int thread, void *arg)
+{
+    cs_csr_job *job = (cs_csr_job *) arg ;
+    const csr *A = job->A ;
+    csi i, p, *Ap = A->p, *Aj = A->j ;
+    const double *Ax = A->x, *x = job->x ;
+    double s ;
+    for (i = A->start [id] ; i < A->start [id+1] ; i++)
+    {
+        s = 0 ;
+        for (p = Ap [i] ; p < Ap [i+1] ; p++) s += Ax [p] * x [Aj [p]] ;
+        job->y [i] = s ;
+    }
+}
+
+csi cs_csr_gemv (const csr *A, const double *x, double *y, cs_parfor parfor)
+{
+    csi k ;
+    cs_csr_job job ;
+    if (!A || !x || !y) return (0) ;
+    job.A = A ; job.T = NULL ; job.x = x ; job.y = y ;
+    if (parfor)
+    {
+        parfor (A->parts, cs_csr_gemv_task, &job) ;
+    }
+    else
+    {
+        for (k = 0 ; k < A->parts ; k++) cs_csr_gemv_task (k, 0, &job) ;
+    }
+    return (1) ;
+}
+
+csmv *cs_spmvfree (csmv *A)
+{
+    if (!A) return (NULL) ;
+    cs_csrfree (A->R) ;
+    cs_free (A->sp) ;
+    cs_free (A->sj) ;
+    cs_free (A->sx) ;
+    cs_free (A->perm) ;
+    cs_free (A->bp) ;
+    cs_free (A->bj) ;
+    cs_free (A->bx) ;
+    cs_free (A->start) ;
+    return ((csmv *) cs_free (A)) ;
+}
+
+#define CS_STR2(x) #x
+#define CS_STR(x) CS_STR2(x)
+
+const char *cs_spmv_name (int format)
+{
+    static const char *names [CS_SPMV_FORMATS] =
+        { "CSC", "CSR", "SELL-" CS_STR (CS_SELL_C) "-" CS_STR (CS_SELL_SIGMA), "BCSR-2x2" } ;
+    return (format >= 0 && format < CS_SPMV_FORMATS ? names [format] : "?") ;
+}
+
+typedef struct cs_spmv_job
+{
+    const csmv *A ;
+    const cs *T ;       /* A' in compressed-column form, the rows of A */
+    const double *x ;
+    double *y ;
+} cs_spmv_job ;
+
+/* rows of the sorted order, slice by slice; padding points at column 0 */
+static void cs_sell_fill_task (int id, int thread, void *arg)
+{
+    cs_spmv_job *job = (cs_spmv_job *) arg ;
+    const csmv *A = job->A ;
+    const cs *T = job->T ;
+    csi s, r, i, k, p, w, last = (A->start [id+1] + CS_SELL_C - 1) / CS_SELL_C ;
+    for (s = A->start [id] / CS_SELL_C ; s < last ; s++)
+    {
+        w = (A->sp [s+1] - A->sp [s]) / CS_SELL_C ;
+        for (r = 0 ; r < CS_SELL_C ; r++)
+        {
+            i = A->perm [s * CS_SELL_C + r] ;
+            p = i < 0 ? 0 : T->p [i] ;
+            for (k = 0 ; k < w ; k++, p++)
+            {
+                if (i >= 0 && p < T->p [i+1])
+                {
+                    A->sj [A->sp [s] + k * CS_SELL_C + r] = T->i [p] ;
+                    A->sx [A->sp [s] + k * CS_SELL_C + r] = T->x [p] ;
+                }
+                else
+                {
+                    A->sj [A->sp [s] + k * CS_SELL_C + r] = 0 ;
+                    A->sx [A->sp [s] + k * CS_SELL_C + r] = 0 ;
+                }
+            }
+        }
+    }
+}
+
+/* longer rows first, ties in row order so the layout is reproducible */
+static int cs_sell_cmp (const void *a, const void *b)
+{
+    const csi *u = (const csi *) a, *v = (const csi *) b ;
+    if (u [0] != v [0]) return (u [0] > v [0] ? -1 : 1) ;
+    return (u [1] < v [1] ? -1 : (u [1] > v [1])) ;
+}
+
+static csi cs_sell_build (csmv *A, const cs *T)
+{
+    csi i, k, s, w, m = A->m, ns = (m + CS_SELL_C - 1) / CS_SELL_C, *len ;
+    len = cs_malloc (2*m, sizeof (csi)) ;
+    A->perm = cs_malloc (ns * CS_SELL_C, sizeof (csi)) ;
+    A->sp = cs_malloc (ns+1, sizeof (csi)) ;
+    if (!len || !A->perm || !A->sp)
+    {
+        cs_free (len) ;
+        return (0) ;
+    }
+    for (i = 0 ; i < m ; i++)
+    {
+        len [2*i] = T->p [i+1] - T->p [i] ;
+        len [2*i+1] = i ;
+    }
+    for (i = 0 ; i < m ; i += CS_SELL_SIGMA)
+    {
+        qsort (len + 2*i, CS_MIN (CS_SELL_SIGMA, m-i), 2 * sizeof (csi), cs_sell_cmp) ;
+    }
+    for (k = 0 ; k < ns * CS_SELL_C ; k++) A->perm [k] = k < m ? len [2*k+1] : -1 ;
+    /* --- a slice is as wide as its longest row, the first of the slice ---- */
+    A->sp [0] = 0 ;
+    for (s = 0 ; s < ns ; s++)
+    {
+        w = len [2 * s * CS_SELL_C] ;
+        if ((double) A->sp [s] + (double) w * CS_SELL_C > INT_MAX)
+        {
+            cs_free (len) ;
+            return (0) ;
+        }
+        A->sp [s+1] = A->sp [s] + w * CS_SELL_C ;
+    }
+    cs_free (len) ;
+    A->sj = cs_malloc (A->sp [ns], sizeof (csi)) ;
+    A->sx = cs_malloc (A->sp [ns], sizeof (double)) ;
+    return (A->sj && A->sx) ;
+}
+
+/* 2x2 block rows: the two rows are merged by block column */
+static void cs_bcsr_fill_task (int id, int thread, void *arg)
+{
+    cs_spmv_job *job = (cs_spmv_job *) arg ;
+    const csmv *A = job->A ;
+    const cs *T = job->T ;
+    csi I, b, r, c, bc, p [2], end [2], last = (A->start [id+1] + 1) / 2 ;
+    for (I = A->start [id] / 2 ; I < last ; I++)
+    {
+        for (r = 0 ; r < 2 ; r++)
+        {
+            p [r] = 2*I+r < A->m ? T->p [2*I+r] : 0 ;
+            end [r] = 2*I+r < A->m ? T->p [2*I+r+1] : 0 ;
+        }
+        for (b = A->bp [I] ; b < A->bp [I+1] ; b++)
+        {
+            bc = INT_MAX ;
+            for (r = 0 ; r < 2 ; r++)
+            {
+                if (p [r] < end [r] && T->i [p [r]] / 2 < bc) bc = T->i [p [r]] / 2 ;
+            }
+            A->bj [b] = bc ;
+            for (c = 0 ; c < 4 ; c++) A->bx [4*b+c] = 0 ;
+            for (r = 0 ; r < 2 ; r++)
+            {
+                for ( ; p [r] < end [r] && T->i [p [r]] / 2 == bc ; p [r]++)
+                {
+                    A->bx [4*b + 2*r + T->i [p [r]] % 2] = T->x [p [r]] ;
+                }
+            }
+        }
+    }
+}
+
+static csi cs_bcsr_build (csmv *A, const cs *T)
+{
+    csi I, r, bc, nb, mb = (A->m + 1) / 2, p [2], end [2] ;
+    A->bp = cs_malloc (mb+1, sizeof (csi)) ;
+    if (!A->bp) return (0) ;
+    /* --- count the blocks of each block row, same merge as the fill ------- */
+    A->bp [0] = 0 ;
+    for (I = 0 ; I < mb ; I++)
+    {
+        for (r = 0 ; r < 2 ; r++)
+        {
+            p [r] = 2*I+r < A->m ? T->p [2*I+r] : 0 ;
+            end [r] = 2*I+r < A->m ? T->p [2*I+r+1] : 0 ;
+        }
+        for (nb = 0 ; p [0] < end [0] || p [1] < end [1] ; nb++)
+        {
+            bc = INT_MAX ;
+            for (r = 0 ; r < 2 ; r++)
+            {
+                if (p [r] < end [r] && T->i [p [r]] / 2 < bc) bc = T->i [p [r]] / 2 ;
+            }
+            for (r = 0 ; r < 2 ; r++)
+            {
+                while (p [r] < end [r] && T->i [p [r]] / 2 == bc) p [r]++ ;
+            }
+        }
+        A->bp [I+1] = A->bp [I] + nb ;
+    }
+    if (4 * (double) A->bp [mb] > INT_MAX) return (0) ;
+    A->bj = cs_malloc (A->bp [mb], sizeof (csi)) ;
+    A->bx = cs_malloc (4 * A->bp [mb], sizeof (double)) ;
+    return (A->bj && A->bx) ;
+}
+
+csmv *cs_spmv_build (const cs *A, int format, int parts, cs_parfor parfor)
+{
+    csi k, ok = 1 ;
+    cs *T = NULL ;
+    csmv *M ;
+    cs_spmv_job job ;
+    void (*fill) (int, int, void *) = NULL ;
+    if (!CS_CSC (A) || parts < 1 || format < 0 || format >= CS_SPMV_FORMATS) return (NULL) ;
+    M = cs_calloc (1, sizeof (csmv)) ;
+    if (!M) return (NULL) ;
+    M->format = format ;
+    M->m = A->m ; M->n = A->n ; M->nnz = A->p [A->n] ;
+    M->A = A ;
+    if (format == CS_SPMV_CSR)
+    {
+        M->R = cs_csr (A, parts, parfor) ;
+        if (!M->R) return (cs_spmvfree (M)) ;
+        M->parts = M->R->parts ;
+        M->start = cs_malloc (M->parts+1, sizeof (csi)) ;
+        if (!M->start) return (cs_spmvfree (M)) ;
+        for (k = 0 ; k <= M->parts ; k++) M->start [k] = M->R->start [k] ;
+        return (M) ;
+    }
+    M->parts = format == CS_SPMV_CSC ? 1 : CS_MAX (CS_MIN (parts, M->m), 1) ;
+    M->start = cs_malloc (M->parts+1, sizeof (csi)) ;
+    if (!M->start) return (cs_spmvfree (M)) ;
+    if (format == CS_SPMV_CSC)
+    {
+        M->start [0] = 0 ; M->start [1] = M->m ;
+        return (M) ;
+    }
+    T = cs_transpose (A, 1) ;
+    if (!T) return (cs_spmvfree (M)) ;
+    if (format == CS_SPMV_SELL)
+    {
+        cs_row_split (T->p, M->m, M->parts, CS_SELL_SIGMA, M->start) ;
+        ok = cs_sell_build (M, T) ;
+        fill = cs_sell_fill_task ;
+    }
+    else
+    {
+        cs_row_split (T->p, M->m, M->parts, 2, M->start) ;
+        ok = cs_bcsr_build (M, T) ;
+        fill = cs_bcsr_fill_task ;
+    }
+    if (ok)
+    {
+        job.A = M ; job.T = T ;
+        if (parfor)
+        {
+            parfor (M->parts, fill, &job) ;
+        }
+        else
+        {
+            for (k = 0 ; k < M->parts ; k++) fill (k, 0, &job) ;
+        }
+    }
+    cs_spfree (T) ;
+    return (ok ? M : cs_spmvfree (M)) ;
+}
+
+static void cs_sell_gemv_task (int id, int thread, void *arg)
+{
+    cs_spmv_job *job = (cs_spmv_job *) arg ;
+    const csmv *A = job->A ;
+    const csi *sj = A->sj, *perm = A->perm ;
+    const double *sx = A->sx, *x = job->x ;
+    csi s, r, k, q, w, last = (A->start [id+1] + CS_SELL_C - 1) / CS_SELL_C ;
+    double t [CS_SELL_C] ;
+    for (s = A->start [id] / CS_SELL_C ; s < last ; s++)
+    {
+        for (r = 0 ; r < CS_SELL_C ; r++) t [r] = 0 ;
+        w = (A->sp [s+1] - A->sp [s]) / CS_SELL_C ;
+        for (k = 0, q = A->sp [s] ; k < w ; k++, q += CS_SELL_C)
+        {
+            for (r = 0 ; r < CS_SELL_C ; r++) t [r] += sx [q+r] * x [sj [q+r]] ;
+        }
+        for (r = 0 ; r < CS_SELL_C ; r++)
+        {
+            if (perm [s * CS_SELL_C + r] >= 0) job->y [perm [s * CS_SELL_C + r]] = t [r] ;
+        }
+    }
+}
+
+static void cs_bcsr_gemv_task (int id, int thread, void *arg)
+{
+    cs_spmv_job *job = (cs_spmv_job *) arg ;
+    const csmv *A = job->A ;
+    const csi *bp = A->bp, *bj = A->bj ;
+    const double *bx = A->bx, *x = job->x ;
+    csi I, b, c, last = (A->start [id+1] + 1) / 2 ;
+    double s0, s1, x0, x1 ;
+    for (I = A->start [id] / 2 ; I < last ; I++)
+    {
+        s0 = 0 ; s1 = 0 ;
+        for (b = bp [I] ; b < bp [I+1] ; b++)
+        {
+            c = 2 * bj [b] ;
+            x0 = x [c] ;
+            x1 = c+1 < A->n ? x [c+1] : 0 ;
+            s0 += bx [4*b] * x0 ;
+            s0 += bx [4*b+1] * x1 ;
+            s1 += bx [4*b+2] * x0 ;
+            s1 += bx [4*b+3] * x1 ;
+        }
+        job->y [2*I] = s0 ;
+        if (2*I+1 < A->m) job->y [2*I+1] = s1 ;
+    }
+}
+
+csi cs_spmv (const csmv *A, const double *x, double *y, cs_parfor parfor)
+{
+    csi k ;
+    cs_spmv_job job ;
+    void (*task) (int, int, void *) ;
+    if (!A || !x || !y) return (0) ;
+    if (A->format == CS_SPMV_CSC)
+    {
+        for (k = 0 ; k < A->m ; k++) y [k] = 0 ;
+        return (cs_gaxpy (A->A, x, y)) ;
+    }
+    if (A->format == CS_SPMV_CSR) return (cs_csr_gemv (A->R, x, y, parfor)) ;
+    task = A->format == CS_SPMV_SELL ? cs_sell_gemv_task : cs_bcsr_gemv_task ;
+    job.A = A ; job.T = NULL ; job.x = x ; job.y = y ;
+    if (parfor)
+    {
+        parfor (A->parts, task, &job) ;
+    }
+    else
+    {
+        for (k = 0 ; k < A->parts ; k++) task (k, 0, &job) ;
+    }
+    return (1) ;
+}
+
+static double cs_wtime (void)
+{
+    struct timespec t ;
+    clock_gettime (CLOCK_MONOTONIC, &t) ;
+    return (t.tv_sec + 1e-9 * t.tv_nsec) ;
+}
+
+#define CS_TUNE_TIME 0.01 /* seconds of products per format */
+#define CS_TUNE_REPS 100 /* at most this many products per format */
+
+csmv *cs_spmv_tune (const cs *A, int parts, cs_parfor parfor, double *gflops)
+{
+    csi f, k, reps ;
+    double t0, t, rate, *x, *y ;
+    csmv *M, *best = NULL ;
+    if (!CS_CSC (A)) return (NULL) ;
+    x = cs_malloc (A->n, sizeof (double)) ;
+    y = cs_malloc (A->m, sizeof (double)) ;
+    if (!x || !y)
+    {
+        cs_free (x) ; cs_free (y) ;
+        return (NULL) ;
+    }
+    for (k = 0 ; k < A->n ; k++) x [k] = 1 ;
+    for (f = 0 ; f < CS_SPMV_FORMATS ; f++)
+    {
+        if (gflops) gflops [f] = 0 ;
+        M = cs_spmv_build (A, f, parts, parfor) ;
+        if (!M) continue ;
+        cs_spmv (M, x, y, parfor) ;     /* warm up the caches and the threads */
+        t0 = cs_wtime () ;
+        for (reps = 0, t = 0 ; reps < 3 || (t < CS_TUNE_TIME && reps < CS_TUNE_REPS) ; reps++)
+        {
+            cs_spmv (M, x, y, parfor) ;
+            t = cs_wtime () - t0 ;
+        }
+        rate = 2.0 * M->nnz * reps / (t > 0 ? t : 1e-9) * 1e-9 ;
+        M->gflops = rate ;
+        if (gflops) gflops [f] = rate ;
+        if (!best || rate > best->gflops)
+        {
+            cs_spmvfree (best) ;
+            best = M ;
+        }
+        else
+        {
+            cs_spmvfree (M) ;
+        }
+    }
+    cs_free (x) ;
+    cs_free (y) ;
+    return (best) ;
+}
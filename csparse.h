@@ -56,6 +56,74 @@ typedef struct cs_numeric /* numeric Cholesky, LU, or QR factorization */
 	double *B; /* beta [0..n-1] for QR */
 } csn;
 
+typedef struct cs_numeric_float /* single precision Cholesky or LU factorization */
+{
+	cs *L; /* pattern of L, without values */
+	cs *U; /* pattern of U for LU */
+	float *Lx; /* values of L */
+	float *Ux; /* values of U */
+	int *pinv; /* partial pivoting for LU */
+} csnf;
+
+typedef struct cs_tree_schedule /* independent subtrees of an elimination tree */
+{
+	int nsub; /* number of independent subtrees */
+	int *order; /* subtree t is order [ptr [t]..ptr [t+1]-1], the top of the tree follows */
+	int *ptr; /* size nsub+1 */
+} cst;
+
+typedef struct cs_triangular_levels /* triangular matrix by rows, grouped in independent levels */
+{
+	cs *R; /* column i holds row i, sorted, the diagonal is last (lower) or first (upper) */
+	int *map; /* position in R of each entry of the factor it was built from */
+	int lower; /* 1 for forward substitution, 0 for back substitution */
+	int nlev; /* number of levels */
+	int *levptr; /* rows of level l are rows [levptr [l]..levptr [l+1]-1], size nlev+1 */
+	int *rows;
+} cstri;
+
+typedef struct cs_row_blocks /* matrix in compressed-row form, in row blocks of about equal work */
+{
+	int m; /* number of rows */
+	int n; /* number of columns */
+	int *p; /* row pointers (size m+1) */
+	int *j; /* column indices, size p [m] */
+	double *x; /* numerical values, size p [m] */
+	int parts; /* number of row blocks */
+	int *start; /* block k holds rows start [k]..start [k+1]-1, size parts+1 */
+} csr;
+
+#define CS_SPMV_CSC 0 /* storage formats of cs_spmv(), CSC is the matrix itself */
+#define CS_SPMV_CSR 1
+#define CS_SPMV_SELL 2 /* SELL-C-sigma, sliced ELLPACK */
+#define CS_SPMV_BCSR 3 /* 2x2 blocks by rows */
+#define CS_SPMV_FORMATS 4
+#define CS_SELL_C 8 /* rows per slice, stored column by column */
+#define CS_SELL_SIGMA 256 /* rows are sorted by length within windows of sigma rows */
+
+typedef struct cs_spmv_matrix /* matrix in one of the storage formats of cs_spmv() */
+{
+	int format; /* CS_SPMV_CSC, CS_SPMV_CSR, CS_SPMV_SELL or CS_SPMV_BCSR */
+	int m; /* number of rows */
+	int n; /* number of columns */
+	int nnz; /* entries of the matrix, without the padding of SELL or BCSR */
+	const cs *A; /* CSC: the matrix it was built from */
+	csr *R; /* CSR */
+	int *sp; /* SELL: slice s is sp [s]..sp [s+1]-1, CS_SELL_C entries per column */
+	int *sj;
+	double *sx;
+	int *perm; /* SELL: row k of the sorted order is row perm [k], -1 past the last */
+	int *bp; /* BCSR: block row i has blocks bp [i]..bp [i+1]-1, sorted by block column */
+	int *bj;
+	double *bx; /* BCSR: 4 values per block, by rows */
+	int parts; /* number of row blocks of the parallel product */
+	int *start; /* block k holds rows start [k]..start [k+1]-1, size parts+1 */
+	double gflops; /* rate measured by cs_spmv_tune(), 0 otherwise */
+} csmv;
+
+/* runs task(id, thread, arg) for id = 0..tasks-1, thread being the index of the calling thread */
+typedef void (*cs_parfor)(int tasks, void (*task)(int id, int thread, void *arg), void *arg);
+
 
 /********************************************************************************
  *                                                                              *
@@ -188,6 +256,17 @@ int cs_sprealloc(cs *A, int nzmax);
 cs *cs_compress(const cs *T);
 
 
+/**
+ *  Function for converting a matrix from triplet to compressed-column format while summing duplicate
+ *  entries. For every triplet k the position of its (summed) value in the result is recorded in map[k],
+ *  so the values of a matrix with the same stamping order can later be refilled without any search.
+ *  @param T Sparse matrix in triplet format. Its values are optional; the result always carries values.
+ *  @param map Output vector of size T->nz with the slot of each triplet in C->x.
+ *  @return The sparse matrix in compressed-column format or NULL on error.
+ */
+cs *cs_compress_map(const cs *T, int *map);
+
+
 /**
  *  Function for computing the cumulative sum of an integer vector.
  *  @param p The cumulative sum of the integer vector.
@@ -362,6 +441,27 @@ int cs_tdfs(int j, int k, int *head, const int *next, int *post, int *stack);
 int *cs_post(const int *parent, int n);
 
 
+/**
+ *  Splits an elimination tree into independent subtrees for a parallel factorization. The heaviest subtree
+ *  is split into its children until every subtree weighs at most 1/parts of the tree; the split nodes form
+ *  the top of the tree, which is factorized after all subtrees.
+ *  @param parent The elimination tree of n nodes.
+ *  @param colptr Column pointers of the factor, the weight of node j is its column count (1 if NULL).
+ *  @param n Number of nodes.
+ *  @param parts Number of subtrees to aim for, a few per thread balances the load.
+ *  @return The schedule, subtrees sorted from the heaviest one, or NULL on error.
+ */
+cst *cs_tschedule(const int *parent, const int *colptr, int n, int parts);
+
+
+/**
+ *  Frees a schedule computed by cs_tschedule().
+ *  @param T The schedule to free.
+ *  @return NULL.
+ */
+cst *cs_tsfree(cst *T);
+
+
 /**
  *  Function that determines whether j is a leaf and find least common ancestor.
  *  @param i The ith row subtree.
@@ -449,6 +549,63 @@ css *cs_schol(int order, const cs *A);
 csn *cs_chol(const cs *A, const css *S);
 
 
+/**
+ *  Like cs_chol(), but fails on a pivot that is not positive instead of replacing it by 1, so it
+ *  also tells whether A is positive definite.
+ *  @param A Matrix to factorize.
+ *  @param S The symbolic analysis of matrix A, as it is computed from cs_schol() function.
+ *  @return The numerical analysis of matrix A or NULL on error or if A is not positive definite.
+ */
+csn *cs_chol_strict(const cs *A, const css *S);
+
+
+/**
+ *  Parallel version of cs_chol(). The subtrees of T are factorized concurrently and the top of the tree
+ *  sequentially. Every row of L is computed by the same operations in the same order as in cs_chol(),
+ *  so the factor is identical bit for bit whatever the number of threads.
+ *  @param A Matrix to factorize.
+ *  @param S The symbolic analysis of matrix A, as it is computed from cs_schol() function.
+ *  @param T Schedule computed by cs_tschedule() from S->parent.
+ *  @param parfor Runs the tasks of one parallel region.
+ *  @param nthreads Largest thread index passed by parfor plus one.
+ *  @return The numerical analysis of matrix A or NULL on error.
+ */
+csn *cs_chol_par(const cs *A, const css *S, const cst *T, cs_parfor parfor, int nthreads);
+
+
+/**
+ *  Supernodal left-looking Cholesky factorization. The fundamental supernodes are found from the etree and
+ *  the column counts of cs_schol(), then a supernode is merged into its parent when this adds few explicit
+ *  zeros. Each supernode is factorized as a dense panel and the updates between supernodes go through the
+ *  dense kernels of blas.c. L is returned in compressed-column form, explicit zeros included, so
+ *  cs_cholsol() solves with it unchanged.
+ *  @param A Matrix to factorize.
+ *  @param S The symbolic analysis of matrix A, as it is computed from cs_schol() function.
+ *  @return The numerical analysis of matrix A or NULL on error.
+ */
+csn *cs_chol_super(const cs *A, const css *S);
+
+/**
+ *  Incomplete Cholesky factorization of a symmetric matrix, A ~ L*L'. Only the lower triangle of A is used.
+ *  With droptol == 0 it is IC(0): L keeps the pattern of tril(A). With droptol > 0 it is ICT: fill is
+ *  allowed, entries below droptol times the norm of their column of A are dropped and at most fill more
+ *  entries than tril(A) has are kept in each column. A column with a non-positive pivot keeps only its
+ *  diagonal, sqrt of the norm of A(:,j), so L*L' stays positive definite.
+ *  @param A Matrix in compressed-column form.
+ *  @return N->L with the diagonal first in each column, or NULL on error.
+ */
+csn *cs_ichol(const cs *A, double droptol, int fill);
+
+/**
+ *  Incomplete LU factorization without pivoting, A ~ L*U. droptol and fill work as in cs_ichol(): ILU(0)
+ *  with droptol == 0 and ILUT otherwise, with the limit applied to L and U separately. L has a unit
+ *  diagonal stored first, U its diagonal last, so cs_lsolve() and cs_usolve() apply them.
+ *  @param A Matrix in compressed-column form.
+ *  @return N->L and N->U, or NULL on error.
+ */
+csn *cs_ilu(const cs *A, double droptol, int fill);
+
+
 /**
  *  Function that computes the refactorization of a matrix.
  *  @param A Matrix to factorize.
@@ -490,9 +647,82 @@ int cs_reltol(cs *A, double tol);
 int cs_print(const cs *A, FILE* outputFilePtr, int brief);
 
 int cs_print_formated(const cs *T, FILE* f, int size);
+int cs_slot(const cs *A, int i, int j);
+/**
+ *  Inverse of the diagonal of a triplet or compressed matrix for the Jacobi preconditioner,
+ *  in one O(nnz) pass. Columns without a diagonal entry get 1.
+ */
+void cs_get_diag(const cs *T,  double *m, int size);
 int cs_entry(cs *T, int i, int j, double x);
 int cs_add_to_entry(cs *T, int i, int j, double x);
 csn *cs_lu (const cs *A, const css *S, double tol);
+
+/**
+ *  Numeric LU refactorization of a matrix with the same pattern as the one N was computed from.
+ *  The pivot sequence and the nonzero structure of L and U are reused, so no reachability search
+ *  and no pivot search is done; only the values of N->L and N->U are overwritten.
+ *  @param A Matrix to factorize, same pattern as the original one.
+ *  @param S The symbolic analysis used for the original factorization.
+ *  @param N The factorization computed by cs_lu() to update in place.
+ *  @param tol A pivot is rejected when it is smaller than tol times the largest entry below it.
+ *  @return 1 on success and 0 if a pivot degraded, in which case N must be recomputed with cs_lu().
+ */
+csi cs_relu (const cs *A, const css *S, csn *N, double tol);
+
+/**
+ *  Parallel version of cs_relu(), with the same results bit for bit. Column k of L and U only reads the
+ *  columns of L that are its descendants in the column elimination tree of A(:,q), whatever the pivots.
+ *  @param A Matrix to factorize, same pattern as the original one.
+ *  @param S The symbolic analysis used for the original factorization.
+ *  @param N The factorization computed by cs_lu() to update in place.
+ *  @param tol A pivot is rejected when it is smaller than tol times the largest entry below it.
+ *  @param T Schedule computed by cs_tschedule() from the column elimination tree of A(:,q).
+ *  @param parfor Runs the tasks of one parallel region.
+ *  @param nthreads Largest thread index passed by parfor plus one.
+ *  @return 1 on success and 0 if a pivot degraded, in which case N must be recomputed with cs_lu().
+ */
+csi cs_relu_par (const cs *A, const css *S, csn *N, double tol, const cst *T,
+    cs_parfor parfor, int nthreads);
+
+/**
+ *  Sparse LU factorization like cs_lu(), computed and stored in single precision. Half the memory of the
+ *  double factors, for solves that are refined against the double matrix.
+ *  @param A Matrix to factorize.
+ *  @param S The symbolic analysis of A, as computed by cs_sqr().
+ *  @param tol Partial pivoting tolerance, as in cs_lu().
+ *  @return The single precision factors or NULL on error or on a zero pivot.
+ */
+csnf *cs_lu_float (const cs *A, const css *S, double tol);
+
+/**
+ *  Sparse Cholesky factorization like cs_chol(), computed and stored in single precision.
+ *  @param A Matrix to factorize.
+ *  @param S The symbolic analysis of A, as computed by cs_schol().
+ *  @return The single precision factor or NULL on error or on a non-positive pivot.
+ */
+csnf *cs_chol_float (const cs *A, const css *S);
+
+/**
+ *  cs_lusol_ws() with the single precision factors of cs_lu_float(), the vectors stay double.
+ *  @param y Scratch vector of size n.
+ *  @return 1 on success and 0 on error.
+ */
+csi cs_lusol_float (const css *S, const csnf *N, const double *b, double *x,
+    double *y, int n);
+
+/**
+ *  cs_cholsol_ws() with the single precision factor of cs_chol_float(), the vectors stay double.
+ *  @param y Scratch vector of size n.
+ *  @return 1 on success and 0 on error.
+ */
+csi cs_cholsol_float (const css *S, const csnf *N, const double *b, double *x,
+    double *y, int n);
+
+/**
+ *  Frees the factors computed by cs_lu_float() or cs_chol_float().
+ *  @return NULL.
+ */
+csnf *cs_nffree (csnf *N);
 css *cs_sqr (csi order, const cs *A, csi qr);
 cs *cs_permute (const cs *A, const csi *pinv, const csi *q, csi values);
 
@@ -503,11 +733,153 @@ csi cs_reach (cs *G, const cs *B, csi k, csi *xi, const csi *pinv);
 csi cs_dfs (csi j, cs *G, csi top, csi *xi, csi *pstack, const csi *pinv);
 csi cs_lsolve (const cs *L, double *x);
 csi cs_lusol (css *S, csn *N, double *b, double *x, int n );
+
+#define CS_LEVEL_CHUNK 128 /* rows per task, levels under two chunks are solved inline */
+
+/**
+ *  Level sets of a triangular factor for cs_tsolve(). A row belongs to the level after the deepest of the
+ *  rows it depends on, so the rows of one level can be solved in any order or at the same time.
+ *  @param A Triangular factor in compressed-column form, with a nonzero diagonal.
+ *  @param lower 1 if A (or A' when trans is set) is lower triangular.
+ *  @param trans 1 to solve with A' instead of A.
+ *  @return The row-wise copy of the factor with its levels or NULL on error.
+ */
+cstri *cs_tlevels (const cs *A, csi lower, csi trans);
+
+/**
+ *  Copies new values of the factor T was built from into T, the pattern must be the same.
+ *  @param T Levels computed by cs_tlevels().
+ *  @param A The factor with its new values.
+ */
+void cs_tvalues (cstri *T, const cs *A);
+
+/**
+ *  Triangular solve in place, level by level. Large levels are split in tasks of CS_LEVEL_CHUNK rows,
+ *  nothing is allocated.
+ *  @param T Levels computed by cs_tlevels().
+ *  @param x Right hand side on input, solution on output.
+ *  @param parfor Runs the tasks of one level, NULL to solve on the calling thread.
+ *  @return 1 on success and 0 on error.
+ */
+csi cs_tsolve (const cstri *T, double *x, cs_parfor parfor);
+
+/**
+ *  Frees the levels computed by cs_tlevels().
+ *  @param T The levels to free.
+ *  @return NULL.
+ */
+cstri *cs_tfree (cstri *T);
+
+/**
+ *  Solves Ax=b with the LU factorization of A like cs_lusol(), but b is left untouched and the
+ *  permutations go through the scratch vector y, so there is no copy back. x may alias b.
+ *  @param y Scratch vector of size n.
+ *  @return 1 on success and 0 on error.
+ */
+csi cs_lusol_ws (const css *S, const csn *N, const double *b, double *x,
+    double *y, int n);
+
+/**
+ *  Solves Ax=b with the Cholesky factorization of A like cs_cholsol(), without destroying b.
+ *  @param y Scratch vector of size n.
+ *  @return 1 on success and 0 on error.
+ */
+csi cs_cholsol_ws (const css *S, const csn *N, const double *b, double *x,
+    double *y, int n);
+
+/**
+ *  cs_lusol_ws() with the level-scheduled triangular solves.
+ *  @param L Levels of N->L, from cs_tlevels (N->L, 1, 0).
+ *  @param U Levels of N->U, from cs_tlevels (N->U, 0, 0).
+ *  @param y Scratch vector of size n.
+ *  @param parfor Runs the tasks of one level, NULL to solve on the calling thread.
+ *  @return 1 on success and 0 on error.
+ */
+csi cs_lusol_levels (const css *S, const csn *N, const cstri *L, const cstri *U,
+    const double *b, double *x, double *y, int n, cs_parfor parfor);
+
+/**
+ *  cs_cholsol_ws() with the level-scheduled triangular solves.
+ *  @param L Levels of N->L, from cs_tlevels (N->L, 1, 0).
+ *  @param Lt Levels of N->L', from cs_tlevels (N->L, 0, 1).
+ *  @param y Scratch vector of size n.
+ *  @param parfor Runs the tasks of one level, NULL to solve on the calling thread.
+ *  @return 1 on success and 0 on error.
+ */
+csi cs_cholsol_levels (const css *S, const cstri *L, const cstri *Lt,
+    const double *b, double *x, double *y, int n, cs_parfor parfor);
 csi cs_cholsol (css *s, csn *N , double *b, double *x, int n);
 
 #endif /* SPARSE_MATRIX_H_ */
 
 csi cs_gaxpy (const cs *A, const double *x, double *y);
+
+/**
+ *  Compressed-row copy of A for a row-parallel product. The rows are split in blocks of about equal
+ *  nonzeros plus rows, and each block is copied by the task that multiplies it later, so with a parfor
+ *  that keeps block k on one thread its rows are first touched, and placed, by that thread.
+ *  @param A Matrix in compressed-column form.
+ *  @param parts Number of row blocks, one per thread.
+ *  @param parfor Runs the copy of the blocks, NULL to copy on the calling thread.
+ *  @return The copy or NULL on error.
+ */
+csr *cs_csr (const cs *A, int parts, cs_parfor parfor);
+
+/**
+ *  y = A*x, one task per row block. Every y(i) is written by a single task, there is no reduction.
+ *  @param A Matrix from cs_csr().
+ *  @param parfor Runs the blocks, NULL to multiply on the calling thread.
+ *  @return 1 on success and 0 on error.
+ */
+csi cs_csr_gemv (const csr *A, const double *x, double *y, cs_parfor parfor);
+
+/**
+ *  Converts A to a storage format for cs_spmv(). The row blocks are split like in cs_csr(), on slice
+ *  (SELL) or block (BCSR) boundaries, and each block is filled by the task that multiplies it. Every
+ *  format sums a row in increasing column order, so they all give the same y to the last bit.
+ *  @param A Matrix in compressed-column form, it has to outlive the result for CS_SPMV_CSC.
+ *  @param format One of CS_SPMV_CSC, CS_SPMV_CSR, CS_SPMV_SELL or CS_SPMV_BCSR.
+ *  @param parts Number of row blocks, one per thread.
+ *  @param parfor Runs the fill of the blocks, NULL to fill on the calling thread.
+ *  @return The matrix or NULL on error.
+ */
+csmv *cs_spmv_build (const cs *A, int format, int parts, cs_parfor parfor);
+
+/**
+ *  Builds A in every format, times a few products with each and keeps the fastest.
+ *  @param A Matrix in compressed-column form, it has to outlive the result.
+ *  @param parts Number of row blocks, one per thread.
+ *  @param parfor Runs the products, NULL to time them on the calling thread.
+ *  @param gflops Rate of each format, indexed by format, 0 for a format that failed (may be NULL).
+ *  @return The fastest matrix, its rate in gflops, or NULL on error.
+ */
+csmv *cs_spmv_tune (const cs *A, int parts, cs_parfor parfor, double *gflops);
+
+/**
+ *  y = A*x in the format of A. CSC scatters by columns and runs on the calling thread.
+ *  @param parfor Runs the row blocks, NULL to multiply on the calling thread.
+ *  @return 1 on success and 0 on error.
+ */
+csi cs_spmv (const csmv *A, const double *x, double *y, cs_parfor parfor);
+
+/**
+ *  Name of a storage format, e.g. "SELL-8-256".
+ */
+const char *cs_spmv_name (int format);
+
+/**
+ *  Frees a matrix computed by cs_spmv_build() or cs_spmv_tune().
+ *  @param A The matrix to free.
+ *  @return NULL.
+ */
+csmv *cs_spmvfree (csmv *A);
+
+/**
+ *  Frees a matrix computed by cs_csr().
+ *  @param A The matrix to free.
+ *  @return NULL.
+ */
+csr *cs_csrfree (csr *A);
 csi cs_gaxpy_transpose (const cs *A, const double *x, double *y);
 double cs_atxy(cs *T, int i, int j);
 
@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <assert.h>
 #include "dc_instruction.h"
 #include "mna.h"
 #include "plot.h"
@@ -10,7 +11,7 @@
 #include "components.h"
 
 extern int *P;//mna.c
-extern double *m;
+extern precond_t *M;
 extern double *dc, *rhs;
 extern int mna_size;
 extern int unique_hash;
@@ -23,44 +24,95 @@ int dc_is_current;
 char * dc_id;
 
 
+// points the sweep at the value of the swept source
+static double *sweep_source()
+{
+	if ( dc_is_current ) {
+		i_t *i;
+
+		for ( i=p_i; i; i = i->next )
+			if ( strcasecmp(i->string_id, dc_id) == 0 )
+				return &i->val;
+
+		printf("[-] Specified current source does not exit\n");
+	} else {
+		v_t *v;
+
+		for ( v=p_v; v; v = v->next )
+			if ( strcasecmp(v->string_id, dc_id) == 0 )
+				return &v->val;
+
+		printf("[-] Specified voltage source does nto exist\n");
+	}
+
+	exit(1);
+}
+
 void dc_instruction()
 {
-	double t;
+	double t, *val = sweep_source();
+	double *B, *X, ts[SOLVE_BATCH], prev;
+	int i, count = 0;
 
-	
-	for ( t = dc_start; t<=dc_stop; t+=dc_step) {
-		if ( dc_is_current ) {
-			i_t *i;
-			
-			for ( i=p_i; i; i = i->next )
-					if ( strcasecmp(i->string_id, dc_id) == 0 ) {
-						i->val = t;
-						break;
-					}
-			if ( i == NULL ) {
-				printf("[-] Specified current source does not exit\n");
-				exit(1);
-			}
-				
-		} else {
-			v_t *v;
-			
-			for ( v=p_v; v; v = v->next )
-					if ( strcasecmp(v->string_id, dc_id) == 0 ) {
-						v->val = t;
-						break;
-					}
-			
-			if ( v == NULL ) {
-				printf("[-] Specified voltage source does nto exist\n");
-				exit(1);
+	if ( method_choice != NonIterative ) {
+		// each point starts from the last one, or from 2*x(n-1) - x(n-2)
+		X = warm_extrapolate ? (double*) malloc(sizeof(double) * mna_size) : NULL;
+		assert(X || !warm_extrapolate);
+
+		plot_open("dc");
+		for ( t = dc_start; t<=dc_stop; t+=dc_step, count++ ) {
+			*val = t;
+			generate_rhs(rhs, mna_size, unique_hash, 0, 0);
+			for ( i=0; X && i<mna_size; i++ ) {
+				prev = dc[i];
+				if ( count > 1 )
+					dc[i] = 2*dc[i] - X[i];
+				X[i] = prev;
 			}
+			solve(M, P, dc, rhs, mna_size);
+			print_plots(t, dc, P);
 		}
-		
-		generate_rhs(rhs, mna_size, unique_hash, 0, 0);
-		solve(m, P, dc, rhs, mna_size);
-		print_plots(t, dc, P);
+
+		free(X);
+		iter_report("DC sweep");
+		plot_finalize();
+		return;
+	}
+
+	// the transient may have left its own matrix factorized, get G's back from the cache
+	if ( decompose(mna_size, &P, method_noniter) != 0 ) {
+		printf("[-] Circuit doesn't have dc point\n");
+		exit(1);
+	}
+
+	B = (double*) malloc(sizeof(double) * mna_size * SOLVE_BATCH);
+	X = (double*) malloc(sizeof(double) * mna_size * SOLVE_BATCH);
+	assert(B && X);
+
+	plot_open("dc");
+
+	// the right hand sides of a batch are independent, solve them in parallel
+	for ( t = dc_start; ; t+=dc_step) {
+		if ( t <= dc_stop ) {
+			*val = t;
+			ts[count] = t;
+			generate_rhs(B + count*mna_size, mna_size, unique_hash, 0, 0);
+			count++;
+		}
+
+		if ( count == SOLVE_BATCH || (t > dc_stop && count) ) {
+			solve_lu_multi(P, B, X, mna_size, count, method_noniter);
+			for ( i=0; i<count; i++ )
+				print_plots(ts[i], X + i*mna_size, P);
+			count = 0;
+		}
+
+		if ( t > dc_stop )
+			break;
 	}
+
+	free(B);
+	free(X);
 	
 	plot_finalize();
 }
@@ -1,24 +1,25 @@
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <assert.h>
+#include "arena.h"
 #include "hash_table.h"
 
-#define HASHES_SIZE 1023
+#define HASH_SLOTS 1024        // initial slots, a power of two
 
-typedef struct HASH_T
-{
-  char *str;
-  int id;
-} hash_t;
-
-typedef struct HASH_BUCKET_T
-{
-  hash_t *hashes;
-  int size;
-} hash_bucket_t;
+/* Node names are interned in an open addressing table of ids, kept at most
+ * half full and doubled as it fills. The names live in an arena that is
+ * dropped as a whole, names[id] is the reverse table. Case is folded by the
+ * hash, so names equal but for case meet in one probe sequence and
+ * strncasecmp only runs on a full hash match. */
 
-static hash_bucket_t hashes[HASHES_SIZE];
+static int *slots = NULL;        // node ids, 0 for an empty slot
+static unsigned int mask = 0;    // slots - 1
+static unsigned int *folded = NULL;  // hash of the name of each id
+static char **names = NULL;      // id -> name
+static int names_size = 0;
+static arena_t pool;
 
 int unique_hash=0;
 
@@ -26,60 +27,102 @@ int unique_hash=0;
 //-------------------
 void hash_initialize()
 {
-  memset(hashes, 0, sizeof(hash_bucket_t)*HASHES_SIZE);
+  slots = (int*) calloc(HASH_SLOTS, sizeof(int));
+  assert(slots);
+  mask = HASH_SLOTS - 1;
   unique_hash = 1;
 }
 
 void hash_cleanup()
 {
-  int i = 0;
-  int num = 0;
-  int j = 0;
-  for ( i=0; i<HASHES_SIZE; i++ ) {
-    if ( hashes[i].size ) {
-      for (j=0; j<hashes[i].size; j ++ ) {
-        free(hashes[i].hashes[j].str);
-        num++;
-      }
-      free(hashes[i].hashes);
-    } 
-  }
+  arena_release(&pool);
+  free(slots);
+  free(folded);
+  free(names);
+  slots = NULL;
+  folded = NULL;
+  names = NULL;
+  names_size = 0;
 }
 
-int hash(unsigned char *str)
+static unsigned int hash(const char *str, int len)
 {
-  assert(str != 0 && "Passed NULL to hashing function");
+  unsigned int h = 2166136261u;
+  int i, c;
+
+  for (i=0; i<len; i++ ) {
+    c = (unsigned char) str[i];
+    if ( c >= 'A' && c <= 'Z' )
+      c += 'a' - 'A';
+    h = (h ^ c) * 16777619u;
+  }
 
-  unsigned long h= 5381;
-  int c;
+  return h;
+}
+
+static void grow()
+{
+  unsigned int i, size = 2*(mask + 1);
+  int id;
 
-  while ((c = *(str++)))
-      h= ((h<< 5) + h) + c; /* hash * 33 + c */
+  free(slots);
+  slots = (int*) calloc(size, sizeof(int));
+  assert(slots);
+  mask = size - 1;
 
-  return h%HASHES_SIZE;
+  for (id=1; id<unique_hash; id++ ) {
+    for ( i=folded[id] & mask; slots[i]; i=(i+1) & mask )
+      ;
+    slots[i] = id;
+  }
 }
 
-int hash_get(char *str)
+/* Like hash_get() for a name inside a buffer (the mapped netlist), the name
+ * is copied only the first time it is seen. */
+int hash_get_slice(const char *str, int len)
 {
-  int h = hash((unsigned char*)str);
-  int i;
-  
-  for (i=0; i< hashes[h].size; i++ ) {
-    if ( strcasecmp(hashes[h].hashes[i].str, str) == 0 ) {
-      free(str);
-      return hashes[h].hashes[i].id;
-    }
+  unsigned int h = hash(str, len), i;
+  int id;
+
+  for ( i=h & mask; (id = slots[i]); i=(i+1) & mask ) {
+    if ( folded[id] == h && strncasecmp(names[id], str, len) == 0 && names[id][len] == 0 )
+      return id;
+  }
+
+  if ( unique_hash >= names_size ) {
+    names_size = names_size ? 2*names_size : HASH_SLOTS;
+    names = (char**) realloc(names, sizeof(char*)*names_size);
+    folded = (unsigned int*) realloc(folded, sizeof(unsigned int)*names_size);
+    assert(names && folded);
   }
-  
 
-  hashes[h].hashes = (hash_t*) realloc(hashes[h].hashes, sizeof(hash_t)*(hashes[h].size+1));
-  hashes[h].hashes[ (hashes[h].size) ].str = str;
-  hashes[h].hashes[ (hashes[h].size)++ ].id= unique_hash;
+  id = unique_hash++;
+  names[id] = arena_strndup(&pool, str, len);
+  folded[id] = h;
+  slots[i] = id;
 #ifdef VERBOSE_HASH
-  printf("translating %s to %d\n", str, unique_hash);
+  printf("translating %s to %d\n", names[id], id);
 #endif
 
-  return unique_hash++;
+  if ( 2*(unsigned int) unique_hash > mask + 1 )
+    grow();
+
+  return id;
 }
 
+int hash_get(const char *str)
+{
+  assert(str != 0 && "Passed NULL to hashing function");
 
+  return hash_get_slice(str, strlen(str));
+}
+
+const char *hash_name(int id)
+{
+  return id > 0 && id < unique_hash ? names[id] : NULL;
+}
+
+int hash_count()
+{
+  return unique_hash - 1;
+}
@@ -3,6 +3,9 @@
 
 void hash_initialize();
 void hash_cleanup();
-int hash_get(char *str);
+int hash_get(const char *str);
+int hash_get_slice(const char *str, int len);
+const char *hash_name(int id);  // the reverse table, NULL for ground
+int hash_count();               // names hashed so far, their ids are 1..hash_count()
 
 #endif
@@ -5,9 +5,10 @@
 #include "mna.h"
 #include "dc_instruction.h"
 #include "transient.h"
+#include "threads.h"
+#include "netlist.h"
+#include "plot.h"
 
-extern FILE* yyin;
-int yyparse();
 int yylex_destroy();
 
 enum IterativeMethods method_iter    = BiCG;
@@ -17,12 +18,21 @@ enum TransientMethods method_tran = Tr;
 int sparse_use = 0;
 
 double itol = 1e-6;
+int gmres_restart = 30;
+int threads_use = 0; // 0: ZICE_THREADS or all online cpus
+int pin_use = 0; // 1: pool thread i bound to the i-th cpu
+enum Preconditioners precond_use = Jacobi;
+double precond_droptol = 0;
+int precond_fill = 10;
+int warm_extrapolate = 0;
+int recycle_size = 0;
+int mixed_use = 0;
+int reduce_use = 0;
 extern int mna_size;
 
 int main(int argc, char* argv[])
 {
 	int debug;
-  yyin = fopen(argv[1], "r");
 	
   if ( argc !=4 ) {
     printf("usage:\n%s <file.spice> <output_file> DEBUG\n", argv[0]);
@@ -36,19 +46,17 @@ int main(int argc, char* argv[])
 	
 		
   
-  if ( yyin == NULL ) {
-    printf("[-] Could not open %s\n", argv[1]);
-    return 0;
-  }
-
   hash_initialize();
 
-  if ( yyparse() == 0 ) {
+  if ( netlist_load(argv[1]) == 0 ) {
     printf("[+] Parsed %s succesfully.\n", argv[1]);
+    threads_reset();
     		if (debug){
 			method_choice = NonIterative;
 			method_noniter = LUDecomp;
 			sparse_use=0;
+			mixed_use=0;
+			reduce_use=0;
 		}
     mna_analysis();
     solve_dc();
@@ -65,10 +73,11 @@ int main(int argc, char* argv[])
 		mna_free();
   }
 
+  plot_cleanup();
   components_cleanup();
-  fclose(yyin);
   yylex_destroy();
   hash_cleanup();
+  threads_cleanup();
 
 
 
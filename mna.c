@@ -12,7 +12,8 @@
 
 extern int unique_hash; // this is how many nodes we got
 
-double *G=NULL, *C=NULL, *dc, *rhs, *m=NULL;
+double *G=NULL, *C=NULL, *LU=NULL, *dc, *rhs;
+precond_t *M=NULL;
 cs *G_s=NULL, *C_s=NULL;
 css *S=NULL;
 csn *N=NULL;
@@ -20,6 +21,21 @@ csn *N=NULL;
 int *P=NULL;
 int mna_size=0;
 
+/* Sparse assembly runs the stamping code twice: the first pass only records
+ * where every stamp lands, the second one adds the values straight into the
+ * compressed-column slots that cs_compress_map() resolved for each stamp. */
+typedef struct STAMP_MAP_T
+{
+	cs *T;      // pattern of the stamps, in stamping order
+	int *slot;  // slot[k] = position of the k-th stamp in A->x
+	int count;  // stamps issued during the current pass
+} stamp_map_t;
+
+enum StampPass { StampPattern, StampValues, StampDone };
+
+static stamp_map_t G_map, C_map;
+static enum StampPass stamp_pass = StampDone;
+
 
 int Doolittle_LU_Decomposition(double *A, int n);
 int Doolittle_LU_Solve(double *LU, double B[], double x[], int n);
@@ -30,6 +46,15 @@ void mna_free()
 	if ( C )  free(C);
 	if ( P )  free(P);
 
+	factor_cache_free();
+	solver_free();
+	precond_free(M);
+	M = NULL;
+	cs_spfree(G_s);
+	cs_spfree(C_s);
+	free(G_map.slot);
+	free(C_map.slot);
+
 	free(dc);
 	free(rhs);
 }
@@ -38,8 +63,7 @@ void mna_free()
  
 void solve_dc()
 {
-	int i, ret;
-	cs *temp;
+	int ret;
 	P = NULL;
 	dc = (double*) calloc(mna_size, sizeof(double));
 	rhs = (double*) calloc(mna_size, sizeof(double));
@@ -59,25 +83,9 @@ void solve_dc()
 				solve_lu( P, rhs, dc, mna_size, method_noniter);
 			}
 		} else {
-			m = (double*) calloc(mna_size, sizeof(double));
-
-			assert(m!=NULL && "Not enough memory for m");
-			
-			if ( sparse_use == 0 ) {
-				for (i=0; i<mna_size; i++) {
-					m[i] = G[i*mna_size+i];
-					if ( fabs(m[i]) < 0.000001 )
-						m[i] = 1;
-					else
-						m[i] = 1/m[i];
-				}
-			} else {
-				cs_get_diag(G_s, m, mna_size);
-				temp = G_s;
-				G_s = cs_compress(G_s);
-			}
-			solve_iter( rhs, dc, m, mna_size, method_iter);
-			G_s = temp;
+			M = precond_setup(M, mna_size);
+			solve_iter( rhs, dc, M, mna_size, method_iter);
+			iter_report("DC point");
 		}
 
 	
@@ -94,12 +102,35 @@ void solve_dc()
 #endif
 }
 
+static void sparse_stamp(cs *A, stamp_map_t *map, int row, int col, double val, int add)
+{
+	int k;
+
+	switch ( stamp_pass ) {
+		case StampPattern:
+			cs_entry(map->T, row, col, val);
+			break;
+
+		case StampValues:
+			k = map->slot[ map->count++ ];
+			A->x[k] = add ? A->x[k] + val : val;
+			break;
+
+		default:
+			k = cs_slot(A, row, col);
+			if ( k >= 0 )
+				A->x[k] = add ? A->x[k] + val : val;
+			else
+				assert(val == 0 && "Stamp outside of the assembled pattern");
+	}
+}
+
 void c_add(int row, int col, double val)
 {
 	if ( sparse_use == 0 ) {
 		C[row*mna_size+col] += val;
 	} else
-		cs_add_to_entry(C_s, row, col, val);
+		sparse_stamp(C_s, &C_map, row, col, val, 1);
 }
 
 void g_add(int row, int col, double val)
@@ -107,7 +138,7 @@ void g_add(int row, int col, double val)
 	if ( sparse_use == 0 ) {
 		G[row*mna_size+col] += val;
 	} else
-    cs_add_to_entry(G_s, row, col, val);
+		sparse_stamp(G_s, &G_map, row, col, val, 1);
 }
 
 double g_read(int row, int col)
@@ -132,7 +163,7 @@ void g_write(int row, int col, double val)
 	if ( sparse_use == 0 ) {
 		G[row*mna_size+col] = val;
 	} else
-    cs_entry(G_s, row, col, val);
+		sparse_stamp(G_s, &G_map, row, col, val, 0);
 }
 
 void c_write(int row, int col, double val)
@@ -140,42 +171,16 @@ void c_write(int row, int col, double val)
 	if ( sparse_use == 0 ) {
 		C[row*mna_size+col] = val;
 	} else
-    cs_entry(G_s, row, col, val);
-		
+		sparse_stamp(C_s, &C_map, row, col, val, 0);
 }
-void mna_analysis()
+
+static void mna_stamp()
 {
-	FILE *g_file, *c_file;
 	r_t *r;
 	v_t *v;
 	l_t *l;
 	c_t *c;
 
-	unique_hash--;
-
-	mna_size = voltages + inductors +unique_hash;
-#ifdef VERBOSE
-	printf("[$] Voltages : %d\n"
-			"[$] Inductors: %d\n"
-			"[$] Nodes    : %d\n"
-			"[$] Total    : %d\n",
-			voltages, inductors, unique_hash, mna_size);
-#endif
-
-	if ( sparse_use == 0 ) {
-		G = (double*) calloc(mna_size*mna_size,sizeof(double));
-		C = (double*) calloc(mna_size*mna_size, sizeof(double));
-    
-    assert(G);
-    assert(C);
-	} else {
-    G_s = cs_spalloc(mna_size, mna_size, voltages + resistors*4, 1,1);
-    C_s = cs_spalloc(mna_size, mna_size, voltages + resistors*4, 1,1);
-
-    assert(G_s);
-    assert(C_s);
-  }
-
 	for ( r =p_r; r; r=r->next ) {
 		if ( r->plus > 0 )
 			g_add(r->plus-1, r->plus-1, 1/r->val);
@@ -223,10 +228,72 @@ void mna_analysis()
 			c_add(c->minus-1, c->minus-1,c->val);
 
 		if ( c->plus >0 && c->minus > 0 ) {
-			c_add(c->minus-1, c->plus-1, c->val);
-			c_add(c->plus-1, c->minus-1, c->val);
+			c_add(c->minus-1, c->plus-1, -c->val);
+			c_add(c->plus-1, c->minus-1, -c->val);
 		}
 	}
+}
+
+static cs *map_compress(stamp_map_t *map)
+{
+	cs *A;
+
+	map->slot = (int*) malloc(sizeof(int) * (map->T->nz ? map->T->nz : 1));
+	assert(map->slot);
+
+	A = cs_compress_map(map->T, map->slot);
+	assert(A);
+
+	map->T = cs_spfree(map->T);
+	map->count = 0;
+	return A;
+}
+
+static void mna_assemble_sparse()
+{
+	G_map.T = cs_spalloc(mna_size, mna_size, 4*(resistors + voltages + inductors), 0, 1);
+	C_map.T = cs_spalloc(mna_size, mna_size, 4*capacitors + inductors, 0, 1);
+
+	assert(G_map.T);
+	assert(C_map.T);
+
+	stamp_pass = StampPattern;
+	mna_stamp();
+
+	G_s = map_compress(&G_map);
+	C_s = map_compress(&C_map);
+
+	stamp_pass = StampValues;
+	mna_stamp();
+	stamp_pass = StampDone;
+}
+
+void mna_analysis()
+{
+	FILE *g_file, *c_file;
+
+	unique_hash--;
+
+	mna_size = voltages + inductors +unique_hash;
+#ifdef VERBOSE
+	printf("[$] Voltages : %d\n"
+			"[$] Inductors: %d\n"
+			"[$] Nodes    : %d\n"
+			"[$] Total    : %d\n",
+			voltages, inductors, unique_hash, mna_size);
+#endif
+
+	if ( sparse_use == 0 ) {
+		G = (double*) calloc(mna_size*mna_size,sizeof(double));
+		C = (double*) calloc(mna_size*mna_size, sizeof(double));
+    
+    assert(G);
+    assert(C);
+
+		mna_stamp();
+	} else {
+		mna_assemble_sparse();
+  }
 
 	printf("[+] MNA is done (size: %dx%d)\n", mna_size, mna_size);
 
@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "components.h"
+#include "hash_table.h"
+#include "netcache.h"
+
+#define NETCACHE_MAGIC "ZICEIMG"
+#define NETCACHE_VERSION 3  // 2: names are matched without case, 3: 64-bit key, deck length and time
+
+typedef struct IMAGE_HEADER_T
+{
+	char magic[8];
+	int version;
+	int transient_size;  // sizeof(transient_t) of the writer
+	uint64_t key;
+	long bytes;          // of the deck lines the key covers
+	long deck_size;      // the deck when the image was written
+	long deck_mtime;
+	int names;           // node ids 1..names
+	int voltages, currents, resistors, capacitors, inductors;
+	int transients;
+	long pairs;
+	long strings;        // bytes of the string pool
+} image_header_t;
+
+// a resistor, capacitor or inductor
+typedef struct IMAGE_BRANCH_T
+{
+	int plus, minus;
+	double val;
+} image_branch_t;
+
+// a voltage or current source
+typedef struct IMAGE_SOURCE_T
+{
+	int plus, minus;
+	double val;
+	long name;           // offset in the string pool
+	int transient;       // index in the transients, -1 for none
+	int pad;
+	long pairs;          // first pair of a PWL
+} image_source_t;
+
+/* The sections follow the header in this order, each starting 8 byte
+ * aligned: name offsets, branches (r, c, l), sources (v, i), transients,
+ * PWL pairs and the string pool. */
+typedef struct IMAGE_T
+{
+	image_header_t *h;
+	long *names;
+	image_branch_t *branch;
+	image_source_t *source;
+	transient_t *transient;
+	pair_t *pairs;
+	char *strings;
+} image_t;
+
+static long align8(long n)
+{
+	return (n + 7) & ~7L;
+}
+
+// points the sections into an image of h's counts at base, returns its size
+static long image_layout(image_t *im, char *base, const image_header_t *h)
+{
+	long off[6], n = align8(sizeof(image_header_t));
+	long count[6] = { h->names, (long) h->resistors + h->capacitors + h->inductors,
+		(long) h->voltages + h->currents, h->transients, h->pairs, h->strings };
+	long bytes[6] = { sizeof(long), sizeof(image_branch_t), sizeof(image_source_t),
+		sizeof(transient_t), sizeof(pair_t), 1 };
+	int k;
+
+	for ( k = 0; k < 6; k++ ) {
+		off[k] = n;
+		n = align8(n + bytes[k]*count[k]);
+	}
+
+	if ( base ) {
+		im->h = (image_header_t*) base;
+		im->names = (long*) (base + off[0]);
+		im->branch = (image_branch_t*) (base + off[1]);
+		im->source = (image_source_t*) (base + off[2]);
+		im->transient = (transient_t*) (base + off[3]);
+		im->pairs = (pair_t*) (base + off[4]);
+		im->strings = base + off[5];
+	}
+
+	return n;
+}
+
+static char *image_path(const char *deck)
+{
+	char *path = (char*) malloc(strlen(deck) + 6);
+
+	assert(path);
+	sprintf(path, "%s.zbin", deck);
+
+	return path;
+}
+
+int netcache_enabled()
+{
+	return getenv("ZICE_NO_CACHE") == NULL;
+}
+
+// every offset and index of the image stays inside it
+static int image_check(const image_t *im)
+{
+	const image_header_t *h = im->h;
+	const image_source_t *s;
+	long k, sources = (long) h->voltages + h->currents;
+
+	if ( h->strings == 0 || im->strings[h->strings-1] != 0 )
+		return 0;
+
+	for ( k = 0; k < h->names; k++ ) {
+		if ( im->names[k] < 0 || im->names[k] >= h->strings )
+			return 0;
+	}
+
+	for ( k = 0; k < (long) h->resistors + h->capacitors + h->inductors; k++ ) {
+		if ( im->branch[k].plus < 0 || im->branch[k].plus > h->names ||
+				im->branch[k].minus < 0 || im->branch[k].minus > h->names )
+			return 0;
+	}
+
+	for ( k = 0; k < sources; k++ ) {
+		s = &im->source[k];
+		if ( s->plus < 0 || s->plus > h->names || s->minus < 0 || s->minus > h->names )
+			return 0;
+		if ( s->name < 0 || s->name >= h->strings )
+			return 0;
+		if ( s->transient < -1 || s->transient >= h->transients )
+			return 0;
+		if ( s->transient >= 0 && (im->transient[s->transient].type < Sin ||
+				im->transient[s->transient].type > Exp) )
+			return 0;
+		if ( s->transient >= 0 && im->transient[s->transient].type == Pwl ) {
+			if ( s->pairs < 0 || im->transient[s->transient].tpwl.size < 0 ||
+					s->pairs + im->transient[s->transient].tpwl.size > h->pairs )
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+static transient_t *image_transient(const image_t *im, const image_source_t *s)
+{
+	transient_t *t;
+
+	if ( s->transient < 0 )
+		return NULL;
+
+	t = (transient_t*) circuit_alloc(sizeof(transient_t));
+	memcpy(t, &im->transient[s->transient], sizeof(transient_t));
+
+	if ( t->type == Pwl ) {
+		t->tpwl.pairs = (pair_t*) circuit_alloc(sizeof(pair_t)*t->tpwl.size);
+		memcpy(t->tpwl.pairs, im->pairs + s->pairs, sizeof(pair_t)*t->tpwl.size);
+	}
+
+	return t;
+}
+
+static void image_restore(const image_t *im)
+{
+	const image_header_t *h = im->h;
+	const image_source_t *s;
+	const image_branch_t *b = im->branch;
+	int counts[5] = { h->voltages, h->currents, h->resistors, h->capacitors, h->inductors };
+	const char *types = "vircl";
+	element_t *e;
+	long k, n, max = 0;
+	int type;
+
+	for ( type = 0; type < 5; type++ )
+		max = counts[type] > max ? counts[type] : max;
+
+	e = (element_t*) calloc(max ? max : 1, sizeof(element_t));
+	assert(e);
+
+	s = im->source;
+	for ( type = 0; type < 5; type++ ) {
+		n = counts[type];
+		for ( k = 0; k < n; k++ ) {
+			e[k].type = types[type];
+			if ( type < 2 ) {
+				e[k].plus = s[k].plus;
+				e[k].minus = s[k].minus;
+				e[k].val = s[k].val;
+				e[k].string_id = circuit_strdup(im->strings + s[k].name);
+				e[k].transient = image_transient(im, &s[k]);
+			} else {
+				e[k].plus = b[k].plus;
+				e[k].minus = b[k].minus;
+				e[k].val = b[k].val;
+			}
+		}
+
+		components_append(e, n);
+		if ( type < 2 )
+			s += n;
+		else
+			b += n;
+	}
+
+	free(e);
+}
+
+int netcache_load(const char *deck, uint64_t key, long bytes)
+{
+	char *path = image_path(deck), *base;
+	image_header_t h;
+	image_t im;
+	struct stat st, ds;
+	int fd, ok = 0;
+	long k;
+
+	fd = open(path, O_RDONLY);
+	if ( fd < 0 ) {
+		free(path);
+		return -1;
+	}
+
+	if ( fstat(fd, &st) || st.st_size < (long) sizeof(image_header_t) ||
+			read(fd, &h, sizeof(h)) != sizeof(h) ) {
+		close(fd);
+		free(path);
+		return -1;
+	}
+
+	// a stale or foreign image is simply written again after the parse
+	if ( memcmp(h.magic, NETCACHE_MAGIC, sizeof(NETCACHE_MAGIC)) || h.version != NETCACHE_VERSION ||
+			h.transient_size != sizeof(transient_t) || h.key != key || h.bytes != bytes ||
+			h.names < 0 || h.voltages < 0 || h.currents < 0 || h.resistors < 0 ||
+			h.capacitors < 0 || h.inductors < 0 || h.transients < 0 || h.pairs < 0 || h.strings < 0 ||
+			image_layout(NULL, NULL, &h) != st.st_size ) {
+		close(fd);
+		free(path);
+		return -1;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( base == MAP_FAILED ) {
+		free(path);
+		return -1;
+	}
+
+	image_layout(&im, base, &h);
+
+	if ( image_check(&im) ) {
+		// the names come back with the ids they had
+		for ( k = 0; k < h.names; k++ ) {
+			if ( hash_get_slice(im.strings + im.names[k], strlen(im.strings + im.names[k])) != k + 1 )
+				break;
+		}
+
+		ok = k == h.names;
+		if ( ok ) {
+			image_restore(&im);
+			// an edit of the dot commands alone still hits, but say so
+			if ( stat(deck, &ds) || ds.st_size != h.deck_size || ds.st_mtime != h.deck_mtime )
+				printf("[#] %s changed since its image, its elements hash the same\n", deck);
+			printf("[+] Circuit restored from %s\n", path);
+		} else {
+			hash_cleanup();
+			hash_initialize();
+		}
+	}
+
+	munmap(base, st.st_size);
+	free(path);
+
+	return ok ? 0 : -1;
+}
+
+// appends s to the pool, returns its offset
+static long pool_add(char **pool, long *size, long *cap, const char *s)
+{
+	long len = strlen(s) + 1, off = *size;
+
+	if ( *size + len > *cap ) {
+		*cap = 2*(*size + len);
+		*pool = (char*) realloc(*pool, *cap);
+		assert(*pool);
+	}
+
+	memcpy(*pool + off, s, len);
+	*size += len;
+
+	return off;
+}
+
+static void source_table(v_t *list, image_source_t *s, transient_t *tr, int *ntr,
+		pair_t **pairs, long *npairs, char **pool, long *size, long *cap)
+{
+	image_source_t *p;
+	v_t *v;
+
+	for ( v = list; v; v = v->next ) {
+		p = &s[v->id];
+		p->plus = v->plus;
+		p->minus = v->minus;
+		p->val = v->val;
+		p->name = pool_add(pool, size, cap, v->string_id);
+		p->transient = -1;
+		p->pad = 0;
+		p->pairs = 0;
+
+		if ( v->transient ) {
+			p->transient = *ntr;
+			tr[*ntr] = *v->transient;
+
+			if ( v->transient->type == Pwl ) {
+				p->pairs = *npairs;
+				tr[*ntr].tpwl.pairs = NULL;
+				*pairs = (pair_t*) realloc(*pairs, sizeof(pair_t)*(*npairs + v->transient->tpwl.size + 1));
+				assert(*pairs);
+				memcpy(*pairs + *npairs, v->transient->tpwl.pairs, sizeof(pair_t)*v->transient->tpwl.size);
+				*npairs += v->transient->tpwl.size;
+			}
+			(*ntr)++;
+		}
+	}
+}
+
+static void branch_table(r_t *list, image_branch_t *b)
+{
+	r_t *r;
+
+	for ( r = list; r; r = r->next ) {
+		b[r->id].plus = r->plus;
+		b[r->id].minus = r->minus;
+		b[r->id].val = r->val;
+	}
+}
+
+// n bytes and the padding to the next section
+static int write_section(FILE *out, const void *p, long n)
+{
+	static const char zero[8];
+
+	if ( n && fwrite(p, 1, n, out) != n )
+		return 0;
+
+	return fwrite(zero, 1, align8(n) - n, out) == align8(n) - n;
+}
+
+// a node only a dot command names (a .PLOT of nothing) is left out of the image
+static int names_used(int names)
+{
+	char *used = (char*) calloc(names + 1, 1);
+	r_t *lists[3] = { p_r, p_c, p_l };
+	v_t *sources[2] = { p_v, p_i };
+	r_t *r;
+	v_t *v;
+	int k, all = 1;
+
+	assert(used);
+	for ( k = 0; k < 3; k++ ) {
+		for ( r = lists[k]; r; r = r->next )
+			used[r->plus] = used[r->minus] = 1;
+	}
+	for ( k = 0; k < 2; k++ ) {
+		for ( v = sources[k]; v; v = v->next )
+			used[v->plus] = used[v->minus] = 1;
+	}
+
+	for ( k = 1; k <= names; k++ )
+		all = all && used[k];
+	free(used);
+
+	return all;
+}
+
+void netcache_save(const char *deck, uint64_t key, long bytes)
+{
+	char *path, *tmp, *pool = NULL;
+	long size = 0, cap = 0, k;
+	image_header_t h;
+	image_t im;
+	struct stat ds;
+	transient_t *tr;
+	pair_t *pairs = NULL;
+	FILE *out;
+	int ok;
+
+	if ( !names_used(hash_count()) || stat(deck, &ds) )
+		return;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, NETCACHE_MAGIC, sizeof(NETCACHE_MAGIC));
+	h.version = NETCACHE_VERSION;
+	h.transient_size = sizeof(transient_t);
+	h.key = key;
+	h.bytes = bytes;
+	h.deck_size = ds.st_size;
+	h.deck_mtime = ds.st_mtime;
+	h.names = hash_count();
+	h.voltages = voltages;
+	h.currents = currents;
+	h.resistors = resistors;
+	h.capacitors = capacitors;
+	h.inductors = inductors;
+
+	im.names = (long*) malloc(sizeof(long)*(h.names + 1));
+	im.branch = (image_branch_t*) calloc((long) resistors + capacitors + inductors + 1, sizeof(image_branch_t));
+	im.source = (image_source_t*) calloc((long) voltages + currents + 1, sizeof(image_source_t));
+	tr = (transient_t*) calloc((long) voltages + currents + 1, sizeof(transient_t));
+	assert(im.names && im.branch && im.source && tr);
+
+	for ( k = 0; k < h.names; k++ )
+		im.names[k] = pool_add(&pool, &size, &cap, hash_name(k+1));
+
+	branch_table(p_r, im.branch);
+	branch_table(p_c, im.branch + resistors);
+	branch_table(p_l, im.branch + resistors + capacitors);
+	source_table(p_v, im.source, tr, &h.transients, &pairs, &h.pairs, &pool, &size, &cap);
+	source_table(p_i, im.source + voltages, tr, &h.transients, &pairs, &h.pairs, &pool, &size, &cap);
+	h.strings = size;
+
+	path = image_path(deck);
+	tmp = (char*) malloc(strlen(path) + 5);
+	assert(tmp);
+	sprintf(tmp, "%s.tmp", path);
+
+	out = fopen(tmp, "wb");
+	ok = out != NULL;
+	if ( ok ) {
+		ok = write_section(out, &h, sizeof(h)) &&
+			write_section(out, im.names, sizeof(long)*h.names) &&
+			write_section(out, im.branch, sizeof(image_branch_t)*((long) resistors + capacitors + inductors)) &&
+			write_section(out, im.source, sizeof(image_source_t)*((long) voltages + currents)) &&
+			write_section(out, tr, sizeof(transient_t)*(long) h.transients) &&
+			write_section(out, pairs, sizeof(pair_t)*h.pairs) &&
+			write_section(out, pool, h.strings);
+		ok = fclose(out) == 0 && ok;
+	}
+
+	if ( ok && rename(tmp, path) == 0 ) {
+		printf("[#] Netlist image saved in %s\n", path);
+	} else {
+		printf("[-] Could not write the netlist image %s\n", path);
+		unlink(tmp);
+	}
+
+	free(tmp);
+	free(path);
+	free(pool);
+	free(pairs);
+	free(tr);
+	free(im.source);
+	free(im.branch);
+	free(im.names);
+}
@@ -0,0 +1,18 @@
+#ifndef NETCACHE_H
+#define NETCACHE_H
+#include <stdint.h>
+
+/* Binary image of a parsed circuit, kept next to the deck as <deck>.zbin:
+ * the node names in id order, the element tables and the transient specs.
+ * The key is a hash of the deck without its dot commands, those are read
+ * again on every run, and bytes the length of what it hashes. Setting
+ * ZICE_NO_CACHE turns the image off. */
+
+int netcache_enabled();
+
+// restores the circuit, 0 on success, the node table must be empty
+int netcache_load(const char *deck, uint64_t key, long bytes);
+
+void netcache_save(const char *deck, uint64_t key, long bytes);
+
+#endif
@@ -0,0 +1,697 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "components.h"
+#include "hash_table.h"
+#include "threads.h"
+#include "netcache.h"
+#include "netlist.h"
+
+#define NETLIST_CHUNK (4 << 20)  // bytes of the deck one task scans, cut at a line end
+
+extern FILE *yyin;
+extern int yylineno;
+int yyparse();
+void yyrestart(FILE *input_file);
+
+typedef struct TOKEN_T
+{
+	const char *s;
+	int len;
+} token_t;
+
+// a component line the scanner took apart, nothing interned yet
+typedef struct LINE_T
+{
+	token_t name, plus, minus;
+	double val;
+} line_t;
+
+// an element of a chunk, or a run of lines for the grammar (type 0)
+typedef struct RECORD_T
+{
+	char type;
+	int plus, minus;   // chunk node ids, -1 for ground; the first line of the run
+	double val;
+	token_t name;      // the name of a source, the text of the run
+} record_t;
+
+/* What a task found in its part of the deck. Node names get chunk ids in the
+ * order they are first seen, the merge interns each once per chunk. */
+typedef struct CHUNK_T
+{
+	const char *begin, *end;
+	const char *lead;  // end of the blank and comment lines the chunk starts with
+	int lines;
+	record_t *rec;
+	int nrec, rec_cap;
+	token_t *names;    // chunk node id -> name
+	int *global;       // chunk node id -> hash_get id, 0 until interned
+	int nnames, names_cap;
+	int *table;        // open addressing over names, -1 when empty
+	int table_size;
+	uint64_t hash, power;       // the key pass, see key_chunk
+	long bytes;                 // of the lines the key covers
+} chunk_t;
+
+// the merge, in file order
+typedef struct MERGE_T
+{
+	const char *buf;
+	const char *span, *span_end;  // lines waiting for the grammar
+	int span_line;
+	element_t *batch;             // elements waiting for components_append
+	int nbatch, batch_cap;
+} merge_t;
+
+static int is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+// the token starting at the first non blank of [p, end), len 0 at the end
+static const char *next_token(const char *p, const char *end, token_t *t)
+{
+	while ( p < end && is_blank(*p) )
+		p++;
+
+	t->s = p;
+	while ( p < end && !is_blank(*p) )
+		p++;
+	t->len = p - t->s;
+
+	return p;
+}
+
+static int is_keyword(const token_t *t, const char *word)
+{
+	return t->len == strlen(word) && strncasecmp(t->s, word, t->len) == 0;
+}
+
+// a STRING of the lexer: [_]?[[:alpha:]]+ then letters, digits and '_'
+static int is_name(const token_t *t)
+{
+	int i = 0;
+
+	if ( t->s[i] == '_' )
+		i++;
+	if ( i == t->len || !isalpha((unsigned char) t->s[i]) )
+		return 0;
+	for ( ; i < t->len; i++ ) {
+		if ( !isalnum((unsigned char) t->s[i]) && t->s[i] != '_' )
+			return 0;
+	}
+
+	// these are tokens of their own
+	return !is_keyword(t, "pwl") && !is_keyword(t, "sin") &&
+		!is_keyword(t, "pulse") && !is_keyword(t, "exp");
+}
+
+static int digits(const char *s, int len)
+{
+	int i;
+
+	for ( i = 0; i < len && isdigit((unsigned char) s[i]); i++ )
+		;
+
+	return i;
+}
+
+static int is_integer(const token_t *t)
+{
+	return t->len > 0 && digits(t->s, t->len) == t->len;
+}
+
+static int is_ground(const token_t *t)
+{
+	int i;
+
+	for ( i = 0; i < t->len && t->s[i] == '0'; i++ )
+		;
+
+	return i == t->len;
+}
+
+/* The grammar reads an integer node and prints it back, so 007 is node 7.
+ * Names that do not print back to themselves are left to it. */
+static int is_node(const token_t *t)
+{
+	if ( is_name(t) )
+		return 1;
+	if ( !is_integer(t) )
+		return 0;
+
+	return is_ground(t) || (t->s[0] != '0' && t->len < 10);
+}
+
+/* An INTEGER or a DOUBLE of the lexer, anything else (1k, .5, 1.) is left to
+ * the grammar. The value is read the way the parser reads it. */
+static int read_number(const token_t *t, double *val)
+{
+	const char *s = t->s, *end = t->s + t->len;
+	int n, fraction = 0, exponent = 0;
+
+	if ( *s == '-' || *s == '+' )
+		s++;
+	if ( (n = digits(s, end - s)) == 0 )
+		return 0;
+	s += n;
+
+	if ( s < end && *s == '.' ) {
+		if ( (n = digits(s+1, end - s - 1)) == 0 )
+			return 0;
+		s += n + 1;
+		fraction = 1;
+	}
+
+	if ( s < end && (*s == 'e' || *s == 'E') ) {
+		s++;
+		if ( s < end && (*s == '-' || *s == '+') )
+			s++;
+		if ( (n = digits(s, end - s)) == 0 )
+			return 0;
+		s += n;
+		exponent = 1;
+	}
+
+	if ( s != end )
+		return 0;
+
+	// the token is followed by a blank or the newline, both stop the conversion
+	if ( fraction || exponent )
+		*val = strtod(t->s, NULL);
+	else
+		*val = (double) (int) strtoul(t->s, NULL, 10);
+
+	return 1;
+}
+
+/* 1 for a plain component line in [p, end), 2 for a blank or comment line,
+ * 0 for anything the grammar has to see */
+static int scan_line(const char *p, const char *end, line_t *l)
+{
+	token_t t;
+
+	p = next_token(p, end, &l->name);
+	if ( l->name.len == 0 || l->name.s[0] == '*' )
+		return 2;
+
+	if ( !strchr("rclviRCLVI", l->name.s[0]) || !is_name(&l->name) )
+		return 0;
+
+	p = next_token(p, end, &l->plus);
+	if ( !is_node(&l->plus) )
+		return 0;
+
+	p = next_token(p, end, &l->minus);
+	if ( !is_node(&l->minus) )
+		return 0;
+
+	p = next_token(p, end, &t);
+	if ( t.len == 0 || !read_number(&t, &l->val) )
+		return 0;
+
+	// a transient spec or a trailing comment
+	next_token(p, end, &t);
+	if ( t.len )
+		return 0;
+
+	return 1;
+}
+
+static unsigned int hash_token(const token_t *t)
+{
+	unsigned int h = 5381;
+	int i;
+
+	for ( i = 0; i < t->len; i++ )
+		h = h*33 + (unsigned char) t->s[i];
+
+	return h;
+}
+
+static void chunk_rehash(chunk_t *c, int size)
+{
+	unsigned int h, mask = size - 1;
+	int k;
+
+	c->table = (int*) realloc(c->table, sizeof(int)*size);
+	assert(c->table);
+	memset(c->table, -1, sizeof(int)*size);
+	c->table_size = size;
+
+	for ( k = 0; k < c->nnames; k++ ) {
+		for ( h = hash_token(&c->names[k]) & mask; c->table[h] >= 0; h = (h+1) & mask )
+			;
+		c->table[h] = k;
+	}
+}
+
+// chunk id of a node, names equal byte for byte share it
+static int chunk_node(chunk_t *c, const token_t *t)
+{
+	unsigned int h, mask = c->table_size - 1;
+	int k;
+
+	if ( is_integer(t) && is_ground(t) )
+		return -1;
+
+	for ( h = hash_token(t) & mask; (k = c->table[h]) >= 0; h = (h+1) & mask ) {
+		if ( c->names[k].len == t->len && memcmp(c->names[k].s, t->s, t->len) == 0 )
+			return k;
+	}
+
+	if ( c->nnames == c->names_cap ) {
+		c->names_cap = c->names_cap ? 2*c->names_cap : 1024;
+		c->names = (token_t*) realloc(c->names, sizeof(token_t)*c->names_cap);
+		c->global = (int*) realloc(c->global, sizeof(int)*c->names_cap);
+		assert(c->names && c->global);
+	}
+
+	k = c->nnames++;
+	c->names[k] = *t;
+	c->global[k] = 0;
+	c->table[h] = k;
+
+	// at most half full
+	if ( 2*c->nnames > c->table_size )
+		chunk_rehash(c, 2*c->table_size);
+
+	return k;
+}
+
+static record_t *chunk_record(chunk_t *c)
+{
+	if ( c->nrec == c->rec_cap ) {
+		c->rec_cap = c->rec_cap ? 2*c->rec_cap : 4096;
+		c->rec = (record_t*) realloc(c->rec, sizeof(record_t)*c->rec_cap);
+		assert(c->rec);
+	}
+
+	return &c->rec[c->nrec++];
+}
+
+/* Phase one, a task per chunk: takes the lines apart, converts the values and
+ * gives the node names chunk ids. Nothing global is touched. */
+static void scan_chunk(int id, int thread, void *arg)
+{
+	chunk_t *c = (chunk_t*) arg + id;
+	const char *p, *q;
+	record_t *r;
+	int kind, line, span = 0;
+	line_t l;
+
+	c->nrec = c->nnames = 0;
+	c->lead = c->begin;
+	if ( c->table == NULL )
+		chunk_rehash(c, 1024);
+	else
+		memset(c->table, -1, sizeof(int)*c->table_size);
+
+	for ( p = c->begin, line = 0; p < c->end; p = q + 1, line++ ) {
+		q = memchr(p, '\n', c->end - p);
+
+		// a last line without its newline is left to the grammar as it is
+		if ( q == NULL ) {
+			q = c->end - 1;
+			kind = 0;
+		} else {
+			kind = scan_line(p, q, &l);
+		}
+
+		// blank lines and comments stay with the grammar lines before them
+		if ( kind == 2 ) {
+			if ( span )
+				c->rec[c->nrec-1].name.len = q + 1 - c->rec[c->nrec-1].name.s;
+			else if ( c->nrec == 0 )
+				c->lead = q + 1;
+			continue;
+		}
+
+		if ( kind == 0 ) {
+			if ( !span ) {
+				r = chunk_record(c);
+				r->type = 0;
+				r->plus = line;
+				r->name.s = p;
+				span = 1;
+			}
+			c->rec[c->nrec-1].name.len = q + 1 - c->rec[c->nrec-1].name.s;
+			continue;
+		}
+
+		span = 0;
+		r = chunk_record(c);
+		r->type = tolower((unsigned char) l.name.s[0]);
+		r->name = l.name;
+		r->val = l.val;
+		r->plus = chunk_node(c, &l.plus);
+		r->minus = chunk_node(c, &l.minus);
+	}
+
+	c->lines = line;
+}
+
+/* Runs the grammar over the lines in [s, s+len), the first being line. The
+ * deck cannot start with an instruction, the newline before s (there is one
+ * unless s starts the file) lets the lines start like the rest of a deck. */
+static int parse_span(const char *buf, const char *s, size_t len, int line)
+{
+	FILE *in;
+	int ret;
+
+	if ( s > buf ) {
+		s--;
+		len++;
+		line--;
+	}
+
+	in = fmemopen((void*) s, len, "r");
+	assert(in);
+
+	yyrestart(in);
+	yylineno = line;
+	ret = yyparse();
+	fclose(in);
+
+	return ret;
+}
+
+static void merge_flush(merge_t *m)
+{
+	components_append(m->batch, m->nbatch);
+	m->nbatch = 0;
+}
+
+static int merge_span(merge_t *m)
+{
+	int ret;
+
+	if ( m->span == NULL )
+		return 0;
+
+	ret = parse_span(m->buf, m->span, m->span_end - m->span, m->span_line);
+	m->span = NULL;
+
+	return ret;
+}
+
+static int global_node(chunk_t *c, int k)
+{
+	if ( k < 0 )
+		return 0;
+	if ( c->global[k] == 0 )
+		c->global[k] = hash_get_slice(c->names[k].s, c->names[k].len);
+
+	return c->global[k];
+}
+
+/* Phase two, on the calling thread in file order: interns the names, runs the
+ * grammar lines where they stand and appends the elements between them, so
+ * node and element ids come out as a serial parse hands them out. */
+static int merge_chunk(merge_t *m, chunk_t *c, int line)
+{
+	element_t *e;
+	record_t *r;
+	int k, ret;
+
+	// a chunk may start with blank lines that follow grammar lines
+	if ( m->span && m->span_end == c->begin )
+		m->span_end = c->lead;
+
+	for ( k = 0; k < c->nrec; k++ ) {
+		r = &c->rec[k];
+
+		if ( r->type == 0 ) {
+			if ( m->span && m->span_end == r->name.s ) {
+				m->span_end = r->name.s + r->name.len;
+				continue;
+			}
+			if ( (ret = merge_span(m)) != 0 )
+				return ret;
+
+			merge_flush(m);
+			m->span = r->name.s;
+			m->span_end = r->name.s + r->name.len;
+			m->span_line = line + r->plus;
+			continue;
+		}
+
+		if ( (ret = merge_span(m)) != 0 )
+			return ret;
+
+		if ( m->nbatch == m->batch_cap ) {
+			m->batch_cap = m->batch_cap ? 2*m->batch_cap : 4096;
+			m->batch = (element_t*) realloc(m->batch, sizeof(element_t)*m->batch_cap);
+			assert(m->batch);
+		}
+
+		e = &m->batch[m->nbatch++];
+		e->type = r->type;
+		e->plus = global_node(c, r->plus);
+		e->minus = global_node(c, r->minus);
+		e->val = r->val;
+		e->string_id = NULL;
+		e->transient = NULL;
+		if ( r->type == 'v' || r->type == 'i' )
+			e->string_id = circuit_strndup(r->name.s, r->name.len);
+	}
+
+	merge_flush(m);
+
+	return 0;
+}
+
+// the first byte of chunk k, each chunk starts a line
+static const char *chunk_begin(const char *buf, const char *end, long k, long chunks)
+{
+	const char *p;
+
+	if ( k == 0 )
+		return buf;
+	if ( k == chunks )
+		return end;
+
+	p = memchr(buf + k*NETLIST_CHUNK - 1, '\n', end - buf - k*NETLIST_CHUNK + 1);
+
+	return p ? p + 1 : end;
+}
+
+// the whole file through the grammar, for what cannot be mapped
+static int parse_stream(const char *path)
+{
+	FILE *in;
+	int ret;
+
+	in = fopen(path, "r");
+	if ( in == NULL ) {
+		printf("[-] Could not open %s\n", path);
+		return 1;
+	}
+
+	yyrestart(in);
+	ret = yyparse();
+	fclose(in);
+
+	return ret;
+}
+
+/* Scans the chunks a round at a time, a chunk per thread, and merges each
+ * round before the next */
+static int parse_chunks(const char *buf, const char *end, long chunks)
+{
+	long first, k, round, tasks;
+	int line, ret = 0;
+	merge_t m = { buf };
+	chunk_t *c;
+
+	tasks = threads_count() < chunks ? threads_count() : chunks;
+	c = (chunk_t*) calloc(tasks, sizeof(chunk_t));
+	assert(c);
+
+	for ( first = 0, line = 1; first < chunks && ret == 0; first += round ) {
+		round = tasks < chunks - first ? tasks : chunks - first;
+
+		for ( k = 0; k < round; k++ ) {
+			c[k].begin = chunk_begin(buf, end, first + k, chunks);
+			c[k].end = chunk_begin(buf, end, first + k + 1, chunks);
+		}
+
+		parallel_for(round, scan_chunk, c);
+
+		for ( k = 0; k < round && ret == 0; k++ ) {
+			ret = merge_chunk(&m, &c[k], line);
+			line += c[k].lines;
+		}
+	}
+
+	if ( ret == 0 )
+		ret = merge_span(&m);
+
+	for ( k = 0; k < tasks; k++ ) {
+		free(c[k].rec);
+		free(c[k].names);
+		free(c[k].global);
+		free(c[k].table);
+	}
+	free(c);
+	free(m.batch);
+
+	return ret;
+}
+
+static uint64_t hash_line(const char *s, long n)
+{
+	uint64_t h = 14695981039346656037ULL, w;
+
+	for ( ; n >= 8; s += 8, n -= 8 ) {
+		memcpy(&w, s, 8);
+		h = (h ^ w) * 1099511628211ULL;
+		h ^= h >> 29;
+	}
+
+	w = 0;
+	memcpy(&w, s, n);
+	h = (h ^ w ^ (uint64_t) n) * 1099511628211ULL;
+
+	return h ^ (h >> 32);
+}
+
+/* The key pass, a task per chunk. The key is the sum of the hashes of the
+ * lines other than dot commands, the i-th of them weighted by KEY_BASE^i, so
+ * it does not depend on where the chunks are cut. The dot commands are kept
+ * as runs for the grammar. */
+#define KEY_BASE 0x9e3779b97f4a7c15ULL
+
+static void key_chunk(int id, int thread, void *arg)
+{
+	chunk_t *c = (chunk_t*) arg + id;
+	const char *p, *q, *s;
+	record_t *r;
+	int line, run = 0;
+
+	c->nrec = 0;
+	c->hash = 0;
+	c->power = 1;
+	c->bytes = 0;
+
+	for ( p = c->begin, line = 0; p < c->end; p = q + 1, line++ ) {
+		q = memchr(p, '\n', c->end - p);
+		if ( q == NULL )
+			q = c->end - 1;
+
+		for ( s = p; s < q && is_blank(*s); s++ )
+			;
+
+		if ( *s == '.' ) {
+			if ( !run ) {
+				r = chunk_record(c);
+				r->type = 0;
+				r->plus = line;
+				r->name.s = p;
+				run = 1;
+			}
+			c->rec[c->nrec-1].name.len = q + 1 - c->rec[c->nrec-1].name.s;
+			continue;
+		}
+
+		run = 0;
+		c->hash += hash_line(p, q + 1 - p) * c->power;
+		c->power *= KEY_BASE;
+		c->bytes += q + 1 - p;
+	}
+
+	c->lines = line;
+}
+
+// the dot commands of a deck the image restored the circuit of
+static int parse_commands(const char *buf, const chunk_t *c, long chunks)
+{
+	const record_t *r;
+	int line, ret;
+	long k, i;
+
+	for ( k = 0, line = 1; k < chunks; line += c[k].lines, k++ ) {
+		for ( i = 0; i < c[k].nrec; i++ ) {
+			r = &c[k].rec[i];
+			if ( (ret = parse_span(buf, r->name.s, r->name.len, line + r->plus)) != 0 )
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+int netlist_load(const char *path)
+{
+	const char *buf, *end;
+	uint64_t key = 0, power = 1;
+	chunk_t *c = NULL;
+	long chunks, k, bytes = 0;
+	int fd, ret = -1;
+	struct stat st;
+
+	fd = open(path, O_RDONLY);
+	if ( fd < 0 ) {
+		printf("[-] Could not open %s\n", path);
+		return 1;
+	}
+
+	if ( fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0 ) {
+		close(fd);
+		return parse_stream(path);
+	}
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( buf == MAP_FAILED )
+		return parse_stream(path);
+
+	madvise((void*) buf, st.st_size, MADV_SEQUENTIAL);
+	end = buf + st.st_size;
+	chunks = (st.st_size + NETLIST_CHUNK - 1) / NETLIST_CHUNK;
+
+	if ( netcache_enabled() ) {
+		c = (chunk_t*) calloc(chunks, sizeof(chunk_t));
+		assert(c);
+		for ( k = 0; k < chunks; k++ ) {
+			c[k].begin = chunk_begin(buf, end, k, chunks);
+			c[k].end = chunk_begin(buf, end, k + 1, chunks);
+		}
+
+		parallel_for(chunks, key_chunk, c);
+
+		for ( k = 0; k < chunks; k++ ) {
+			key += c[k].hash * power;
+			power *= c[k].power;
+			bytes += c[k].bytes;
+		}
+
+		if ( netcache_load(path, key, bytes) == 0 )
+			ret = parse_commands(buf, c, chunks);
+	}
+
+	if ( ret < 0 ) {
+		ret = parse_chunks(buf, end, chunks);
+		if ( ret == 0 && c )
+			netcache_save(path, key, bytes);
+	}
+
+	if ( c ) {
+		for ( k = 0; k < chunks; k++ )
+			free(c[k].rec);
+		free(c);
+	}
+
+	munmap((void*) buf, st.st_size);
+
+	return ret;
+}
@@ -0,0 +1,9 @@
+#ifndef NETLIST_H
+#define NETLIST_H
+
+/* Reads a netlist. The file is mapped and the R, C, L, V and I lines of the
+ * plain form (name, two nodes, a value) are scanned in place, every other
+ * line goes through the grammar. Returns 0 on success, like yyparse(). */
+int netlist_load(const char *path);
+
+#endif
@@ -4,10 +4,11 @@
 #define ITERATIVE_UNIMPLENTED assert(0 && "Iterative Methods are not implemented");
 #define SPARSE_UNIMPLEMENTED assert(0 && "Sparse matrices are not implemented");
 
-enum IterativeMethods   {BiCG, CG};
+enum IterativeMethods   {BiCG, CG, BiCGSTAB, GMRES};
 enum SolutionMethods    {Iterative, NonIterative};
 enum NonIterativeMethods{LUDecomp, CholDecomp};
 enum TransientMethods {Tr, Be};
+enum Preconditioners {Jacobi, IncompleteCholesky, IncompleteLU, AlgebraicMultigrid};
 
 
 extern int  sparse_use;
@@ -16,4 +17,14 @@ extern enum IterativeMethods method_iter;
 extern enum SolutionMethods method_choice;
 extern enum NonIterativeMethods method_noniter;
 extern double itol;
+extern int gmres_restart;
+extern int threads_use;
+extern int pin_use;             // pool thread i stays on cpu i
+extern enum Preconditioners precond_use;
+extern double precond_droptol;  // 0: IC(0)/ILU(0), otherwise ICT/ILUT
+extern int precond_fill;
+extern int warm_extrapolate;    // start a solve of a sequence from 2*x(n-1) - x(n-2)
+extern int recycle_size;        // earlier solutions kept to project the initial guess on, 0: off
+extern int mixed_use;           // single precision factors refined to double accuracy
+extern int reduce_use;          // solve the nodal system with the source and inductor rows eliminated
 #endif
@@ -69,7 +69,7 @@ node_id: STRING
   } else {
     char temp[50];
     sprintf(temp, "%u", $1);
-    $$ = hash_get(strdup(temp));
+    $$ = hash_get_slice(temp, strlen(temp));
   }
 }
 ;
@@ -115,10 +115,8 @@ STRING node_id node_id number transient_spec
     break;
 
     default:
-      free($1);
       return yyerror("Unknown component");
   }
-  free($1);
 }
 
 ;
@@ -129,15 +127,11 @@ options: OPTIONS option_list
 
 plot_list: plot_list PLOT_V
 {
-  char *c = strdup($2);
-  plot_node(hash_get($2), c);
-  free(c);
+  plot_node(hash_get($2), $2);
 }
 | PLOT_V
 {
-  char *c = strdup($1);
-  plot_node(hash_get($1), c);
-  free(c);
+  plot_node(hash_get($1), $1);
 }
 ;
 
@@ -174,13 +168,16 @@ instruction: TRAN number number
 ;
 
 pairs: pairs pair {
-  $$.pairs = (pair_t*) realloc($$.pairs, sizeof(pair_t)*($$.size+1));
+  /* doubled when the size reaches a power of two, the PWL rule copies the
+     pairs into the circuit */
+  if ( ($$.size & ($$.size-1)) == 0 )
+    $$.pairs = (pair_t*) realloc($$.pairs, sizeof(pair_t)*2*$$.size);
   $$.pairs[$$.size] = $2;
   $$.size++;
 }
 | pair
 {
-  $$.pairs = (pair_t*) calloc(1, sizeof(pair_t));
+  $$.pairs = (pair_t*) malloc(sizeof(pair_t));
   *($$.pairs)=$1;
   $$.size = 1;
 }
@@ -193,7 +190,7 @@ pair: LPAREN number number RPAREN
 
 transient_spec: SIN LPAREN number number number number number number RPAREN
 {
-  $$ = (transient_t*) calloc(1, sizeof(transient_t));
+  $$ = (transient_t*) circuit_alloc(sizeof(transient_t));
   $$->type = Sin;
   $$->tsin.i1 = $3;
   $$->tsin.ia = $4;
@@ -204,7 +201,7 @@ transient_spec: SIN LPAREN number number number number number number RPAREN
 }
 | EXP LPAREN number number number number number number RPAREN
 {
-  $$ = ( transient_t*) calloc(1, sizeof(transient_t));
+  $$ = (transient_t*) circuit_alloc(sizeof(transient_t));
 
   $$->type = Exp;
 
@@ -217,7 +214,7 @@ transient_spec: SIN LPAREN number number number number number number RPAREN
 }
 | PULSE LPAREN number number number number number number number RPAREN
 {
-  $$ = ( transient_t* ) calloc(1, sizeof(transient_t));
+  $$ = (transient_t*) circuit_alloc(sizeof(transient_t));
   $$->type = Pulse;
 
   $$->tpulse.i1 = $3;
@@ -230,10 +227,13 @@ transient_spec: SIN LPAREN number number number number number number RPAREN
 }
 | PWL pairs
 {
-   $$ = ( transient_t* ) calloc(1, sizeof(transient_t));
+   $$ = (transient_t*) circuit_alloc(sizeof(transient_t));
    $$->type = Pwl;
    
-   $$->tpwl = $2;
+   $$->tpwl.size = $2.size;
+   $$->tpwl.pairs = (pair_t*) circuit_alloc(sizeof(pair_t)*$2.size);
+   memcpy($$->tpwl.pairs, $2.pairs, sizeof(pair_t)*$2.size);
+   free($2.pairs);
 }
 |
 {
@@ -254,11 +254,15 @@ option: STRING
   } else if (strcasecmp($1, "iter") == 0) {
     method_choice = Iterative;
     method_iter = CG;
+  } else if (strcasecmp($1, "extrapolate") == 0) {
+    warm_extrapolate = 1;
+  } else if (strcasecmp($1, "mixed") == 0) {
+    mixed_use = 1;
+  } else if (strcasecmp($1, "reduce") == 0) {
+    reduce_use = 1;
   } else{
-    free($1);
     return yyerror("Uknown option");
   }
-  free($1);
 }
 | STRING STRING
 {
@@ -269,13 +273,9 @@ option: STRING
       method_iter = BiCG;
     else {
       yyerror("Invalid iter type");
-      free($1);
-      free($2);
       return 1;
     }
   }
-  free($1);
-  free($2);
 }
 | STRING ASSIGN STRING
 {
@@ -286,30 +286,60 @@ option: STRING
 			method_tran = Be;
 		} else {
 			yyerror("Expected \"TR\" or \"BE\"");
-			free($1);
-      free($3);
+			return 1;
+		}
+	} else if ( strcasecmp($1, "iter") == 0 ) {
+		method_choice = Iterative;
+		if ( strcasecmp($3, "cg") == 0 ) {
+			method_iter = CG;
+		} else if ( strcasecmp($3, "bicg") == 0 ) {
+			method_iter = BiCG;
+		} else if ( strcasecmp($3, "bicgstab") == 0 ) {
+			method_iter = BiCGSTAB;
+		} else if ( strcasecmp($3, "gmres") == 0 ) {
+			method_iter = GMRES;
+		} else {
+			yyerror("Expected \"CG\", \"BICG\", \"BICGSTAB\" or \"GMRES\"");
+			return 1;
+		}
+	} else if ( strcasecmp($1, "precond") == 0 ) {
+		if ( strcasecmp($3, "jacobi") == 0 ) {
+			precond_use = Jacobi;
+		} else if ( strcasecmp($3, "ic") == 0 ) {
+			precond_use = IncompleteCholesky;
+		} else if ( strcasecmp($3, "ilu") == 0 ) {
+			precond_use = IncompleteLU;
+		} else if ( strcasecmp($3, "amg") == 0 ) {
+			precond_use = AlgebraicMultigrid;
+		} else {
+			yyerror("Expected \"JACOBI\", \"IC\", \"ILU\" or \"AMG\"");
 			return 1;
 		}
 	} else {
-		yyerror("Expected \"METHOD\"");
-    free($1);
-    free($3);
+		yyerror("Expected \"METHOD\", \"ITER\" or \"PRECOND\"");
 		return 1;
 	}
-  free($1);
-  free($3);
 }
 | STRING ASSIGN number
 {
   if ( strcasecmp($1, "itol") == 0 ) {
     itol = $3;
+  } else if ( strcasecmp($1, "threads") == 0 ) {
+    threads_use = (int) $3;
+  } else if ( strcasecmp($1, "pin") == 0 ) {
+    pin_use = (int) $3 != 0;
+  } else if ( strcasecmp($1, "droptol") == 0 ) {
+    precond_droptol = $3;
+  } else if ( strcasecmp($1, "fill") == 0 ) {
+    precond_fill = (int) $3;
+  } else if ( strcasecmp($1, "restart") == 0 ) {
+    gmres_restart = (int) $3 > 0 ? (int) $3 : 1;
+  } else if ( strcasecmp($1, "recycle") == 0 ) {
+    recycle_size = (int) $3 > 0 ? (int) $3 : 0;
   } else {
     yyerror("Unknown Option");
-    free($1);
 		return 1;
   }
-
-  free($1);
 }
 ;
 %%
@@ -1,42 +1,73 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 int *nodes=NULL;
 FILE **files = NULL;
+static char **names = NULL;
 static int num_nodes = 0;
-extern int unique_hash;
+static int analyses = 0;  // analyses that wrote their files already
 
 void plot_node(int id, char *str) 
 {
-  char temp[1230];
-
   nodes = ( int* ) realloc(nodes, sizeof(int)*(num_nodes+1));
   files = ( FILE**) realloc(files, sizeof(FILE*) * (num_nodes+1));
+  names = ( char**) realloc(names, sizeof(char*) * (num_nodes+1));
 
-  sprintf(temp, "plot_v_%s", str);
-  files[num_nodes] = fopen(temp, "w");
+  files[num_nodes] = NULL;
+  names[num_nodes] = strdup(str);
   nodes[num_nodes] = id;
   num_nodes++;
 }
 
+void plot_open(const char *analysis)
+{
+  char temp[1230];
+  int i;
+
+  for (i=0; i<num_nodes; i++ ) {
+    if ( analyses == 0 )
+      snprintf(temp, sizeof(temp), "plot_v_%s", names[i]);
+    else
+      snprintf(temp, sizeof(temp), "plot_v_%s.%s", names[i], analysis);
+    files[i] = fopen(temp, "w");
+    if ( files[i] == NULL ) {
+      printf("[-] Failed to open %s\n", temp);
+      exit(1);
+    }
+  }
+}
+
 void print_plots(double x, double *sol, int *P)
 {
   int i =0;
-	if ( P )
-		for (i=0; i<num_nodes; i++ )
-			fprintf(files[i], "%10g %10g\n", x ,sol[P[i]]);
-	else
-		for (i=0; i<num_nodes; i++ )
-			fprintf(files[i], "%10g %10g\n", x ,sol[i]);
+
+	// the solvers hand back the solution in node order, P is only the pivoting
+	for (i=0; i<num_nodes; i++ )
+		fprintf(files[i], "%10g %10g\n", x ,sol[nodes[i]-1]);
 
 }
 
 void plot_finalize() {
   int i;
-  for (i=0;i<num_nodes; i++)
+  for (i=0;i<num_nodes; i++) {
     fclose(files[i]);
-	
+    files[i] = NULL;
+  }
+
+	analyses++;
+}
+
+void plot_cleanup() {
+  int i;
+  for (i=0;i<num_nodes; i++)
+    free(names[i]);
+
 	free(files);
 	free(nodes);
+	free(names);
+	files = NULL;
+	nodes = NULL;
+	names = NULL;
+	num_nodes = 0;
 }
-
@@ -1,8 +1,13 @@
 #ifndef PLOT_H
 #define PLOT_H
 
+/* The nodes of .PLOT are written one file each, plot_v_<node>. An analysis
+ * opens the files, prints its points and closes them again; when a deck runs
+ * more than one, the later ones write plot_v_<node>.<analysis>. */
 void plot_node(int id, char *str);
+void plot_open(const char *analysis);
 void print_plots(double x, double *sol, int *P);
 void plot_finalize();
+void plot_cleanup();
 
 #endif
@@ -0,0 +1,393 @@
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "csparse.h"
+#include "reduce.h"
+
+static int uf_find(int *uf, int i)
+{
+	while ( uf[i] != i ) {
+		uf[i] = uf[uf[i]];
+		i = uf[i];
+	}
+	return i;
+}
+
+/* The nodes (+1 and -1 entries) and the diagonal of branch k, from its
+ * column. Returns 0 for a column that is not a plain two terminal branch. */
+static int reduce_branch(reduce_t *R, int k)
+{
+	int i, p, c = R->nodes + k, p0, p1;
+	double a;
+
+	R->n1[k] = R->n2[k] = -1;
+	R->d[k] = 0;
+
+	p0 = R->A_s ? R->A_s->p[c] : 0;
+	p1 = R->A_s ? R->A_s->p[c+1] : R->size;
+
+	for ( p=p0; p<p1; p++ ) {
+		i = R->A_s ? R->A_s->i[p] : p;
+		a = R->A_s ? R->A_s->x[p] : R->A[i*R->size + c];
+
+		if ( i == c )
+			R->d[k] = a;
+		else if ( a == 0 )
+			continue;
+		else if ( i >= R->nodes )
+			return 0;  // coupled branches
+		else if ( a == 1 && R->n1[k] == -1 )
+			R->n1[k] = i;
+		else if ( a == -1 && R->n2[k] == -1 )
+			R->n2[k] = i;
+		else
+			return 0;
+	}
+
+	return R->n1[k] >= 0 || R->n2[k] >= 0;
+}
+
+// G(map[i],map[j]) += a, nothing for ground and the fixed nodes
+static void reduce_add(reduce_t *R, cs *T, int i, int j, double a)
+{
+	if ( i < 0 || j < 0 || R->map[i] < 0 || R->map[j] < 0 )
+		return;
+
+	if ( T )
+		cs_entry(T, R->map[i], R->map[j], a);
+	else
+		R->G[R->map[i]*R->rsize + R->map[j]] += a;
+}
+
+/* Chains of ties from ground and from the root of every merged group,
+ * breadth first so a node always comes after the node it is reached from. */
+static void reduce_order(reduce_t *R, int *uf)
+{
+	int i, k, p, u, w, head, tail, nb = R->size - R->nodes, nodes = R->nodes;
+	int *adjp, *adj, *queue;
+
+	adjp = (int*) calloc(nodes+2, sizeof(int));
+	adj = (int*) malloc(sizeof(int) * (2*nb + 1));
+	queue = (int*) malloc(sizeof(int) * (nodes+1));
+	assert(adjp && adj && queue);
+
+	// ground is node 'nodes' here
+	for ( k=0; k<nb; k++ ) {
+		if ( R->d[k] != 0 )
+			continue;
+		adjp[(R->n1[k] < 0 ? nodes : R->n1[k]) + 1]++;
+		adjp[(R->n2[k] < 0 ? nodes : R->n2[k]) + 1]++;
+	}
+	for ( i=0; i<=nodes; i++ )
+		adjp[i+1] += adjp[i];
+	for ( i=0; i<=nodes; i++ )
+		uf[i] = adjp[i];
+	for ( k=0; k<nb; k++ ) {
+		if ( R->d[k] != 0 )
+			continue;
+		adj[uf[R->n1[k] < 0 ? nodes : R->n1[k]]++] = k;
+		adj[uf[R->n2[k] < 0 ? nodes : R->n2[k]]++] = k;
+	}
+
+	for ( i=0; i<nodes; i++ )
+		R->from[i] = -2;  // not reached through a tie
+
+	R->norder = 0;
+	for ( k=-1; k<R->rsize; k++ ) {
+		queue[0] = k < 0 ? nodes : R->root[k];
+		for ( head=0, tail=1; head<tail; head++ ) {
+			u = queue[head];
+			for ( p=adjp[u]; p<adjp[u+1]; p++ ) {
+				w = R->n1[adj[p]] == (u == nodes ? -1 : u) ? R->n2[adj[p]] : R->n1[adj[p]];
+				if ( w < 0 || R->from[w] != -2 || w == queue[0] )
+					continue;
+
+				R->from[w] = u == nodes ? -1 : u;
+				R->edge[w] = adj[p];
+				R->order[R->norder++] = w;
+				queue[tail++] = w;
+			}
+		}
+	}
+
+	free(adjp);
+	free(adj);
+	free(queue);
+}
+
+/* Builds the reduction of the matrix A (dense) or A_s (sparse), which has to
+ * outlive it. Returns NULL when A is not an MNA matrix of two terminal
+ * branches or when the ties close a loop, a loop of voltage sources. */
+reduce_t *reduce_setup(double *A, cs *A_s, int size, int nodes)
+{
+	int i, j, k, p, r, g, nb = size - nodes, *uf, *group;
+	reduce_t *R;
+	cs *T = NULL;
+
+	R = (reduce_t*) calloc(1, sizeof(reduce_t));
+	assert(R);
+	R->size = size;
+	R->nodes = nodes;
+	R->A = A;
+	R->A_s = A_s;
+
+	R->n1 = (int*) malloc(sizeof(int) * (nb+1));
+	R->n2 = (int*) malloc(sizeof(int) * (nb+1));
+	R->d = (double*) malloc(sizeof(double) * (nb+1));
+	R->map = (int*) malloc(sizeof(int) * (nodes+1));
+	R->root = (int*) malloc(sizeof(int) * (nodes+1));
+	R->order = (int*) malloc(sizeof(int) * (nodes+1));
+	R->from = (int*) malloc(sizeof(int) * (nodes+1));
+	R->edge = (int*) malloc(sizeof(int) * (nodes+1));
+	R->off = (double*) calloc(nodes+1, sizeof(double));
+	R->res = (double*) calloc(nodes+1, sizeof(double));
+	uf = (int*) calloc(nodes+2, sizeof(int));
+	group = (int*) malloc(sizeof(int) * (nodes+1));
+	assert(R->n1 && R->n2 && R->d && R->map && R->root && R->order && R->from && R->edge);
+	assert(R->off && R->res && uf && group);
+
+	for ( k=0; k<nb; k++ ) {
+		if ( !reduce_branch(R, k) ) {
+			free(uf);
+			free(group);
+			return reduce_free(R);
+		}
+	}
+
+	// the ties merge their nodes, ground is node 'nodes'
+	for ( i=0; i<=nodes; i++ )
+		uf[i] = i;
+
+	for ( k=0; k<nb; k++ ) {
+		if ( R->d[k] != 0 )
+			continue;
+
+		i = uf_find(uf, R->n1[k] < 0 ? nodes : R->n1[k]);
+		j = uf_find(uf, R->n2[k] < 0 ? nodes : R->n2[k]);
+		if ( i == j ) {
+			free(uf);
+			free(group);
+			return reduce_free(R);
+		}
+		uf[i] = j;
+	}
+
+	// one unknown per group, the ground group is fixed
+	g = uf_find(uf, nodes);
+	for ( i=0; i<nodes; i++ )
+		group[i] = -1;
+
+	for ( i=0; i<nodes; i++ ) {
+		r = uf_find(uf, i);
+		if ( r == g ) {
+			R->map[i] = -1;
+			continue;
+		}
+		if ( group[r] < 0 ) {
+			group[r] = R->rsize;
+			R->root[R->rsize++] = i;
+		}
+		R->map[i] = group[r];
+	}
+
+	reduce_order(R, uf);
+	free(uf);
+	free(group);
+
+	if ( R->rsize == 0 )
+		return reduce_free(R);  // every node is set by a source
+
+	// G = T' * (A_nn + sum of B_k*B_k'/-d_k) * T, T the 0/1 map of the nodes
+	if ( A_s ) {
+		T = cs_spalloc(R->rsize, R->rsize, A_s->p[nodes] + 4*nb, 1, 1);
+		assert(T);
+	} else {
+		R->G = (double*) calloc((long) R->rsize*R->rsize + 1, sizeof(double));
+		assert(R->G);
+	}
+
+	for ( j=0; j<nodes; j++ ) {
+		if ( A_s ) {
+			for ( p=A_s->p[j]; p<A_s->p[j+1]; p++ )
+				if ( A_s->i[p] < nodes )
+					reduce_add(R, T, A_s->i[p], j, A_s->x[p]);
+		} else {
+			for ( i=0; i<nodes; i++ )
+				if ( A[i*size+j] != 0 )
+					reduce_add(R, T, i, j, A[i*size+j]);
+		}
+	}
+
+	for ( k=0; k<nb; k++ ) {
+		if ( R->d[k] == 0 )
+			continue;
+
+		reduce_add(R, T, R->n1[k], R->n1[k], -1/R->d[k]);
+		reduce_add(R, T, R->n2[k], R->n2[k], -1/R->d[k]);
+		reduce_add(R, T, R->n1[k], R->n2[k], 1/R->d[k]);
+		reduce_add(R, T, R->n2[k], R->n1[k], 1/R->d[k]);
+	}
+
+	if ( T ) {
+		R->G_s = cs_compress(T);
+		cs_spfree(T);
+		assert(R->G_s);
+		k = cs_dupl(R->G_s);
+		assert(k);
+	}
+
+	R->b = (double*) malloc(sizeof(double) * (R->rsize+1));
+	R->x = (double*) calloc(R->rsize+1, sizeof(double));
+	assert(R->b && R->x);
+
+	return R;
+}
+
+// the voltage of node i, -1 is ground
+static double node_voltage(const double *v, int i)
+{
+	return i < 0 ? 0 : v[i];
+}
+
+/* R->b for the full right hand side b: the node voltages the ties set are
+ * carried to the right hand side, as are the branch rows eliminated. */
+void reduce_rhs(reduce_t *R, const double *b)
+{
+	int i, j, k, o, p, nodes = R->nodes;
+	double t;
+
+	for ( o=0; o<R->norder; o++ ) {
+		i = R->order[o];
+		k = R->edge[i];
+		t = node_voltage(R->off, R->from[i]);
+		R->off[i] = i == R->n1[k] ? t + b[nodes+k] : t - b[nodes+k];  // v(n1) - v(n2) = b_k
+	}
+
+	for ( k=0; k<R->rsize; k++ )
+		R->b[k] = 0;
+
+	for ( i=0; i<nodes; i++ )
+		if ( R->map[i] >= 0 )
+			R->b[R->map[i]] += b[i];
+
+	for ( k=0; k<R->size-nodes; k++ ) {
+		if ( R->d[k] == 0 )
+			continue;
+
+		t = (node_voltage(R->off, R->n1[k]) - node_voltage(R->off, R->n2[k]) - b[nodes+k]) / R->d[k];
+		if ( R->n1[k] >= 0 && R->map[R->n1[k]] >= 0 )
+			R->b[R->map[R->n1[k]]] += t;
+		if ( R->n2[k] >= 0 && R->map[R->n2[k]] >= 0 )
+			R->b[R->map[R->n2[k]]] -= t;
+	}
+
+	// b -= A_nn * off, off is only set on the nodes reached through a tie
+	for ( o=0; o<R->norder; o++ ) {
+		j = R->order[o];
+		if ( R->off[j] == 0 )
+			continue;
+
+		if ( R->A_s ) {
+			for ( p=R->A_s->p[j]; p<R->A_s->p[j+1]; p++ ) {
+				i = R->A_s->i[p];
+				if ( i < nodes && R->map[i] >= 0 )
+					R->b[R->map[i]] -= R->A_s->x[p] * R->off[j];
+			}
+		} else {
+			for ( i=0; i<nodes; i++ )
+				if ( R->map[i] >= 0 )
+					R->b[R->map[i]] -= R->A[i*R->size+j] * R->off[j];
+		}
+	}
+}
+
+// R->x from a full initial guess, the roots carry no offset
+void reduce_guess(reduce_t *R, const double *x)
+{
+	int k;
+
+	for ( k=0; k<R->rsize; k++ )
+		R->x[k] = x[R->root[k]];
+}
+
+/* The full solution from R->x: the node voltages, the currents of the
+ * eliminated branches from their rows, and the currents of the ties from
+ * the residuals of the node rows, leaves first. R->off must be the one
+ * reduce_rhs() computed for b. */
+void reduce_expand(reduce_t *R, const double *b, double *x)
+{
+	int i, j, k, o, p, u, nodes = R->nodes;
+	double s, cur;
+
+	for ( i=0; i<nodes; i++ )
+		x[i] = R->off[i] + (R->map[i] >= 0 ? R->x[R->map[i]] : 0);
+
+	for ( k=0; k<R->size-nodes; k++ ) {
+		if ( R->d[k] == 0 )
+			x[nodes+k] = 0;
+		else
+			x[nodes+k] = (b[nodes+k] - node_voltage(x, R->n1[k]) + node_voltage(x, R->n2[k])) / R->d[k];
+	}
+
+	// residual of the node rows without the tie currents, A_nn is symmetric
+	for ( o=0; o<R->norder; o++ ) {
+		i = R->order[o];
+		s = b[i];
+		if ( R->A_s ) {
+			for ( p=R->A_s->p[i]; p<R->A_s->p[i+1]; p++ )
+				if ( R->A_s->i[p] < nodes )
+					s -= R->A_s->x[p] * x[R->A_s->i[p]];
+		} else {
+			for ( j=0; j<nodes; j++ )
+				s -= R->A[i*R->size+j] * x[j];
+		}
+		R->res[i] = s;
+	}
+
+	for ( k=0; k<R->size-nodes; k++ ) {
+		if ( R->d[k] == 0 )
+			continue;
+		if ( R->n1[k] >= 0 && R->from[R->n1[k]] != -2 )
+			R->res[R->n1[k]] -= x[nodes+k];
+		if ( R->n2[k] >= 0 && R->from[R->n2[k]] != -2 )
+			R->res[R->n2[k]] += x[nodes+k];
+	}
+
+	// the tie that reaches a node carries what is left of its residual
+	for ( o=R->norder-1; o>=0; o-- ) {
+		i = R->order[o];
+		k = R->edge[i];
+		cur = i == R->n1[k] ? R->res[i] : -R->res[i];
+		x[nodes+k] = cur;
+
+		u = R->from[i];
+		if ( u >= 0 && R->from[u] != -2 )
+			R->res[u] -= u == R->n1[k] ? cur : -cur;
+	}
+}
+
+reduce_t *reduce_free(reduce_t *R)
+{
+	if ( R == NULL )
+		return NULL;
+
+	free(R->n1);
+	free(R->n2);
+	free(R->d);
+	free(R->map);
+	free(R->root);
+	free(R->order);
+	free(R->from);
+	free(R->edge);
+	free(R->off);
+	free(R->res);
+	free(R->G);
+	cs_spfree(R->G_s);
+	free(R->b);
+	free(R->x);
+	free(R->B);
+	free(R->X);
+	free(R);
+
+	return NULL;
+}
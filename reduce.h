@@ -0,0 +1,43 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+#include "csparse.h"
+
+/* Nodal reduction of the MNA system. The branch rows of the voltage sources
+ * and of the inductors follow the node rows. A branch with a zero diagonal
+ * (a voltage source, an inductor at DC) ties the voltages of its nodes: the
+ * nodes a chain of them reaches are merged into one unknown, or fixed when
+ * the chain reaches ground. A branch with a diagonal (an inductor in the
+ * transient, -L/h) is eliminated into a conductance between its nodes. What
+ * is left is the nodal matrix, symmetric positive definite for a grounded
+ * network, and the branch currents are recovered after the solve. */
+
+typedef struct REDUCE_T
+{
+	int size;          // unknowns of the full system
+	int nodes;         // node voltages, the branch currents follow
+	int rsize;         // unknowns of the reduced system
+	int *map;          // node i is reduced unknown map[i], -1 when fixed by a chain to ground
+	int *root;         // reduced unknown k is the voltage of node root[k]
+	int norder;        // nodes reached through a branch, each after the node it is reached from
+	int *order;
+	int *from;         // node the branch of node i leaves from, -1 for ground
+	int *edge;         // branch that reaches node i
+	int *n1, *n2;      // nodes of each branch, -1 for ground
+	double *d;         // diagonal of each branch row, 0 for the ties
+	double *A;         // the full matrix, dense
+	cs *A_s;           // or sparse
+	double *G;         // the reduced matrix, dense
+	cs *G_s;           // or sparse
+	double *off;       // node voltages set by the sources alone
+	double *res;       // node residuals the tie currents are solved from
+	double *b, *x;     // reduced right hand side and solution
+	double *B, *X;     // the same for a batch of solve_lu_multi, NULL until its first call
+} reduce_t;
+
+reduce_t *reduce_setup(double *A, cs *A_s, int size, int nodes);
+void reduce_rhs(reduce_t *R, const double *b);
+void reduce_guess(reduce_t *R, const double *x);
+void reduce_expand(reduce_t *R, const double *b, double *x);
+reduce_t *reduce_free(reduce_t *R);
+
+#endif
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include "options.h"
+#include "threads.h"
+
+#define MAX_THREADS 256
+
+typedef struct JOB_T
+{
+	void (*task)(int id, int thread, void *arg);
+	void *arg;
+	int tasks;
+	int pinned;     // task id runs on thread id % threads, see parallel_for_pinned
+	int next;       // next task index to hand out
+	int running;    // workers still inside the job
+} job_t;
+
+static pthread_t workers[MAX_THREADS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+
+static job_t job;
+static int generation = 0;
+static int num_threads = 0;
+static int shutting_down = 0;
+static int in_parallel = 0;  // nested calls run inline on the calling thread
+static int pinned = 0;       // the pool runs with thread i on cpu i of the mask below
+static cpu_set_t cpus;       // the cpus the process was allowed on before pinning
+
+int threads_count()
+{
+	char *env;
+
+	if ( num_threads )
+		return num_threads;
+
+	if ( threads_use > 0 ) {
+		num_threads = threads_use;
+	} else if ( (env = getenv("ZICE_THREADS")) != NULL && atoi(env) > 0 ) {
+		num_threads = atoi(env);
+	} else {
+		num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	if ( num_threads < 1 )
+		num_threads = 1;
+	if ( num_threads > MAX_THREADS )
+		num_threads = MAX_THREADS;
+
+	return num_threads;
+}
+
+static void run_tasks(int thread)
+{
+	int id;
+
+	if ( job.pinned ) {
+		for ( id=thread; id<job.tasks; id+=num_threads )
+			job.task(id, thread, job.arg);
+		return;
+	}
+
+	while ( (id = __sync_fetch_and_add(&job.next, 1)) < job.tasks )
+		job.task(id, thread, job.arg);
+}
+
+/* Thread i runs on the i-th cpu the process was allowed on (wrapping around),
+ * so the row blocks parallel_for_pinned gives it, and first touches, stay in
+ * the memory node of that cpu. */
+static void pin_thread(int thread)
+{
+	cpu_set_t one;
+	int cpu, n = thread % CPU_COUNT(&cpus);
+
+	for ( cpu=0; cpu<CPU_SETSIZE; cpu++ )
+		if ( CPU_ISSET(cpu, &cpus) && n-- == 0 )
+			break;
+
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+}
+
+static void *worker(void *arg)
+{
+	int thread = (int) (long) arg;
+	int seen = 0;
+
+	if ( pinned )
+		pin_thread(thread);
+
+	pthread_mutex_lock(&lock);
+	for ( ;; ) {
+		while ( generation == seen && !shutting_down )
+			pthread_cond_wait(&start, &lock);
+
+		if ( shutting_down )
+			break;
+
+		seen = generation;
+		pthread_mutex_unlock(&lock);
+
+		run_tasks(thread);
+
+		pthread_mutex_lock(&lock);
+		if ( --job.running == 0 )
+			pthread_cond_signal(&done);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+static int started = 0;
+
+static void threads_start()
+{
+	long i;
+
+	pinned = pin_use && pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+
+	for ( i=1; i<threads_count(); i++ ) {
+		if ( pthread_create(&workers[i], NULL, worker, (void*) i) != 0 ) {
+			printf("[-] Failed to start worker thread\n");
+			exit(1);
+		}
+	}
+
+	// after the workers are created, they would inherit it
+	if ( pinned )
+		pin_thread(0);
+
+	started = 1;
+#ifdef VERBOSE
+	printf("[$] Using %d threads\n", threads_count());
+#endif
+}
+
+static void parallel_run(int tasks, int pinned, void (*task)(int id, int thread, void *arg), void *arg)
+{
+	int id;
+
+	if ( tasks <= 0 )
+		return;
+
+	if ( threads_count() == 1 || tasks == 1 || in_parallel ) {
+		for ( id=0; id<tasks; id++ )
+			task(id, 0, arg);
+		return;
+	}
+
+	if ( !started )
+		threads_start();
+
+	pthread_mutex_lock(&lock);
+	in_parallel = 1;
+	job.task = task;
+	job.arg = arg;
+	job.tasks = tasks;
+	job.pinned = pinned;
+	job.next = 0;
+	job.running = num_threads - 1;
+	generation++;
+	pthread_cond_broadcast(&start);
+	pthread_mutex_unlock(&lock);
+
+	run_tasks(0);
+
+	pthread_mutex_lock(&lock);
+	while ( job.running > 0 )
+		pthread_cond_wait(&done, &lock);
+	in_parallel = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+void parallel_for(int tasks, void (*task)(int id, int thread, void *arg), void *arg)
+{
+	parallel_run(tasks, 0, task, arg);
+}
+
+void parallel_for_pinned(int tasks, void (*task)(int id, int thread, void *arg), void *arg)
+{
+	parallel_run(tasks, 1, task, arg);
+}
+
+void threads_cleanup()
+{
+	int i;
+
+	if ( !started )
+		return;
+
+	pthread_mutex_lock(&lock);
+	shutting_down = 1;
+	pthread_cond_broadcast(&start);
+	pthread_mutex_unlock(&lock);
+
+	for ( i=1; i<num_threads; i++ )
+		pthread_join(workers[i], NULL);
+
+	if ( pinned )
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	// the workers of a restarted pool start from seen = 0, a job left over
+	// from this one must not look new to them
+	generation = 0;
+
+	started = 0;
+	shutting_down = 0;
+}
+
+void threads_reset()
+{
+	if ( started && pinned != pin_use )
+		threads_cleanup();
+
+	if ( threads_use <= 0 || threads_use == num_threads )
+		return;
+
+	threads_cleanup();
+	num_threads = 0;
+}
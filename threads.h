@@ -0,0 +1,22 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+/* Fork-join pool used by the dense and sparse kernels. A parallel_for hands
+ * out task indices 0..tasks-1 in increasing order, the calling thread takes
+ * part, and the call returns once every task is done. */
+
+int  threads_count();
+void parallel_for(int tasks, void (*task)(int id, int thread, void *arg), void *arg);
+
+/* Same, but task id always runs on thread id % threads_count(), so data a
+ * task touches first stays in the memory and cache of the same thread.
+ * With .options pin=1, pool thread i is also bound to the i-th cpu the
+ * process may run on. */
+void parallel_for_pinned(int tasks, void (*task)(int id, int thread, void *arg), void *arg);
+void threads_cleanup();
+
+/* The netlist reader runs on the pool before the .options of the deck are
+ * read, this sizes it again if a threads option asks for another count. */
+void threads_reset();
+
+#endif
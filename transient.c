@@ -17,161 +17,178 @@ int do_transient = 0;
 
 double tran_step;
 double tran_finish;
-extern double *G, *C, *dc, *rhs, *TempMatrix, *L, *U; // mna.c
+extern double *G, *C, *dc, *rhs; // mna.c
 extern int *P;//mna.c
-extern double *m;
+extern precond_t *M;
 extern cs *C_s, *G_s;
 
 
-void transient_analysis_tr()
+/* y = A*x on whichever representation is in use */
+static void matvec(double *A, cs *A_s, double *x, double *y, int size)
 {
-	int size = voltages + inductors + unique_hash;
-	int i,j;
-	double t, temp, temp2;
-
-	double *swap;
-	double *e = (double*) malloc(sizeof(double)*size);
-	double *sol  = (double*) malloc(sizeof(double)*size);
-	double *rhs0 = (double*) malloc(sizeof(double)*size);
+	if ( sparse_use == 0 ) {
+		multiply_matrix_vector(A, x, y, size);
+	} else {
+		settozero(y, size);
+		cs_gaxpy(A_s, x, y);
+	}
+}
 
-	t = 2/tran_step;
+/* Builds G + alpha*C once and makes it the system matrix the solvers work on.
+ * The DC conductance is handed back through G_dc/G_s_dc for the history terms. */
+static void transient_setup(double alpha, double **G_dc, cs **G_s_dc, int size)
+{
+	int i;
+	double *A;
 
-	for (i=0; i<size; i++) {
-		for (j=0; j<size; j++ ) {
-			c_write(i,j, c_read(i,j)*t); // C[i*size+j] *= t;
+	*G_dc = G;
+	*G_s_dc = G_s;
 
-			temp = g_read(i,j);
-			temp2 = c_read(i,j);
+	if ( sparse_use == 0 ) {
+		A = (double*) malloc(sizeof(double)*size*size);
+		assert(A);
 
-			g_add(i, j, temp2);
-			c_write(i, j, temp-temp2);
-		}
+		for (i=0; i<size*size; i++)
+			A[i] = G[i] + alpha*C[i];
 
-		sol[i] = dc[i];
-		rhs0[i] = rhs[i];
+		G = A;
+	} else {
+		G_s = cs_add(G_s, C_s, 1, alpha);
+		assert(G_s);
 	}
 
 	if ( method_choice == NonIterative ) {
-		decompose(size, &P, method_noniter);
-	} else {
-		if ( sparse_use == 0 ) {
-			for (i=0; i<size; i++) {
-				m[i] = G[i*size+i];
-				if ( fabs(m[i]) < 0.000001 )
-					m[i] = 1;
-				else
-					m[i] = 1/m[i];
-			}
-		} else {
-			cs_get_diag(G_s, m, size);
+		if ( decompose(size, &P, method_noniter) != 0 ) {
+			printf("[-] Failed to decompose the transient matrix\n");
+			exit(0);
 		}
+	} else {
+		M = precond_setup(M, size);
 	}
+}
 
-	if ( sparse_use == 1 )
-		G_s = cs_compress(G_s);
-
-	for ( t=tran_step; t <= tran_finish; t+=tran_step ) {
-		generate_rhs(rhs, size, unique_hash, 1, t);
-
-		/*for (i=0; i<size; i++) {
-			rhs0[i] += rhs[i];
-			for (j=0; j<size; j++ )
-				rhs0[i] -=  c_read(i,j) * sol[j];
-		}*/
-		
-		for ( i=0; i<size; i++ ) {
-			e[i] = 0;
-			for ( j=0; j< size; j++ )
-				e[i] += c_read(i,j)*sol[j];
-			
-			e[i]= rhs[i] + rhs0[i] - e[i];
-		}
+static void transient_restore(double *G_dc, cs *G_s_dc, int size)
+{
+	if ( sparse_use == 0 ) {
+		free(G);
+		G = G_dc;
+	} else {
+		cs_spfree(G_s);
+		G_s = G_s_dc;
+	}
 
-		// rhs = e-1(t) + e(t) -*((G-2/hC)*X(n-1))
+	// a .DC sweep after the transient solves with G again
+	if ( method_choice != NonIterative )
+		M = precond_setup(M, size);
+}
 
-		solve(m, P, sol, rhs0, size);
-		print_plots(t,sol, P);
+/* Solves step n into sol[1], the iterative methods start from the previous
+ * solution or its extrapolation. The buffers are swapped after,
+ * so sol[0] is always the latest solution and sol[1] the one before it. */
+static void transient_solve(solver_t *ws, double *b, int size, int n)
+{
+	int i;
+	double *swap;
 
-		swap = rhs;
-		rhs = rhs0;
-		rhs0 = swap;
+	if ( method_choice != NonIterative ) {
+		if ( warm_extrapolate && n > 1 ) {
+			for ( i=0; i<size; i++ )
+				ws->sol[1][i] = 2*ws->sol[0][i] - ws->sol[1][i];
+		} else {
+			memcpy(ws->sol[1], ws->sol[0], sizeof(double)*size);
+		}
 	}
 
-	plot_finalize();
+	solve(M, P, ws->sol[1], b, size);
 
-	free(sol);
-	free(rhs0);
+	swap = ws->sol[0];
+	ws->sol[0] = ws->sol[1];
+	ws->sol[1] = swap;
 }
 
-int Doolittle_LU_Decomposition_with_Pivoting(double *A, int pivot[], int n);
-int Doolittle_LU_with_Pivoting_Solve(double *A, double B[], int pivot[],
-		double x[], int n);
-
-
-void transient_analysis_be()
+void transient_analysis_tr()
 {
 	int size = voltages + inductors + unique_hash;
-	int i,j;
-	double t, k;
+	int i, n;
+	double t, alpha;
+	double *G_dc;
+	cs *G_s_dc;
+	double *swap, *e, *e0;
+	solver_t *ws;
 
-	double *sol = (double*) malloc(sizeof(double)*size);
-	assert(sol);
+	alpha = 2/tran_step;
 
-	t = 1/tran_step;
+	transient_setup(alpha, &G_dc, &G_s_dc, size);
+	ws = solver_context(size);
 
-	for (i=0; i<size; i++) {
-		for (j=0; j<size; j++ ) {
-			k = c_read(i,j)*t;
-			c_write(i, j, k ); // C[i*size+j] *= t;
-			g_add(i,j, k); // G[i*size+j] += C[i*size+j];
-		}
+	memcpy(ws->sol[0], dc, sizeof(double)*size);
+	generate_rhs(ws->rhs[1], size, unique_hash, 0, 0);
 
-		sol[i] = 0;
-	}
+	plot_open("tran");
+	for ( n=1, t=tran_step; t <= tran_finish; t+=tran_step, n++ ) {
+		e = ws->rhs[0];
+		e0 = ws->rhs[1];
+		generate_rhs(e, size, unique_hash, 1, t);
 
+		// (G+2/h*C)*X(n) = e(n) + e(n-1) - (G-2/h*C)*X(n-1)
+		matvec(G_dc, G_s_dc, ws->sol[0], ws->gx, size);
+		matvec(C, C_s, ws->sol[0], ws->cx, size);
 
-	if ( method_choice == NonIterative ) {
-		decompose(size, &P, method_noniter);
-	} else {
-		if ( sparse_use == 0 ) {
-			for (i=0; i<size; i++) {
-				m[i] = G[i*size+i];
-				if ( fabs(m[i]) < 0.000001 )
-					m[i] = 1;
-				else
-					m[i] = 1/m[i];
-			}
-		} else {
-			cs_get_diag(G_s, m, size);
-		}
-	}
+		// e(n-1) is not needed after this step, the right hand side goes over it
+		for ( i=0; i<size; i++ )
+			e0[i] = e[i] + e0[i] - ws->gx[i] + alpha*ws->cx[i];
 
-	if ( sparse_use == 1 ) {
-		G_s = cs_compress(G_s);
-		assert(G_s);
+		transient_solve(ws, e0, size, n);
+		print_plots(t, ws->sol[0], P);
+
+		swap = ws->rhs[0];
+		ws->rhs[0] = ws->rhs[1];
+		ws->rhs[1] = swap;
 	}
-		
 
-	for ( t=0; t <= tran_finish; t+=tran_step ) {
-		generate_rhs(rhs, size, unique_hash, 1, t);
+	plot_finalize();
+	transient_restore(G_dc, G_s_dc, size);
+}
+
+void transient_analysis_be()
+{
+	int size = voltages + inductors + unique_hash;
+	int i, n;
+	double t, alpha;
+	double *G_dc;
+	cs *G_s_dc;
+	double *b;
+	solver_t *ws;
+
+	alpha = 1/tran_step;
+
+	transient_setup(alpha, &G_dc, &G_s_dc, size);
+	ws = solver_context(size);
+	b = ws->rhs[0];
 
-		for (i=0; i<size; i++)
-			for (j=0; j<size; j++ )
-				rhs[i]+= c_read(i, j) * sol[j];
+	memcpy(ws->sol[0], dc, sizeof(double)*size);
 
-		// rhs = e(t)+1/h*(C*X(n-1))
+	plot_open("tran");
+	for ( n=1, t=tran_step; t <= tran_finish; t+=tran_step, n++ ) {
+		generate_rhs(b, size, unique_hash, 1, t);
 
-		solve(m, P, sol, rhs, size);
+		// (G+1/h*C)*X(n) = e(n) + 1/h*C*X(n-1)
+		matvec(C, C_s, ws->sol[0], ws->cx, size);
 
-		print_array(rhs, size, stdout);
-		printf("----\n");
-		print_array(sol, size, stdout);
+		for ( i=0; i<size; i++ )
+			b[i] += alpha*ws->cx[i];
+
+		transient_solve(ws, b, size, n);
+
+#ifdef VERBOSE
+		print_array(ws->sol[0], size, stdout);
 		printf("\n\n");
-		print_plots(t,sol, P);
+#endif
+		print_plots(t, ws->sol[0], P);
 	}
 
 	plot_finalize();
-
+	transient_restore(G_dc, G_s_dc, size);
 }
 
 void transient_analysis()
@@ -181,6 +198,7 @@ void transient_analysis()
 	else if ( method_tran == Be )
 		transient_analysis_be();
 
+	iter_report("Transient");
 	printf("[+] Transient analysis: Done\n");
 }
 